@@ -2,17 +2,20 @@
 #define COMMON_H
 
 #include "timer.h"
+#include "stackwalk.h"
 
 #include <exec/types.h>
 #include <stddef.h>
 
-#define MAX_STACK_DEPTH 30
+#define DEFAULT_STACK_DEPTH 30
 #define MAX_TASKS 100
 #define NAME_LEN 256
 #define MAX_LOAD_AVERAGES (15*60)
+#define RUN_QUEUE_BINS 9 // Histogram of 0...7 runnable tasks, and 8 or more
 
 typedef struct Sample {
     struct Task* task; // Currently running task, collected by timer interrupt
+    uint32 switches; // Task switches since previous sample, from DispCount
     //uint32 forbidCount; // TODO: could collect for each task. But it needs zeroing during flip
 } Sample;
 
@@ -29,11 +32,21 @@ typedef struct SampleData {
     Sample* sampleBuffer; // Task data
     uint32 uniqueTasks; // Number of unique tasks identified
     uint32 forbidCount; // Number of samples collected with task switching disabled
+    uint32 runQueueSum; // Sum of runnable task counts
+    uint32 runQueueHistogram[RUN_QUEUE_BINS]; // Number of samples by runnable task count
 } SampleData;
 
+#define STACK_TRACE_FORBID 0x1 // Task switching was disabled when sampled
+#define STACK_TRACE_SUPERVISOR 0x2 // Interrupted code ran in supervisor mode
+#define STACK_TRACE_USER 0x4 // Interrupted code ran in user (problem state) mode
+#define STACK_TRACE_LINK_REGISTER 0x8 // Second frame is the link register, not yet checked against the first
+
 typedef struct StackTraceSample {
     struct Task* task; // Related task
-    ULONG* addresses[MAX_STACK_DEPTH]; // Stores collected instruction pointers of collected stack traces
+    uint32 delta; // EClock ticks since previous stack trace sample
+    uint32 position; // Frame arena position of the first collected instruction pointer
+    uint32 depth; // Number of collected instruction pointers and repeat markers, innermost first
+    uint32 flags; // STACK_TRACE_* flags
 } StackTraceSample;
 
 typedef struct Profiling {
@@ -44,12 +57,52 @@ typedef struct Profiling {
     StackTraceSample* samples;
     size_t stackTraces; // Number of stack traces collected
     size_t maxStackTraces; // 30 (seconds) * samples
+    size_t nextStackTrace; // Ring buffer index where next stack trace is stored
+    uint64 totalStackTraces; // Number of stack traces collected since start, including overwritten ones
+    ULONG maxDepth; // Maximum number of frames collected per stack trace
+    ULONG** frames; // Ring arena of instruction pointers, each stack trace sample is a contiguous record
+    uint32 frameArenaSize; // Number of instruction pointers in arena, always a power of two
+    uint32 framePosition; // Arena position where next record is stored, wraps around
+    size_t stackTracesTruncated; // Stack traces that were deeper than maxDepth
+    size_t depthHistogram[MAX_STACK_DEPTH + 1]; // Number of stack traces by collected depth
+    uint64 lastTimestamp; // EClock ticks of the most recent stack trace sample
     size_t validSymbols; // Number of valid symbols found. (For example, not NULL)
     size_t uniqueSymbols; // Number of unique symbols found
     size_t uniqueStackTraces; // Number of unique stack traces found
+    size_t evictedSymbols; // Symbols replaced by new ones when symbol table was full
+    size_t evictedStackTraces; // Stack traces replaced by new ones when stack trace table was full
     size_t stackFrameLoopDetected; // When back chain pointer points to the current stack frame
     size_t stackFrameNotAligned; // When stack frame pointers don't have 16-byte relative alignment
     size_t stackFrameOutOfBounds; // When stack frame pointer exceeds lower or upper bound
+    size_t savedContextWalks; // Stack traces walked from the saved stack pointer, without interrupted registers
+    size_t linkRegisterFramesDropped; // Link register frames that returned into the sampled function itself
+
+    char foldedFile[NAME_LEN]; // Collapsed stack output for flame graph tools, empty when disabled
+    char pprofFile[NAME_LEN]; // Gzipped pprof profile output, empty when disabled
+    char htmlFile[NAME_LEN]; // Interactive flame graph page output, empty when disabled
+    char chromeTraceFile[NAME_LEN]; // Chrome trace event timeline output, empty when disabled
+    char speedscopeFile[NAME_LEN]; // Speedscope timeline output, empty when disabled
+
+    BOOL continuous; // Aggregate stack traces into time windows while running
+    ULONG windowLength; // Length of a continuous profiling window in seconds
+    ULONG maxWindows; // Number of windows kept, the oldest is dropped first
+    char windowDir[NAME_LEN]; // Directory for window files, empty for current directory
+
+    ULONG reservoirSize; // Number of stack traces kept by uniform random sampling, 0 when disabled
+
+    BOOL phases; // Collect samples into time buckets, one per display interval
+    char phaseCsvFile[NAME_LEN]; // Time bucket CSV output, empty when disabled
+
+    ULONG offCpuRate; // Wait list snapshots per second, 0 when off-CPU profiling is disabled
+    ULONG semaphoreRate; // Semaphore list snapshots per second, 0 when disabled
+    BOOL spinDetection; // Find tasks looping in the same few instructions
+
+    char taskFilter[NAME_LEN]; // AmigaDOS pattern selecting tasks for the per-task report, empty for all
+    ULONG annotatedFunctions; // Number of top functions shown with hot addresses, 0 when disabled
+
+    char baselineFile[NAME_LEN]; // Collapsed stack file to compare against, empty when not comparing
+    char candidateFile[NAME_LEN]; // Collapsed stack file compared to baseline
+    char diffHtmlFile[NAME_LEN]; // Differential flame graph output, empty when disabled
 } Profiling;
 
 typedef struct Context {
@@ -62,15 +115,21 @@ typedef struct Context {
     ULONG totalSamples; // interval * samples
     ULONG taskSwitchesPerSecond;
     ULONG lastDispCount;
+    ULONG sampledDispCount; // DispCount at the previous timer interrupt
+    ULONG peakSwitchesPerSecond; // Highest 100 ms task switch rate during the last interval
+    ULONG peakTickSwitchesPerSecond; // Highest single tick task switch rate during the last interval
+    char switchCsvFile[NAME_LEN]; // Task switch rate CSV output, empty when disabled
 
     BOOL debugMode; // Display extra debug information when enabled
     BOOL gui; // Start in GUI mode
     BOOL running; // TRUE until program is quit
     BOOL customRendering; // Alternative (simpler and faster) GUI mode
     BOOL symbolLookupWorkaroundNeeded; // WA needed for kernel version <= 54.46
+    BOOL portMonitor; // Count messages queued at public message ports each interval
 
     BYTE timerSignal; // Signaled by timer interrupt when data enough data is collected for display
     BYTE lastSignal; // Signaled by timer interrupt when quitting. Main program waits for timer to "stop"
+    BYTE semaphoreSignal; // Signaled by timer interrupt when a semaphore snapshot is due, -1 when not used
     struct Task* mainTask; // Tequila main program
     struct Interrupt* interrupt; // Tequila timer interrupt
 
@@ -86,6 +145,13 @@ typedef struct Context {
     float loadAverage5; // load average of last 5 minutes
     float loadAverage15; // load average of last 15 minutes
 
+    float runQueue; // Average number of runnable tasks during the last interval
+    float* runQueueAverage; // stored run queue lengths over time
+    float runQueue1; // run queue length average of last 60 seconds
+    float runQueue5; // run queue length average of last 5 minutes
+    float runQueue15; // run queue length average of last 15 minutes
+    uint64 runQueueHistogram[RUN_QUEUE_BINS]; // Number of samples by runnable task count since start
+
     char* cliNameBuffer; // String buffer for shell process names
 
     TimerContext sampler; // Context for timer interrupt
@@ -0,0 +1,440 @@
+#include "continuous.h"
+#include "folded.h"
+#include "hashmap.h"
+#include "intern.h"
+#include "profiler.h"
+#include "symbols.h"
+#include "tasknames.h"
+#include "common.h"
+
+#include <proto/dos.h>
+#include <proto/exec.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Continuous mode drains the stack trace ring buffer while sampling and
+// aggregates samples into fixed-length windows. Only unique stacks and their
+// counts are kept per window, so a long ring of windows stays small. Each window
+// has its own strings, which are freed with the window when it is dropped.
+
+// Environment variable selecting the windows Control-F writes, like "0" for the
+// open window or "1-5" for the five windows closed before it
+#define SELECT_VARIABLE "TequilaWindows"
+
+typedef struct WindowEntry {
+    uint32 stack; // Id of the folded stack string
+    uint32 count; // Number of samples
+} WindowEntry;
+
+typedef struct ProfileWindow {
+    struct DateStamp start; // Wall clock time of the first sample
+    uint32 samples; // Number of samples aggregated, including empty stack traces
+    size_t count; // Number of entries
+    WindowEntry* entries;
+    InternTable strings; // Task names, frames and complete stacks of the window
+    BOOL written; // TRUE when window is already written to a file
+} ProfileWindow;
+
+typedef struct Continuous {
+    ProfileWindow* windows; // Ring of closed windows
+    size_t nextWindow; // Ring index where next closed window is stored
+    size_t windowCount; // Number of closed windows stored
+    ProfileWindow current; // Window being collected, entries are in counts
+    HashMap counts; // Stack string id -> sample count of the current window
+    HashMap tasks; // Task -> task name string id, cleared with each window
+    HashMap frames; // Address -> frame string id, cleared with each window
+    uint64 readStackTraces; // Number of stack traces drained from the ring buffer
+    uint64 lostStackTraces; // Number of stack traces overwritten before draining
+    char* buffer; // Stack string buffer
+    BOOL symbolsOpen;
+} Continuous;
+
+static Continuous cont;
+
+static uint32 GetFrame(const uint32* ip)
+{
+    uint32* frame = HashMapGet(&cont.frames, (uint32)ip);
+
+    if (frame) {
+        return *frame;
+    }
+
+    AppendFoldedFrame(cont.buffer, 0, FOLDED_STACK_LEN, ip);
+
+    const uint32 id = InternString(&cont.current.strings, cont.buffer);
+
+    frame = HashMapAdd(&cont.frames, (uint32)ip);
+    if (frame) {
+        *frame = id;
+    }
+
+    return id;
+}
+
+static size_t AppendString(size_t length, const uint32 id)
+{
+    const char* string = GetInternedString(&cont.current.strings, id);
+
+    while (*string && length + 1 < FOLDED_STACK_LEN) {
+        cont.buffer[length++] = *string++;
+    }
+
+    cont.buffer[length] = '\0';
+
+    return length;
+}
+
+static void AddSample(const StackTraceSample* sample)
+{
+    if (cont.current.samples++ == 0) {
+        IDOS->DateStamp(&cont.current.start);
+    }
+
+    ULONG** addresses = GetStackTraceAddresses(sample);
+
+    if (!addresses || sample->depth == 0) {
+        // Empty stack traces have no frames to show
+        return;
+    }
+
+    uint32 ids[MAX_STACK_DEPTH];
+    ULONG* frames[MAX_STACK_DEPTH];
+    const size_t frameCount = ExpandRepeats(addresses, sample->depth, frames, MAX_STACK_DEPTH);
+    size_t depth = 0;
+
+    // Resolve names first, lookups use the same buffer
+    while (depth < frameCount) {
+        ids[depth] = GetFrame(frames[depth]);
+        depth++;
+    }
+
+    const uint32 task = InternTaskName(sample->task, &cont.tasks, &cont.current.strings);
+    size_t length = AppendFoldedName(cont.buffer, 0, FOLDED_STACK_LEN, GetInternedString(&cont.current.strings, task));
+
+    while (depth > 0) {
+        if (length + 1 < FOLDED_STACK_LEN) {
+            cont.buffer[length++] = ';';
+        }
+
+        length = AppendString(length, ids[--depth]);
+    }
+
+    const uint32 stack = InternString(&cont.current.strings, cont.buffer);
+
+    if (stack) {
+        uint32* count = HashMapAdd(&cont.counts, stack);
+        if (count) {
+            (*count)++;
+        }
+    }
+}
+
+// Copies the stacks of the open window, returns NULL when there are none
+static WindowEntry* GetEntries(size_t* count)
+{
+    WindowEntry* entries = cont.counts.count ? AllocateMemory(cont.counts.count * sizeof(WindowEntry)) : NULL;
+
+    *count = 0;
+
+    if (entries) {
+        for (size_t slot = 0; slot < cont.counts.capacity; slot++) {
+            if (cont.counts.keys[slot]) {
+                entries[*count].stack = cont.counts.keys[slot];
+                entries[*count].count = cont.counts.values[slot];
+                (*count)++;
+            }
+        }
+    } else if (cont.counts.count) {
+        puts("Failed to allocate profile window");
+    }
+
+    return entries;
+}
+
+static void FreeWindow(ProfileWindow* window)
+{
+    if (window->entries) {
+        FreeMemory(window->entries);
+        window->entries = NULL;
+    }
+
+    FreeInternTable(&window->strings);
+}
+
+static void CloseWindow(void)
+{
+    ProfileWindow* window = &cont.windows[cont.nextWindow];
+
+    // Oldest window is dropped with its strings
+    FreeWindow(window);
+
+    *window = cont.current;
+    window->entries = GetEntries(&window->count);
+
+    if (++cont.nextWindow >= ctx.profiling.maxWindows) {
+        cont.nextWindow = 0;
+    }
+
+    if (cont.windowCount < ctx.profiling.maxWindows) {
+        cont.windowCount++;
+    }
+
+    memset(&cont.current, 0, sizeof(ProfileWindow));
+
+    if (!InitInternTable(&cont.current.strings)) {
+        puts("Failed to allocate profile window strings");
+    }
+
+    ClearHashMap(&cont.counts);
+
+    // Tasks and modules come and go, refresh names for the next window
+    ClearHashMap(&cont.tasks);
+    ClearHashMap(&cont.frames);
+}
+
+static size_t GetDaysInYear(const uint32 year)
+{
+    const BOOL leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+
+    return leap ? 366 : 365;
+}
+
+static void FormatFileName(const struct DateStamp* start, char* buffer)
+{
+    static const uint8 daysInMonth[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+    // DateStamp days are counted from 1.1.1978
+    uint32 days = (uint32)start->ds_Days;
+    uint32 year = 1978;
+    uint32 month = 0;
+
+    while (days >= GetDaysInYear(year)) {
+        days -= GetDaysInYear(year++);
+    }
+
+    while (month < 11) {
+        const uint32 length = daysInMonth[month] + ((month == 1 && GetDaysInYear(year) == 366) ? 1u : 0u);
+
+        if (days < length) {
+            break;
+        }
+
+        days -= length;
+        month++;
+    }
+
+    const uint32 minute = (uint32)start->ds_Minute;
+    const uint32 second = (uint32)start->ds_Tick / TICKS_PER_SECOND;
+
+    // Names sort by time, so concatenating a range of files is easy
+    char name[64];
+    snprintf(name, sizeof(name), "tequila-%04lu%02lu%02lu-%02lu%02lu%02lu.folded",
+             year, month + 1, days + 1, minute / 60, minute % 60, second);
+
+    snprintf(buffer, NAME_LEN, "%s", ctx.profiling.windowDir);
+    IDOS->AddPart(buffer, name, NAME_LEN);
+}
+
+static BOOL WriteWindow(ProfileWindow* window)
+{
+    char fileName[NAME_LEN];
+    FormatFileName(&window->start, fileName);
+
+    FILE* file = fopen(fileName, "w");
+
+    if (!file) {
+        printf("Failed to open '%s' for writing\n", fileName);
+        return FALSE;
+    }
+
+    for (size_t i = 0; i < window->count; i++) {
+        fprintf(file, "%s %lu\n", GetInternedString(&window->strings, window->entries[i].stack), window->entries[i].count);
+    }
+
+    fclose(file);
+
+    window->written = TRUE;
+
+    return TRUE;
+}
+
+// Open window is written as it is now, and again in full when it closes. It keeps
+// its start time, so the full file replaces the partial one
+static BOOL WriteOpenWindow(void)
+{
+    ProfileWindow window = cont.current;
+    window.entries = GetEntries(&window.count);
+
+    const BOOL success = WriteWindow(&window);
+
+    if (window.entries) {
+        FreeMemory(window.entries);
+    }
+
+    return success;
+}
+
+// Reads the range of window ages to write, 0 being the open window
+static BOOL GetSelection(uint32* first, uint32* last)
+{
+    char value[32];
+
+    if (IDOS->GetVar(SELECT_VARIABLE, value, sizeof(value), 0) <= 0) {
+        return FALSE;
+    }
+
+    char* end = NULL;
+    *first = strtoul(value, &end, 10);
+    *last = *end == '-' ? strtoul(end + 1, NULL, 10) : *first;
+
+    if (*last < *first) {
+        const uint32 age = *first;
+        *first = *last;
+        *last = age;
+    }
+
+    return TRUE;
+}
+
+// Writes the selected windows again, even when written before. Without a selection
+// writes the closed windows not yet written and the open window
+static void WriteWindows(const BOOL select)
+{
+    uint32 first = 0;
+    uint32 last = (uint32)cont.windowCount;
+    const BOOL selected = select && GetSelection(&first, &last);
+    size_t written = 0;
+    BOOL success = TRUE;
+
+    // Oldest window first
+    size_t index = (cont.nextWindow + ctx.profiling.maxWindows - cont.windowCount) % ctx.profiling.maxWindows;
+
+    for (size_t i = 0; i < cont.windowCount; i++) {
+        ProfileWindow* window = &cont.windows[index];
+        const size_t age = cont.windowCount - i;
+
+        if (window->samples && age >= first && age <= last && (selected || !window->written)) {
+            success = WriteWindow(window);
+            if (!success) {
+                break;
+            }
+            written++;
+        }
+
+        if (++index >= ctx.profiling.maxWindows) {
+            index = 0;
+        }
+    }
+
+    if (success && first == 0 && cont.current.samples && WriteOpenWindow()) {
+        written++;
+    }
+
+    if (selected) {
+        printf("Wrote %u profile window(s) aged %lu-%lu to '%s'\n", written, first, last, ctx.profiling.windowDir);
+    } else {
+        printf("Wrote %u profile window(s) to '%s'\n", written, ctx.profiling.windowDir);
+    }
+
+    if (cont.lostStackTraces) {
+        printf("%llu stack trace(s) were overwritten before they could be aggregated\n", cont.lostStackTraces);
+    }
+}
+
+void WriteProfileWindows(void)
+{
+    UpdateContinuousProfiling();
+
+    WriteWindows(TRUE);
+}
+
+void UpdateContinuousProfiling(void)
+{
+    const uint32 windowSamples = ctx.profiling.windowLength * ctx.samples;
+
+    size_t index;
+    size_t pending = GetNewStackTraces(&cont.readStackTraces, &index, &cont.lostStackTraces);
+
+    while (pending > 0) {
+        AddSample(&ctx.profiling.samples[index]);
+
+        if (cont.current.samples >= windowSamples) {
+            CloseWindow();
+        }
+
+        if (++index >= ctx.profiling.maxStackTraces) {
+            index = 0;
+        }
+
+        pending--;
+    }
+}
+
+BOOL InitContinuousProfiling(void)
+{
+    memset(&cont, 0, sizeof(cont));
+
+    cont.symbolsOpen = OpenSymbols();
+
+    if (!cont.symbolsOpen) {
+        puts("Failed to get IDebug");
+        return FALSE;
+    }
+
+    cont.windows = AllocateMemory(ctx.profiling.maxWindows * sizeof(ProfileWindow));
+    cont.buffer = AllocateMemory(FOLDED_STACK_LEN);
+
+    if (!cont.windows || !cont.buffer) {
+        puts("Failed to allocate profile windows");
+        return FALSE;
+    }
+
+    if (!InitHashMap(&cont.counts, 0) ||
+        !InitHashMap(&cont.tasks, 0) ||
+        !InitHashMap(&cont.frames, 0) ||
+        !InitInternTable(&cont.current.strings)) {
+        puts("Failed to allocate profile window tables");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void FreeContinuousProfiling(void)
+{
+    if (cont.windows && cont.buffer && cont.current.strings.slotCount) {
+        UpdateContinuousProfiling();
+
+        if (cont.current.samples) {
+            CloseWindow();
+        }
+
+        WriteWindows(FALSE);
+    }
+
+    if (cont.windows) {
+        for (size_t i = 0; i < ctx.profiling.maxWindows; i++) {
+            FreeWindow(&cont.windows[i]);
+        }
+
+        FreeMemory(cont.windows);
+        cont.windows = NULL;
+    }
+
+    if (cont.buffer) {
+        FreeMemory(cont.buffer);
+        cont.buffer = NULL;
+    }
+
+    FreeHashMap(&cont.counts);
+    FreeHashMap(&cont.tasks);
+    FreeHashMap(&cont.frames);
+    FreeInternTable(&cont.current.strings);
+
+    if (cont.symbolsOpen) {
+        CloseSymbols();
+        cont.symbolsOpen = FALSE;
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef CONTINUOUS_H
+#define CONTINUOUS_H
+
+#include <exec/types.h>
+
+BOOL InitContinuousProfiling(void);
+// Closes the current window, writes windows not yet written and frees everything
+void FreeContinuousProfiling(void);
+
+// Moves new stack trace samples from the interrupt ring buffer to the current window
+void UpdateContinuousProfiling(void);
+// Writes each window selected by the TequilaWindows variable to its own folded file,
+// or without the variable the closed windows not yet written and the open window
+void WriteProfileWindows(void);
+
+#endif
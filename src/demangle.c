@@ -0,0 +1,1355 @@
+#include "demangle.h"
+#include "hashmap.h"
+#include "intern.h"
+#include "common.h"
+
+#include <proto/exec.h>
+
+#include <stdio.h>
+#include <string.h>
+
+// Demangler for the Itanium C++ ABI mangling used by GCC:
+// https://itanium-cxx-abi.github.io/cxx-abi/abi.html#mangling
+// It covers names, types, templates, substitutions and special names.
+// Expressions in template arguments are not supported, those names are shown mangled.
+
+#define ARENA_SIZE 32768
+#define MAX_SUBSTITUTIONS 256
+#define MAX_TEMPLATE_ARGS 64
+#define MAX_PACK_ELEMENTS 64
+#define MAX_RECURSION 128
+
+// Type is printed as left + right. Declarators go between them, for example
+// pointer to function "void (*)(int)" has "void (" and ")(int)" around "*".
+typedef struct Type {
+    const char* left;
+    const char* right;
+} Type;
+
+typedef struct TemplateArg {
+    Type type;
+    size_t packStart; // First element in packElements
+    int packSize; // Number of elements, -1 when argument is not a pack
+} TemplateArg;
+
+typedef struct Substitution {
+    Type type;
+    int templateParam; // Template parameter is resolved when used, -1 for other types
+} Substitution;
+
+typedef struct Parser {
+    const char* p; // Next character to parse
+    size_t used; // Bytes used in the arena
+    BOOL failed;
+    unsigned recursion;
+    Substitution substitutions[MAX_SUBSTITUTIONS];
+    size_t substitutionCount;
+    TemplateArg templateArgs[MAX_TEMPLATE_ARGS]; // Referenced by template parameters T_, T0_...
+    size_t templateArgCount;
+    Type packElements[MAX_PACK_ELEMENTS];
+    size_t packElementCount;
+    int packIndex; // Pack element being expanded, -1 outside of pack expansion
+    int packSize; // Size of the pack referenced during expansion, -1 when none
+    unsigned templateArgDepth; // Nesting level of template argument lists being parsed
+    BOOL captureTemplateArgs; // Set while parsing the name of a function
+    BOOL noReturnType; // Last unqualified name was a constructor, destructor or conversion operator
+    BOOL hideReturnType; // Set while parsing function that encloses a local name
+    char arena[ARENA_SIZE]; // Strings built during parsing
+} Parser;
+
+typedef struct Demangler {
+    InternTable names; // Both mangled and demangled names
+    HashMap results; // Mangled name id + 1 -> demangled name id + 1
+} Demangler;
+
+static Demangler* demangler;
+
+static const char* Parse(Parser* parser, const char* (*function)(Parser*));
+static const char* ParseEncoding(Parser* parser);
+static const char* ParseName(Parser* parser, BOOL* templated, const char** qualifiers);
+static Type ParseType(Parser* parser);
+static const char* ParseTemplateArgs(Parser* parser, const char* name);
+
+static void Fail(Parser* parser)
+{
+    parser->failed = TRUE;
+}
+
+static char Peek(const Parser* parser)
+{
+    return parser->failed ? '\0' : *parser->p;
+}
+
+static char PeekNext(const Parser* parser)
+{
+    return (parser->failed || !parser->p[0]) ? '\0' : parser->p[1];
+}
+
+static BOOL Consume(Parser* parser, const char c)
+{
+    if (Peek(parser) == c) {
+        parser->p++;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void Expect(Parser* parser, const char c)
+{
+    if (!Consume(parser, c)) {
+        Fail(parser);
+    }
+}
+
+static void* Allocate(Parser* parser, const size_t size)
+{
+    // Keep allocations aligned for structures
+    const size_t start = (parser->used + 7) & ~(size_t)7;
+
+    if (parser->failed || start + size > ARENA_SIZE) {
+        Fail(parser);
+        return NULL;
+    }
+
+    parser->used = start + size;
+
+    return parser->arena + start;
+}
+
+static const char* Append(Parser* parser, const char* a, const char* b, const char* c)
+{
+    const size_t lengths[3] = { strlen(a), strlen(b), strlen(c) };
+    char* result = Allocate(parser, lengths[0] + lengths[1] + lengths[2] + 1);
+
+    if (!result) {
+        return "";
+    }
+
+    memcpy(result, a, lengths[0]);
+    memcpy(result + lengths[0], b, lengths[1]);
+    memcpy(result + lengths[0] + lengths[1], c, lengths[2] + 1);
+
+    return result;
+}
+
+static const char* Copy(Parser* parser, const char* string, const size_t length)
+{
+    char* result = Allocate(parser, length + 1);
+
+    if (!result) {
+        return "";
+    }
+
+    memcpy(result, string, length);
+    result[length] = '\0';
+
+    return result;
+}
+
+static const char* TypeToString(Parser* parser, const Type type)
+{
+    return Append(parser, type.left, type.right, "");
+}
+
+static Type SimpleType(const char* name)
+{
+    const Type type = { name, "" };
+    return type;
+}
+
+static void AddTemplateParamSubstitution(Parser* parser, const Type type, const int templateParam)
+{
+    if (parser->substitutionCount < MAX_SUBSTITUTIONS) {
+        parser->substitutions[parser->substitutionCount].type = type;
+        parser->substitutions[parser->substitutionCount].templateParam = templateParam;
+        parser->substitutionCount++;
+    } else {
+        Fail(parser);
+    }
+}
+
+static void AddSubstitution(Parser* parser, const Type type)
+{
+    AddTemplateParamSubstitution(parser, type, -1);
+}
+
+static long ParseNumber(Parser* parser)
+{
+    const BOOL negative = Consume(parser, 'n');
+    long value = 0;
+
+    if (Peek(parser) < '0' || Peek(parser) > '9') {
+        Fail(parser);
+        return 0;
+    }
+
+    while (Peek(parser) >= '0' && Peek(parser) <= '9') {
+        value = value * 10 + (*parser->p++ - '0');
+    }
+
+    return negative ? -value : value;
+}
+
+// <seq-id> _ where seq-id is base 36 plus one, and empty seq-id means 0
+static size_t ParseSequenceId(Parser* parser)
+{
+    size_t value = 0;
+
+    if (Consume(parser, '_')) {
+        return 0;
+    }
+
+    for (;;) {
+        const char c = Peek(parser);
+
+        if (c >= '0' && c <= '9') {
+            value = value * 36 + (size_t)(c - '0');
+        } else if (c >= 'A' && c <= 'Z') {
+            value = value * 36 + (size_t)(c - 'A' + 10);
+        } else {
+            break;
+        }
+
+        parser->p++;
+    }
+
+    Expect(parser, '_');
+
+    return value + 1;
+}
+
+// _ <digit> or __ <number> _
+static void SkipDiscriminator(Parser* parser)
+{
+    if (Consume(parser, '_')) {
+        if (Consume(parser, '_')) {
+            ParseNumber(parser);
+            Expect(parser, '_');
+        } else {
+            ParseNumber(parser);
+        }
+    }
+}
+
+static const char* ParseSourceName(Parser* parser)
+{
+    const long length = ParseNumber(parser);
+
+    if (parser->failed || length <= 0 || (long)strnlen(parser->p, (size_t)length) < length) {
+        Fail(parser);
+        return "";
+    }
+
+    const char* name = parser->p;
+    parser->p += length;
+
+    if (length >= 10 && strncmp(name, "_GLOBAL_", 8) == 0 && name[9] == 'N') {
+        return "(anonymous namespace)";
+    }
+
+    return Copy(parser, name, (size_t)length);
+}
+
+typedef struct Operator {
+    char code[3];
+    const char* name;
+} Operator;
+
+static const Operator operators[] = {
+    { "nw", "new" }, { "na", "new[]" }, { "dl", "delete" }, { "da", "delete[]" },
+    { "ps", "+" }, { "ng", "-" }, { "ad", "&" }, { "de", "*" }, { "co", "~" },
+    { "pl", "+" }, { "mi", "-" }, { "ml", "*" }, { "dv", "/" }, { "rm", "%" },
+    { "an", "&" }, { "or", "|" }, { "eo", "^" }, { "aS", "=" }, { "pL", "+=" },
+    { "mI", "-=" }, { "mL", "*=" }, { "dV", "/=" }, { "rM", "%=" }, { "aN", "&=" },
+    { "oR", "|=" }, { "eO", "^=" }, { "ls", "<<" }, { "rs", ">>" }, { "lS", "<<=" },
+    { "rS", ">>=" }, { "eq", "==" }, { "ne", "!=" }, { "lt", "<" }, { "gt", ">" },
+    { "le", "<=" }, { "ge", ">=" }, { "ss", "<=>" }, { "nt", "!" }, { "aa", "&&" },
+    { "oo", "||" }, { "pp", "++" }, { "mm", "--" }, { "cm", "," }, { "pm", "->*" },
+    { "pt", "->" }, { "cl", "()" }, { "ix", "[]" }, { "qu", "?" }, { "aw", "co_await" }
+};
+
+static const char* ParseOperatorName(Parser* parser)
+{
+    if (Consume(parser, 'c')) {
+        if (Consume(parser, 'v')) {
+            // Conversion operator
+            return Append(parser, "operator ", TypeToString(parser, ParseType(parser)), "");
+        }
+
+        parser->p--;
+    }
+
+    if (Peek(parser) == 'l' && PeekNext(parser) == 'i') {
+        parser->p += 2;
+        return Append(parser, "operator\"\" ", ParseSourceName(parser), "");
+    }
+
+    if (Peek(parser) == 'v' && PeekNext(parser) >= '0' && PeekNext(parser) <= '9') {
+        parser->p += 2;
+        return Append(parser, "operator ", ParseSourceName(parser), "");
+    }
+
+    for (size_t i = 0; i < sizeof(operators) / sizeof(operators[0]); i++) {
+        if (Peek(parser) == operators[i].code[0] && PeekNext(parser) == operators[i].code[1]) {
+            const char* name = operators[i].name;
+            parser->p += 2;
+            return Append(parser, "operator", (name[0] >= 'a' && name[0] <= 'z') ? " " : "", name);
+        }
+    }
+
+    Fail(parser);
+
+    return "";
+}
+
+static const char* ParseParameters(Parser* parser, const char terminator)
+{
+    const char* parameters = "";
+
+    // Single void parameter means no parameters
+    if (Peek(parser) == 'v' && (PeekNext(parser) == terminator || PeekNext(parser) == '\0' || PeekNext(parser) == '.')) {
+        parser->p++;
+        return parameters;
+    }
+
+    while (!parser->failed && Peek(parser) != terminator && Peek(parser) != '\0' && Peek(parser) != '.') {
+        // Ref-qualifier at the end of a function type
+        if ((Peek(parser) == 'R' || Peek(parser) == 'O') && PeekNext(parser) == terminator) {
+            break;
+        }
+
+        const char* type = TypeToString(parser, ParseType(parser));
+        parameters = Append(parser, parameters, (parameters[0] && type[0]) ? ", " : "", type);
+    }
+
+    return parameters;
+}
+
+static const char* ParseUnnamedTypeName(Parser* parser)
+{
+    if (Consume(parser, 't')) {
+        const unsigned number = (Peek(parser) == '_') ? 1 : (unsigned)ParseNumber(parser) + 2;
+        char buffer[32];
+        Expect(parser, '_');
+        snprintf(buffer, sizeof(buffer), "{unnamed type#%u}", number);
+        return Copy(parser, buffer, strlen(buffer));
+    }
+
+    if (Consume(parser, 'l')) {
+        const char* parameters = ParseParameters(parser, 'E');
+        Expect(parser, 'E');
+        const unsigned number = (Peek(parser) == '_') ? 1 : (unsigned)ParseNumber(parser) + 2;
+        char buffer[32];
+        Expect(parser, '_');
+        snprintf(buffer, sizeof(buffer), ")#%u}", number);
+        return Append(parser, "{lambda(", parameters, buffer);
+    }
+
+    Fail(parser);
+
+    return "";
+}
+
+static const char* ParseAbiTags(Parser* parser, const char* name)
+{
+    while (Consume(parser, 'B')) {
+        name = Append(parser, name, "[abi:", Append(parser, ParseSourceName(parser), "]", ""));
+    }
+
+    return name;
+}
+
+// Returns last component of a qualified name without template arguments
+static const char* GetClassName(Parser* parser, const char* scope)
+{
+    const char* start = scope;
+    const char* end = NULL;
+    int depth = 0;
+
+    for (const char* p = scope; *p; p++) {
+        if (*p == '<' || *p == '(' || *p == '[') {
+            if (depth++ == 0 && *p != '(' && !end) {
+                end = p;
+            }
+        } else if (*p == '>' || *p == ')' || *p == ']') {
+            depth--;
+        } else if (depth == 0 && p[0] == ':' && p[1] == ':') {
+            start = p + 2;
+            end = NULL;
+        }
+    }
+
+    return Copy(parser, start, end ? (size_t)(end - start) : strlen(start));
+}
+
+// Scope is the enclosing name, needed by constructors and destructors
+static const char* ParseUnqualifiedName(Parser* parser, const char* scope)
+{
+    const char c = Peek(parser);
+    const char* name;
+
+    parser->noReturnType = FALSE;
+
+    if (c >= '0' && c <= '9') {
+        name = ParseSourceName(parser);
+    } else if (c == 'C' && (PeekNext(parser) >= '1' && PeekNext(parser) <= '5')) {
+        parser->p += 2;
+        name = GetClassName(parser, scope);
+        parser->noReturnType = TRUE;
+    } else if (c == 'C' && PeekNext(parser) == 'I') {
+        // Inheriting constructor
+        parser->p += 3;
+        ParseType(parser);
+        name = GetClassName(parser, scope);
+        parser->noReturnType = TRUE;
+    } else if (c == 'D' && (PeekNext(parser) >= '0' && PeekNext(parser) <= '5')) {
+        parser->p += 2;
+        name = Append(parser, "~", GetClassName(parser, scope), "");
+        parser->noReturnType = TRUE;
+    } else if (c == 'U') {
+        parser->p++;
+        name = ParseUnnamedTypeName(parser);
+    } else if (c == 'L') {
+        // Internal linkage name
+        parser->p++;
+        name = ParseUnqualifiedName(parser, scope);
+        SkipDiscriminator(parser);
+    } else if (c >= 'a' && c <= 'z') {
+        name = ParseOperatorName(parser);
+        parser->noReturnType = (strncmp(name, "operator ", 9) == 0);
+    } else {
+        Fail(parser);
+        return "";
+    }
+
+    return ParseAbiTags(parser, name);
+}
+
+static Type ResolveTemplateParam(Parser* parser, const size_t index)
+{
+    if (parser->failed || index >= parser->templateArgCount) {
+        Fail(parser);
+        return SimpleType("");
+    }
+
+    const TemplateArg* arg = &parser->templateArgs[index];
+
+    if (parser->packIndex >= 0 && arg->packSize >= 0) {
+        parser->packSize = arg->packSize;
+        return (parser->packIndex < arg->packSize) ? parser->packElements[arg->packStart + (size_t)parser->packIndex] : SimpleType("");
+    }
+
+    return arg->type;
+}
+
+// Standard abbreviations are written in full when they are a prefix of constructor or destructor
+static Type ParseSubstitution(Parser* parser, const BOOL prefix)
+{
+    static const struct {
+        char code;
+        const char* name;
+        const char* fullName;
+    } standard[] = {
+        { 'a', "std::allocator", "std::allocator" },
+        { 'b', "std::basic_string", "std::basic_string" },
+        { 's', "std::string", "std::basic_string<char, std::char_traits<char>, std::allocator<char> >" },
+        { 'i', "std::istream", "std::basic_istream<char, std::char_traits<char> >" },
+        { 'o', "std::ostream", "std::basic_ostream<char, std::char_traits<char> >" },
+        { 'd', "std::iostream", "std::basic_iostream<char, std::char_traits<char> >" }
+    };
+
+    Expect(parser, 'S');
+
+    for (size_t i = 0; i < sizeof(standard) / sizeof(standard[0]); i++) {
+        if (Consume(parser, standard[i].code)) {
+            const BOOL full = prefix && (Peek(parser) == 'C' || Peek(parser) == 'D');
+            return SimpleType(full ? standard[i].fullName : standard[i].name);
+        }
+    }
+
+    const size_t index = ParseSequenceId(parser);
+
+    if (parser->failed || index >= parser->substitutionCount) {
+        Fail(parser);
+        return SimpleType("");
+    }
+
+    if (parser->substitutions[index].templateParam >= 0) {
+        return ResolveTemplateParam(parser, (size_t)parser->substitutions[index].templateParam);
+    }
+
+    return parser->substitutions[index].type;
+}
+
+static Type ParseTemplateParam(Parser* parser)
+{
+    Expect(parser, 'T');
+
+    return ResolveTemplateParam(parser, ParseSequenceId(parser));
+}
+
+static const char* ParseNestedName(Parser* parser, BOOL* templated, const char** qualifiers)
+{
+    Expect(parser, 'N');
+
+    const char* cv = "";
+
+    if (Consume(parser, 'r')) {
+        cv = Append(parser, cv, " restrict", "");
+    }
+
+    if (Consume(parser, 'V')) {
+        cv = Append(parser, " volatile", cv, "");
+    }
+
+    if (Consume(parser, 'K')) {
+        cv = Append(parser, " const", cv, "");
+    }
+
+    if (Consume(parser, 'R')) {
+        cv = Append(parser, cv, " &", "");
+    } else if (Consume(parser, 'O')) {
+        cv = Append(parser, cv, " &&", "");
+    }
+
+    *qualifiers = cv;
+
+    const char* name = "";
+
+    while (!parser->failed && !Consume(parser, 'E')) {
+        const char c = Peek(parser);
+        *templated = FALSE;
+
+        if (c == 'S' && PeekNext(parser) == 't') {
+            parser->p += 2;
+            name = Append(parser, name, name[0] ? "::" : "", "std");
+            continue;
+        } else if (c == 'S' && !name[0]) {
+            name = TypeToString(parser, ParseSubstitution(parser, TRUE));
+            continue;
+        } else if (c == 'T') {
+            name = TypeToString(parser, ParseTemplateParam(parser));
+        } else if (c == 'I') {
+            if (!name[0]) {
+                Fail(parser);
+            }
+            name = ParseTemplateArgs(parser, name);
+            *templated = TRUE;
+        } else if (c == 'M') {
+            // Closure data member prefix
+            parser->p++;
+            continue;
+        } else {
+            name = Append(parser, name, name[0] ? "::" : "", ParseUnqualifiedName(parser, name));
+        }
+
+        // Every prefix is a substitution candidate, but the complete name is not
+        if (Peek(parser) != 'E') {
+            AddSubstitution(parser, SimpleType(name));
+        }
+    }
+
+    return name;
+}
+
+// Qualifiers of a local member function, like the const of a lambda call operator,
+// are passed on to the encoding
+static const char* ParseLocalName(Parser* parser, BOOL* templated, const char** qualifiers)
+{
+    Expect(parser, 'Z');
+
+    // Local name may be a template argument of another function, whose template
+    // parameters are restored afterwards
+    const size_t templateArgCount = parser->templateArgCount;
+    const size_t packElementCount = parser->packElementCount;
+    TemplateArg* templateArgs = Allocate(parser, templateArgCount * sizeof(TemplateArg) + 1);
+    Type* packElements = Allocate(parser, packElementCount * sizeof(Type) + 1);
+
+    if (!templateArgs || !packElements) {
+        return "";
+    }
+
+    memcpy(templateArgs, parser->templateArgs, templateArgCount * sizeof(TemplateArg));
+    memcpy(packElements, parser->packElements, packElementCount * sizeof(Type));
+
+    const unsigned templateArgDepth = parser->templateArgDepth;
+    const BOOL hideReturnType = parser->hideReturnType;
+
+    parser->templateArgDepth = 0;
+    parser->hideReturnType = TRUE;
+    const char* function = ParseEncoding(parser);
+    parser->hideReturnType = hideReturnType;
+    Expect(parser, 'E');
+
+    const char* entity;
+
+    if (Consume(parser, 's')) {
+        SkipDiscriminator(parser);
+        entity = "string literal";
+    } else {
+        if (Consume(parser, 'd')) {
+            // Default argument scope
+            if (Peek(parser) != '_') {
+                ParseNumber(parser);
+            }
+            Expect(parser, '_');
+        }
+
+        entity = ParseName(parser, templated, qualifiers);
+        SkipDiscriminator(parser);
+    }
+
+    parser->templateArgDepth = templateArgDepth;
+    parser->templateArgCount = templateArgCount;
+    parser->packElementCount = packElementCount;
+    memcpy(parser->templateArgs, templateArgs, templateArgCount * sizeof(TemplateArg));
+    memcpy(parser->packElements, packElements, packElementCount * sizeof(Type));
+
+    return Append(parser, function, "::", entity);
+}
+
+// Sets templated when the name ends with template arguments
+static const char* ParseName(Parser* parser, BOOL* templated, const char** qualifiers)
+{
+    const char c = Peek(parser);
+    const char* name;
+
+    *templated = FALSE;
+    *qualifiers = "";
+
+    if (c == 'N') {
+        return ParseNestedName(parser, templated, qualifiers);
+    }
+
+    if (c == 'Z') {
+        return ParseLocalName(parser, templated, qualifiers);
+    }
+
+    const BOOL substitution = (c == 'S' && PeekNext(parser) != 't');
+
+    if (c == 'S' && PeekNext(parser) == 't') {
+        parser->p += 2;
+        name = Append(parser, "std::", ParseUnqualifiedName(parser, "std"), "");
+    } else if (substitution) {
+        name = TypeToString(parser, ParseSubstitution(parser, FALSE));
+
+        if (Peek(parser) != 'I') {
+            // Plain substitution is not a name
+            Fail(parser);
+        }
+    } else {
+        name = ParseUnqualifiedName(parser, "");
+    }
+
+    if (Peek(parser) == 'I') {
+        if (!substitution) {
+            AddSubstitution(parser, SimpleType(name));
+        }
+
+        name = ParseTemplateArgs(parser, name);
+        *templated = TRUE;
+    }
+
+    return name;
+}
+
+static const char* ParseExpressionPrimary(Parser* parser)
+{
+    Expect(parser, 'L');
+
+    if (Consume(parser, '_')) {
+        Expect(parser, 'Z');
+        const char* encoding = ParseEncoding(parser);
+        Expect(parser, 'E');
+        return encoding;
+    }
+
+    if (Peek(parser) == 'Z') {
+        parser->p++;
+        const char* encoding = ParseEncoding(parser);
+        Expect(parser, 'E');
+        return encoding;
+    }
+
+    const char type = Peek(parser);
+    const char* typeName = TypeToString(parser, ParseType(parser));
+    const char* value = parser->p;
+
+    while (Peek(parser) && Peek(parser) != 'E') {
+        parser->p++;
+    }
+
+    const char* number = Copy(parser, value, (size_t)(parser->p - value));
+    Expect(parser, 'E');
+
+    if (number[0] == 'n') {
+        number = Append(parser, "-", number + 1, "");
+    }
+
+    switch (type) {
+        case 'b':
+            return (number[0] == '0') ? "false" : "true";
+        case 'i':
+            return number;
+        case 'j':
+            return Append(parser, number, "u", "");
+        case 'l':
+            return Append(parser, number, "l", "");
+        case 'm':
+            return Append(parser, number, "ul", "");
+        default:
+            return Append(parser, "(", typeName, Append(parser, ")", number, ""));
+    }
+}
+
+static Type ParseTemplateArg(Parser* parser)
+{
+    const char c = Peek(parser);
+
+    if (c == 'L') {
+        return SimpleType(ParseExpressionPrimary(parser));
+    }
+
+    if (c == 'J') {
+        // Argument pack
+        parser->p++;
+        const char* args = "";
+
+        while (!parser->failed && !Consume(parser, 'E')) {
+            const char* arg = TypeToString(parser, ParseTemplateArg(parser));
+            args = Append(parser, args, (args[0] && arg[0]) ? ", " : "", arg);
+        }
+
+        return SimpleType(args);
+    }
+
+    if (c == 'X') {
+        // Expressions are not supported
+        Fail(parser);
+        return SimpleType("");
+    }
+
+    return ParseType(parser);
+}
+
+// Returns name followed by template arguments. Template parameters refer to the arguments
+// of the function template, so those are recorded while parsing the function name.
+static const char* ParseTemplateArgs(Parser* parser, const char* name)
+{
+    const BOOL record = parser->templateArgDepth == 0 && parser->captureTemplateArgs;
+    const BOOL noReturnType = parser->noReturnType;
+    const size_t nameLength = strlen(name);
+    // Avoid "operator<<<" for operator templates
+    const char* result = (nameLength > 0 && name[nameLength - 1] == '<') ? " <" : "<";
+
+    Expect(parser, 'I');
+
+    if (record) {
+        parser->templateArgCount = 0;
+        parser->packElementCount = 0;
+    }
+
+    parser->templateArgDepth++;
+
+    while (!parser->failed && !Consume(parser, 'E')) {
+        TemplateArg* arg = NULL;
+        const char* string = "";
+
+        if (record && parser->templateArgCount < MAX_TEMPLATE_ARGS) {
+            arg = &parser->templateArgs[parser->templateArgCount++];
+            arg->type = SimpleType("");
+            arg->packStart = parser->packElementCount;
+            arg->packSize = -1;
+        }
+
+        if (arg && Consume(parser, 'J')) {
+            // Elements are needed separately for pack expansions
+            arg->packSize = 0;
+
+            while (!parser->failed && !Consume(parser, 'E')) {
+                const Type element = ParseTemplateArg(parser);
+                const char* elementString = TypeToString(parser, element);
+
+                if (parser->packElementCount < MAX_PACK_ELEMENTS) {
+                    parser->packElements[parser->packElementCount++] = element;
+                    arg->packSize++;
+                }
+
+                string = Append(parser, string, (string[0] && elementString[0]) ? ", " : "", elementString);
+            }
+
+            arg->type = SimpleType(string);
+        } else {
+            const Type type = ParseTemplateArg(parser);
+            string = TypeToString(parser, type);
+
+            if (arg) {
+                arg->type = type;
+            }
+        }
+
+        result = Append(parser, result, (result[strlen(result) - 1] != '<' && string[0]) ? ", " : "", string);
+    }
+
+    parser->templateArgDepth--;
+    parser->noReturnType = noReturnType;
+
+    const size_t length = strlen(result);
+
+    return Append(parser, name, result, (length > 0 && result[length - 1] == '>') ? " >" : ">");
+}
+
+static Type Qualify(Parser* parser, const Type type, const char* qualifiers)
+{
+    Type result = type;
+    const size_t length = strlen(type.left);
+    const size_t qualifiersLength = strlen(qualifiers);
+
+    // Qualifiers from a template argument are not repeated
+    if (!type.right[0] && length >= qualifiersLength && strcmp(type.left + length - qualifiersLength, qualifiers) == 0) {
+        return result;
+    }
+
+    if (type.right[0] == '(') {
+        // Qualifiers of a function type go after the parameters
+        result.right = Append(parser, type.right, qualifiers, "");
+    } else {
+        result.left = Append(parser, type.left, qualifiers, "");
+    }
+
+    return result;
+}
+
+static Type Declarator(Parser* parser, const Type type, const char* declarator)
+{
+    Type result;
+
+    if (type.right[0] == '(' || strncmp(type.right, " [", 2) == 0) {
+        // Pointer to function or array needs parentheses
+        const size_t length = strlen(type.left);
+        const BOOL space = length > 0 && type.left[length - 1] != ' ';
+        result.left = Append(parser, type.left, space ? " (" : "(", declarator);
+        result.right = Append(parser, ")", type.right, "");
+    } else {
+        result.left = Append(parser, type.left, declarator, "");
+        result.right = type.right;
+    }
+
+    return result;
+}
+
+// Reference to reference collapses, only rvalue reference to rvalue reference stays rvalue reference
+static Type Reference(Parser* parser, const Type type, const char* reference)
+{
+    const size_t length = strlen(type.left);
+
+    if (length == 0 || type.left[length - 1] != '&') {
+        return Declarator(parser, type, reference);
+    }
+
+    Type result = type;
+
+    if (reference[1] != '&' && length > 1 && type.left[length - 2] == '&') {
+        result.left = Copy(parser, type.left, length - 1);
+    }
+
+    return result;
+}
+
+static Type ParseFunctionType(Parser* parser)
+{
+    Expect(parser, 'F');
+    Consume(parser, 'Y');
+
+    const char* returnType = TypeToString(parser, ParseType(parser));
+    const char* parameters = ParseParameters(parser, 'E');
+    const char* reference = "";
+
+    if (Consume(parser, 'R')) {
+        reference = " &";
+    } else if (Consume(parser, 'O')) {
+        reference = " &&";
+    }
+
+    Expect(parser, 'E');
+
+    Type type;
+    type.left = Append(parser, returnType, " ", "");
+    type.right = Append(parser, "(", parameters, Append(parser, ")", reference, ""));
+
+    return type;
+}
+
+static Type ParseBuiltinType(Parser* parser, BOOL* found)
+{
+    static const struct {
+        char code;
+        const char* name;
+    } builtins[] = {
+        { 'v', "void" }, { 'w', "wchar_t" }, { 'b', "bool" }, { 'c', "char" },
+        { 'a', "signed char" }, { 'h', "unsigned char" }, { 's', "short" },
+        { 't', "unsigned short" }, { 'i', "int" }, { 'j', "unsigned int" },
+        { 'l', "long" }, { 'm', "unsigned long" }, { 'x', "long long" },
+        { 'y', "unsigned long long" }, { 'n', "__int128" }, { 'o', "unsigned __int128" },
+        { 'f', "float" }, { 'd', "double" }, { 'e', "long double" },
+        { 'g', "__float128" }, { 'z', "..." }
+    };
+
+    static const struct {
+        char code;
+        const char* name;
+    } extended[] = {
+        { 'd', "decimal64" }, { 'e', "decimal128" }, { 'f', "decimal32" },
+        { 'h', "half" }, { 'i', "char32_t" }, { 's', "char16_t" }, { 'u', "char8_t" },
+        { 'a', "auto" }, { 'c', "decltype(auto)" }, { 'n', "decltype(nullptr)" }
+    };
+
+    *found = TRUE;
+
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (Consume(parser, builtins[i].code)) {
+            return SimpleType(builtins[i].name);
+        }
+    }
+
+    if (Peek(parser) == 'D') {
+        for (size_t i = 0; i < sizeof(extended) / sizeof(extended[0]); i++) {
+            if (PeekNext(parser) == extended[i].code) {
+                parser->p += 2;
+                return SimpleType(extended[i].name);
+            }
+        }
+    }
+
+    *found = FALSE;
+
+    return SimpleType("");
+}
+
+// Pattern is repeated for each element of the pack it references
+static Type ParsePackExpansion(Parser* parser)
+{
+    const char* start = parser->p;
+    const int packIndex = parser->packIndex;
+    const int packSize = parser->packSize;
+
+    parser->packIndex = 0;
+    parser->packSize = -1;
+
+    Type type = ParseType(parser);
+
+    if (parser->packSize < 0) {
+        // Pack is not known
+        type.right = Append(parser, type.right, "...", "");
+    } else if (parser->packSize == 0) {
+        type = SimpleType("");
+    } else {
+        const char* end = parser->p;
+        const size_t substitutionCount = parser->substitutionCount;
+        const char* elements = TypeToString(parser, type);
+
+        for (int i = 1; i < parser->packSize && !parser->failed; i++) {
+            parser->p = start;
+            parser->packIndex = i;
+            elements = Append(parser, elements, ", ", TypeToString(parser, ParseType(parser)));
+            parser->substitutionCount = substitutionCount;
+        }
+
+        parser->p = end;
+        type = SimpleType(elements);
+    }
+
+    parser->packIndex = packIndex;
+    parser->packSize = packSize;
+
+    return type;
+}
+
+static Type ParseTypeUnchecked(Parser* parser)
+{
+    const char c = Peek(parser);
+    BOOL builtin = FALSE;
+    Type type = ParseBuiltinType(parser, &builtin);
+
+    if (builtin || parser->failed) {
+        return type;
+    }
+
+    switch (c) {
+        case 'r':
+        case 'V':
+        case 'K': {
+            const char* qualifiers = "";
+
+            if (Consume(parser, 'r')) {
+                qualifiers = " restrict";
+            }
+
+            if (Consume(parser, 'V')) {
+                qualifiers = Append(parser, " volatile", qualifiers, "");
+            }
+
+            if (Consume(parser, 'K')) {
+                qualifiers = Append(parser, " const", qualifiers, "");
+            }
+
+            if (Peek(parser) == 'F') {
+                // Qualified member function type is a single substitution candidate
+                type = Qualify(parser, ParseType(parser), qualifiers);
+                parser->substitutionCount--;
+            } else {
+                type = Qualify(parser, ParseType(parser), qualifiers);
+            }
+            break;
+        }
+        case 'P':
+            parser->p++;
+            type = Declarator(parser, ParseType(parser), "*");
+            break;
+        case 'R':
+        case 'O':
+            parser->p++;
+            type = Reference(parser, ParseType(parser), (c == 'R') ? "&" : "&&");
+            break;
+        case 'C':
+            parser->p++;
+            type = Qualify(parser, ParseType(parser), " _Complex");
+            break;
+        case 'G':
+            parser->p++;
+            type = Qualify(parser, ParseType(parser), " _Imaginary");
+            break;
+        case 'F':
+            type = ParseFunctionType(parser);
+            break;
+        case 'A': {
+            parser->p++;
+            const char* dimension = "";
+
+            if (Peek(parser) >= '0' && Peek(parser) <= '9') {
+                const char* start = parser->p;
+                ParseNumber(parser);
+                dimension = Copy(parser, start, (size_t)(parser->p - start));
+            } else if (Peek(parser) != '_') {
+                Fail(parser);
+            }
+
+            Expect(parser, '_');
+
+            const Type element = ParseType(parser);
+            type.left = element.left;
+            const BOOL nested = strncmp(element.right, " [", 2) == 0;
+            type.right = Append(parser, " [", dimension, Append(parser, "]", nested ? element.right + 1 : element.right, ""));
+            break;
+        }
+        case 'M': {
+            parser->p++;
+            const char* scope = TypeToString(parser, ParseType(parser));
+            const Type member = ParseType(parser);
+            type = Declarator(parser, member, Append(parser, (member.right[0] == '(') ? "" : " ", scope, "::*"));
+            break;
+        }
+        case 'T': {
+            parser->p++;
+            const size_t index = ParseSequenceId(parser);
+            type = ResolveTemplateParam(parser, index);
+            AddTemplateParamSubstitution(parser, type, (int)index);
+
+            if (Peek(parser) == 'I') {
+                type = SimpleType(ParseTemplateArgs(parser, TypeToString(parser, type)));
+                break;
+            }
+
+            return type;
+        }
+        case 'S':
+            if (PeekNext(parser) == 't') {
+                BOOL templated = FALSE;
+                const char* qualifiers = "";
+                type = SimpleType(ParseName(parser, &templated, &qualifiers));
+                break;
+            }
+
+            type = ParseSubstitution(parser, FALSE);
+
+            if (Peek(parser) == 'I') {
+                type = SimpleType(ParseTemplateArgs(parser, TypeToString(parser, type)));
+                break;
+            }
+
+            // Plain substitution is not added again
+            return type;
+        case 'D':
+            if (PeekNext(parser) == 'p') {
+                parser->p += 2;
+                type = ParsePackExpansion(parser);
+                break;
+            }
+
+            if (PeekNext(parser) == 'v') {
+                // Vector type
+                parser->p += 2;
+                const char* start = parser->p;
+                ParseNumber(parser);
+                const char* size = Copy(parser, start, (size_t)(parser->p - start));
+                Expect(parser, '_');
+                type = ParseType(parser);
+                type.left = Append(parser, type.left, " __vector(", Append(parser, size, ")", ""));
+                break;
+            }
+
+            Fail(parser);
+            break;
+        case 'u':
+            parser->p++;
+            type = SimpleType(ParseSourceName(parser));
+            break;
+        default:
+            if ((c >= '0' && c <= '9') || c == 'N' || c == 'Z') {
+                BOOL templated = FALSE;
+                const char* qualifiers = "";
+                type = SimpleType(ParseName(parser, &templated, &qualifiers));
+            } else {
+                Fail(parser);
+            }
+            break;
+    }
+
+    AddSubstitution(parser, type);
+
+    return type;
+}
+
+static Type ParseType(Parser* parser)
+{
+    if (parser->failed || ++parser->recursion > MAX_RECURSION) {
+        Fail(parser);
+        return SimpleType("");
+    }
+
+    const Type type = ParseTypeUnchecked(parser);
+
+    parser->recursion--;
+
+    return type;
+}
+
+static const char* ParseSpecialName(Parser* parser)
+{
+    const char c = *parser->p++;
+    const char code = *parser->p++;
+
+    if (c == 'T') {
+        switch (code) {
+            case 'V': return Append(parser, "vtable for ", TypeToString(parser, ParseType(parser)), "");
+            case 'T': return Append(parser, "VTT for ", TypeToString(parser, ParseType(parser)), "");
+            case 'I': return Append(parser, "typeinfo for ", TypeToString(parser, ParseType(parser)), "");
+            case 'S': return Append(parser, "typeinfo name for ", TypeToString(parser, ParseType(parser)), "");
+            case 'H': return Append(parser, "TLS init function for ", Parse(parser, ParseEncoding), "");
+            case 'W': return Append(parser, "TLS wrapper function for ", Parse(parser, ParseEncoding), "");
+            case 'h':
+                ParseNumber(parser);
+                Expect(parser, '_');
+                return Append(parser, "non-virtual thunk to ", Parse(parser, ParseEncoding), "");
+            case 'v':
+                ParseNumber(parser);
+                Expect(parser, '_');
+                ParseNumber(parser);
+                Expect(parser, '_');
+                return Append(parser, "virtual thunk to ", Parse(parser, ParseEncoding), "");
+            case 'c':
+                for (int i = 0; i < 2; i++) {
+                    if (Consume(parser, 'v')) {
+                        ParseNumber(parser);
+                        Expect(parser, '_');
+                    }
+                    ParseNumber(parser);
+                    Expect(parser, '_');
+                }
+                return Append(parser, "covariant return thunk to ", Parse(parser, ParseEncoding), "");
+            case 'C': {
+                const char* derived = TypeToString(parser, ParseType(parser));
+                ParseNumber(parser);
+                Expect(parser, '_');
+                const char* base = TypeToString(parser, ParseType(parser));
+                return Append(parser, "construction vtable for ", base, Append(parser, "-in-", derived, ""));
+            }
+        }
+    } else if (c == 'G') {
+        BOOL templated = FALSE;
+        const char* qualifiers = "";
+
+        switch (code) {
+            case 'V': return Append(parser, "guard variable for ", ParseName(parser, &templated, &qualifiers), "");
+            case 'R': {
+                const char* name = ParseName(parser, &templated, &qualifiers);
+                ParseSequenceId(parser);
+                return Append(parser, "reference temporary for ", name, "");
+            }
+            case 'T':
+                if (!Consume(parser, 't')) {
+                    Expect(parser, 'n');
+                }
+                return Append(parser, "transaction clone for ", Parse(parser, ParseEncoding), "");
+        }
+    }
+
+    Fail(parser);
+
+    return "";
+}
+
+static const char* ParseEncoding(Parser* parser)
+{
+    const char c = Peek(parser);
+
+    if ((c == 'T' && PeekNext(parser) != '_' && !(PeekNext(parser) >= '0' && PeekNext(parser) <= '9')) ||
+        (c == 'G' && (PeekNext(parser) == 'V' || PeekNext(parser) == 'R' || PeekNext(parser) == 'T')))
+    {
+        return ParseSpecialName(parser);
+    }
+
+    BOOL templated = FALSE;
+    const char* qualifiers = "";
+    const BOOL capture = parser->captureTemplateArgs;
+    const BOOL hideReturnType = parser->hideReturnType;
+
+    parser->hideReturnType = FALSE;
+
+    parser->captureTemplateArgs = TRUE;
+    const char* name = ParseName(parser, &templated, &qualifiers);
+    parser->captureTemplateArgs = FALSE;
+
+    if (parser->failed || Peek(parser) == '\0' || Peek(parser) == 'E' || Peek(parser) == '.') {
+        // Data object
+        parser->captureTemplateArgs = capture;
+        return name;
+    }
+
+    const char* returnType = "";
+
+    // Template functions encode the return type, except constructors, destructors
+    // and conversion operators
+    if (templated && !parser->noReturnType) {
+        const char* type = TypeToString(parser, ParseType(parser));
+
+        if (!hideReturnType) {
+            returnType = Append(parser, type, " ", "");
+        }
+    }
+
+    const char* parameters = ParseParameters(parser, 'E');
+
+    parser->captureTemplateArgs = capture;
+
+    return Append(parser, returnType, name, Append(parser, "(", parameters, Append(parser, ")", qualifiers, "")));
+}
+
+static const char* Parse(Parser* parser, const char* (*function)(Parser*))
+{
+    if (parser->failed || ++parser->recursion > MAX_RECURSION) {
+        Fail(parser);
+        return "";
+    }
+
+    const char* result = function(parser);
+
+    parser->recursion--;
+
+    return result;
+}
+
+static BOOL DemangleInto(Parser* parser, const char* mangled, uint32* id)
+{
+    parser->p = mangled + 2;
+    parser->packIndex = -1;
+    parser->packSize = -1;
+
+    const char* result = Parse(parser, ParseEncoding);
+
+    // Vendor suffixes like .constprop.0 or .cold are clones of the function. Numeric
+    // parts stay with the name before them, like c++filt does
+    while (!parser->failed && Peek(parser) == '.') {
+        const char* start = parser->p;
+
+        do {
+            do {
+                parser->p++;
+            } while (Peek(parser) && Peek(parser) != '.');
+        } while (Peek(parser) == '.' && PeekNext(parser) >= '0' && PeekNext(parser) <= '9');
+
+        result = Append(parser, result, " [clone ", Append(parser, Copy(parser, start, (size_t)(parser->p - start)), "]", ""));
+    }
+
+    if (parser->failed || Peek(parser) != '\0') {
+        return FALSE;
+    }
+
+    *id = InternString(&demangler->names, result);
+
+    return TRUE;
+}
+
+static BOOL InitDemangler(void)
+{
+    demangler = AllocateMemory(sizeof(Demangler));
+
+    if (!demangler) {
+        return FALSE;
+    }
+
+    if (!InitInternTable(&demangler->names) || !InitHashMap(&demangler->results, 256)) {
+        FreeDemangler();
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+const char* DemangleSymbol(const char* name)
+{
+    if (!name || name[0] != '_' || name[1] != 'Z') {
+        return name;
+    }
+
+    if (!demangler && !InitDemangler()) {
+        return name;
+    }
+
+    const uint32 mangledId = InternString(&demangler->names, name);
+    uint32* result = HashMapAdd(&demangler->results, mangledId + 1);
+
+    if (!result) {
+        return name;
+    }
+
+    if (!*result) {
+        uint32 demangledId = mangledId;
+        Parser* parser = AllocateMemory(sizeof(Parser));
+
+        if (parser) {
+            if (!DemangleInto(parser, name, &demangledId)) {
+                demangledId = mangledId;
+            }
+
+            FreeMemory(parser);
+        }
+
+        // Interning may have grown the map
+        result = HashMapGet(&demangler->results, mangledId + 1);
+        *result = demangledId + 1;
+    }
+
+    return GetInternedString(&demangler->names, *result - 1);
+}
+
+void FreeDemangler(void)
+{
+    if (demangler) {
+        FreeHashMap(&demangler->results);
+        FreeInternTable(&demangler->names);
+        FreeMemory(demangler);
+        demangler = NULL;
+    }
+}
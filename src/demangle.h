@@ -0,0 +1,9 @@
+#ifndef DEMANGLE_H
+#define DEMANGLE_H
+
+// Returns readable form of a mangled C++ name. Other names and names that can't
+// be demangled are returned as is. Results are cached until FreeDemangler.
+const char* DemangleSymbol(const char* name);
+void FreeDemangler(void);
+
+#endif
@@ -0,0 +1,285 @@
+#include "diff.h"
+#include "flamegraph.h"
+#include "folded.h"
+#include "hashmap.h"
+#include "intern.h"
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Counts are normalized to percentages of all samples in each file, so captures of
+// different length can be compared. Functions and modules are ranked by their self
+// samples, that is, when they are the innermost frame.
+
+#define MAX_DIFF_ENTRIES 20
+#define LINE_LEN (FOLDED_STACK_LEN + 16)
+
+typedef struct Profile {
+    HashMap stacks; // Stack name id -> samples
+    HashMap functions; // Innermost "module`function" name id -> samples
+    HashMap modules; // Innermost module name id -> samples
+    uint32 total; // Number of samples
+} Profile;
+
+typedef struct DiffEntry {
+    uint32 name;
+    uint32 baseline; // Samples in baseline
+    uint32 candidate; // Samples in candidate
+    float change; // Percentage points
+} DiffEntry;
+
+static void AddCount(HashMap* map, const uint32 name, const uint32 count)
+{
+    if (name) {
+        uint32* value = HashMapAdd(map, name);
+        if (value) {
+            *value += count;
+        }
+    }
+}
+
+static BOOL ReadProfile(const char* fileName, Profile* profile, InternTable* names, char* line)
+{
+    FILE* file = fopen(fileName, "r");
+
+    if (!file) {
+        printf("Failed to open '%s' for reading\n", fileName);
+        return FALSE;
+    }
+
+    while (fgets(line, LINE_LEN, file)) {
+        size_t length = strlen(line);
+
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r' || line[length - 1] == ' ')) {
+            line[--length] = '\0';
+        }
+
+        // Count follows the last space, task names may have spaces too
+        char* space = strrchr(line, ' ');
+
+        if (!space || space == line) {
+            continue;
+        }
+
+        *space = '\0';
+
+        const uint32 count = (uint32)strtoul(space + 1, NULL, 10);
+
+        if (!count) {
+            continue;
+        }
+
+        AddCount(&profile->stacks, InternString(names, line), count);
+        profile->total += count;
+
+        char* leaf = strrchr(line, ';');
+
+        if (leaf) {
+            leaf++;
+            AddCount(&profile->functions, InternString(names, leaf), count);
+
+            char* separator = strchr(leaf, '`');
+            if (separator) {
+                *separator = '\0';
+            }
+
+            AddCount(&profile->modules, InternString(names, leaf), count);
+        }
+    }
+
+    fclose(file);
+
+    printf("Read %lu samples from '%s'\n", profile->total, fileName);
+
+    return TRUE;
+}
+
+static float GetShare(const uint32 count, const uint32 total)
+{
+    return total ? 100.0f * (float)count / (float)total : 0.0f;
+}
+
+static int CompareChanges(const void* first, const void* second)
+{
+    const DiffEntry* a = first;
+    const DiffEntry* b = second;
+
+    const float changeA = a->change < 0.0f ? -a->change : a->change;
+    const float changeB = b->change < 0.0f ? -b->change : b->change;
+
+    if (changeA > changeB) return -1;
+    if (changeA < changeB) return 1;
+
+    return 0;
+}
+
+// Returns entries for every name found in either profile, sorted by the biggest change first
+static DiffEntry* CompareMaps(const HashMap* baseline, const HashMap* candidate, const uint32 baselineTotal,
+                              const uint32 candidateTotal, size_t* count)
+{
+    DiffEntry* entries = AllocateMemory((baseline->count + candidate->count + 1) * sizeof(DiffEntry));
+
+    *count = 0;
+
+    if (!entries) {
+        puts("Failed to allocate diff entries");
+        return NULL;
+    }
+
+    for (size_t slot = 0; slot < baseline->capacity; slot++) {
+        if (baseline->keys[slot]) {
+            const uint32* value = HashMapGet(candidate, baseline->keys[slot]);
+
+            DiffEntry* entry = &entries[(*count)++];
+            entry->name = baseline->keys[slot];
+            entry->baseline = baseline->values[slot];
+            entry->candidate = value ? *value : 0;
+        }
+    }
+
+    for (size_t slot = 0; slot < candidate->capacity; slot++) {
+        if (candidate->keys[slot] && !HashMapGet(baseline, candidate->keys[slot])) {
+            DiffEntry* entry = &entries[(*count)++];
+            entry->name = candidate->keys[slot];
+            entry->baseline = 0;
+            entry->candidate = candidate->values[slot];
+        }
+    }
+
+    for (size_t i = 0; i < *count; i++) {
+        entries[i].change = GetShare(entries[i].candidate, candidateTotal) - GetShare(entries[i].baseline, baselineTotal);
+    }
+
+    qsort(entries, *count, sizeof(DiffEntry), CompareChanges);
+
+    return entries;
+}
+
+static void ShowChanges(const char* title, const Profile* baseline, const Profile* candidate,
+                        const HashMap* baselineMap, const HashMap* candidateMap, const InternTable* names)
+{
+    size_t count;
+    DiffEntry* entries = CompareMaps(baselineMap, candidateMap, baseline->total, candidate->total, &count);
+
+    if (!entries) {
+        return;
+    }
+
+    printf("\n%10s %11s %10s %64s\n", "Baseline %", "Candidate %", "Change", title);
+
+    for (size_t i = 0; i < count && i < MAX_DIFF_ENTRIES; i++) {
+        printf("%10.2f %11.2f %+10.2f %64s\n",
+               GetShare(entries[i].baseline, baseline->total),
+               GetShare(entries[i].candidate, candidate->total),
+               entries[i].change,
+               GetInternedString(names, entries[i].name));
+    }
+
+    FreeMemory(entries);
+}
+
+static void WriteDiffHtml(const char* htmlFile, const Profile* baseline, const Profile* candidate, const InternTable* names)
+{
+    size_t count;
+    DiffEntry* entries = CompareMaps(&baseline->stacks, &candidate->stacks, baseline->total, candidate->total, &count);
+
+    const char** stacks = AllocateMemory((count + 1) * sizeof(const char *));
+    uint32* counts = AllocateMemory((count + 1) * sizeof(uint32));
+    uint32* baseCounts = AllocateMemory((count + 1) * sizeof(uint32));
+
+    if (entries && stacks && counts && baseCounts) {
+        for (size_t i = 0; i < count; i++) {
+            stacks[i] = GetInternedString(names, entries[i].name);
+            counts[i] = entries[i].candidate;
+            baseCounts[i] = entries[i].baseline;
+        }
+
+        WriteDiffFlameGraph(htmlFile, "Tequila - candidate compared to baseline", stacks, counts, baseCounts, count);
+    } else {
+        puts("Failed to allocate differential flame graph buffers");
+    }
+
+    if (baseCounts) {
+        FreeMemory(baseCounts);
+    }
+
+    if (counts) {
+        FreeMemory(counts);
+    }
+
+    if (stacks) {
+        FreeMemory(stacks);
+    }
+
+    if (entries) {
+        FreeMemory(entries);
+    }
+}
+
+static BOOL InitProfile(Profile* profile)
+{
+    profile->total = 0;
+
+    return InitHashMap(&profile->stacks, 0) &&
+           InitHashMap(&profile->functions, 0) &&
+           InitHashMap(&profile->modules, 0);
+}
+
+static void FreeProfile(Profile* profile)
+{
+    FreeHashMap(&profile->stacks);
+    FreeHashMap(&profile->functions);
+    FreeHashMap(&profile->modules);
+}
+
+BOOL ShowProfileDiff(const char* baselineFile, const char* candidateFile, const char* htmlFile)
+{
+    BOOL result = FALSE;
+
+    Profile baseline;
+    Profile candidate;
+    InternTable names;
+
+    memset(&baseline, 0, sizeof(Profile));
+    memset(&candidate, 0, sizeof(Profile));
+
+    char* line = AllocateMemory(LINE_LEN);
+
+    if (!InitInternTable(&names) || !InitProfile(&baseline) || !InitProfile(&candidate) || !line) {
+        puts("Failed to allocate profile tables");
+        goto out;
+    }
+
+    if (!ReadProfile(baselineFile, &baseline, &names, line) ||
+        !ReadProfile(candidateFile, &candidate, &names, line)) {
+        goto out;
+    }
+
+    if (!baseline.total || !candidate.total) {
+        puts("No samples to compare");
+        goto out;
+    }
+
+    ShowChanges("Innermost module", &baseline, &candidate, &baseline.modules, &candidate.modules, &names);
+    ShowChanges("Innermost function", &baseline, &candidate, &baseline.functions, &candidate.functions, &names);
+    ShowChanges("Stack trace", &baseline, &candidate, &baseline.stacks, &candidate.stacks, &names);
+
+    if (htmlFile && htmlFile[0]) {
+        WriteDiffHtml(htmlFile, &baseline, &candidate, &names);
+    }
+
+    result = TRUE;
+
+out:
+    if (line) {
+        FreeMemory(line);
+    }
+
+    FreeProfile(&candidate);
+    FreeProfile(&baseline);
+    FreeInternTable(&names);
+
+    return result;
+}
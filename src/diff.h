@@ -0,0 +1,10 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#include <exec/types.h>
+
+// Compares two collapsed stack files, for example FOLDED outputs of two releases.
+// Writes a differential flame graph too when htmlFile is not empty.
+BOOL ShowProfileDiff(const char* baselineFile, const char* candidateFile, const char* htmlFile);
+
+#endif
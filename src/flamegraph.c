@@ -0,0 +1,326 @@
+#include "flamegraph.h"
+#include "folded.h"
+#include "symbols.h"
+#include "version.h"
+#include "common.h"
+
+#include <stdio.h>
+
+// Single self-contained HTML page with an interactive flame graph and icicle graph.
+// Stacks are embedded in folded format and the tree is built and drawn by inline
+// JavaScript, so the page works offline on any machine with a browser.
+
+static const char* const htmlHead[] = {
+    "<!DOCTYPE html>",
+    "<html>",
+    "<head>",
+    "<meta charset=\"iso-8859-1\">",
+    "<title>Tequila flame graph</title>",
+    "<style>",
+    "body { font: 12px sans-serif; margin: 8px; }",
+    "#bar { margin-bottom: 6px; }",
+    "#search { width: 240px; }",
+    "#graph { display: block; width: 100%; cursor: pointer; }",
+    "#info { height: 16px; margin: 4px 0; white-space: nowrap; overflow: hidden; }",
+    "</style>",
+    "</head>",
+    "<body>",
+    "<div id=\"bar\">",
+    "<b id=\"title\"></b>",
+    "<button id=\"mode\">Icicle graph</button>",
+    "<button id=\"reset\">Reset zoom</button>",
+    "<input id=\"search\" placeholder=\"Search (regular expression)\">",
+    "<span id=\"match\"></span>",
+    "</div>",
+    "<div id=\"info\">Click a frame to zoom in</div>",
+    "<canvas id=\"graph\"></canvas>",
+    "<script>",
+    "var profile = {",
+    NULL
+};
+
+static const char* const htmlTail[] = {
+    "};",
+    "(function () {",
+    "    var root = { name: 'all', value: 0, base: 0, children: {}, parent: null };",
+    "    profile.stacks.forEach(function (stack) {",
+    "        var node = root;",
+    "        var base = stack[2] || 0;",
+    "        root.value += stack[1];",
+    "        root.base += base;",
+    "        stack[0].split(';').forEach(function (name) {",
+    "            var child = node.children[name];",
+    "            if (!child) {",
+    "                child = node.children[name] = { name: name, value: 0, base: 0, children: {}, parent: node };",
+    "            }",
+    "            child.value += stack[1];",
+    "            child.base += base;",
+    "            node = child;",
+    "        });",
+    "    });",
+    "    var canvas = document.getElementById('graph');",
+    "    var context = canvas.getContext('2d');",
+    "    var info = document.getElementById('info');",
+    "    var rowHeight = 16;",
+    "    var flame = true;",
+    "    var zoom = root;",
+    "    var pattern = null;",
+    "    var boxes = [];",
+    "    document.getElementById('title').textContent = profile.title;",
+    "    function height(node) {",
+    "        var levels = 0;",
+    "        for (var name in node.children) {",
+    "            levels = Math.max(levels, height(node.children[name]));",
+    "        }",
+    "        return levels + 1;",
+    "    }",
+    "    function change(node) {",
+    "        var share = root.value ? 100 * node.value / root.value : 0;",
+    "        return share - (root.base ? 100 * node.base / root.base : 0);",
+    "    }",
+    "    function color(node) {",
+    "        if (pattern && pattern.test(node.name)) {",
+    "            return '#e040e0';",
+    "        }",
+    "        if (profile.differential) {",
+    "            // Red grew and blue shrank compared to baseline, 5 percentage points is full color",
+    "            var delta = change(node);",
+    "            var fade = Math.round(255 * (1 - Math.min(1, Math.abs(delta) / 5)));",
+    "            return delta > 0 ? 'rgb(255,' + fade + ',' + fade + ')' : 'rgb(' + fade + ',' + fade + ',255)';",
+    "        }",
+    "        var hash = 0;",
+    "        for (var i = 0; i < node.name.length; i++) {",
+    "            hash = (hash * 31 + node.name.charCodeAt(i)) % 997;",
+    "        }",
+    "        var hue = node.name.indexOf('`') < 0 ? 200 : 10 + hash % 40;",
+    "        return 'hsl(' + hue + ',' + (60 + hash % 30) + '%,' + (55 + hash % 15) + '%)';",
+    "    }",
+    "    function draw() {",
+    "        var width = canvas.clientWidth;",
+    "        var chain = [];",
+    "        for (var node = zoom; node; node = node.parent) {",
+    "            chain.unshift(node);",
+    "        }",
+    "        var levels = chain.length - 1 + height(zoom);",
+    "        var ratio = window.devicePixelRatio || 1;",
+    "        canvas.style.height = levels * rowHeight + 'px';",
+    "        canvas.width = width * ratio;",
+    "        canvas.height = levels * rowHeight * ratio;",
+    "        context.setTransform(ratio, 0, 0, ratio, 0, 0);",
+    "        context.font = '11px sans-serif';",
+    "        context.textBaseline = 'middle';",
+    "        boxes = [];",
+    "        function box(node, x, w, depth, faded) {",
+    "            var y = flame ? (levels - depth - 1) * rowHeight : depth * rowHeight;",
+    "            context.globalAlpha = faded ? 0.5 : 1;",
+    "            context.fillStyle = color(node);",
+    "            context.fillRect(x, y, Math.max(w - 1, 1), rowHeight - 1);",
+    "            context.globalAlpha = 1;",
+    "            if (w > 30) {",
+    "                context.save();",
+    "                context.beginPath();",
+    "                context.rect(x, y, w - 3, rowHeight);",
+    "                context.clip();",
+    "                context.fillStyle = '#000';",
+    "                context.fillText(node.name, x + 3, y + rowHeight / 2);",
+    "                context.restore();",
+    "            }",
+    "            boxes.push({ node: node, x: x, y: y, w: w });",
+    "        }",
+    "        function walk(node, x, depth) {",
+    "            var w = width * node.value / zoom.value;",
+    "            if (w < 0.5) {",
+    "                return;",
+    "            }",
+    "            box(node, x, w, depth, false);",
+    "            Object.keys(node.children).sort().forEach(function (name) {",
+    "                var child = node.children[name];",
+    "                walk(child, x, depth + 1);",
+    "                x += width * child.value / zoom.value;",
+    "            });",
+    "        }",
+    "        for (var depth = 0; depth < chain.length - 1; depth++) {",
+    "            box(chain[depth], 0, width, depth, true);",
+    "        }",
+    "        walk(zoom, 0, chain.length - 1);",
+    "    }",
+    "    function describe(node) {",
+    "        var percent = (100 * node.value / root.value).toFixed(2);",
+    "        var text = node.name + ' - ' + node.value + ' samples, ' + percent + '%';",
+    "        if (profile.differential) {",
+    "            var delta = change(node);",
+    "            text += ' (' + (delta >= 0 ? '+' : '') + delta.toFixed(2) + '% compared to baseline)';",
+    "        }",
+    "        return text;",
+    "    }",
+    "    function find(event) {",
+    "        var rect = canvas.getBoundingClientRect();",
+    "        var x = event.clientX - rect.left;",
+    "        var y = event.clientY - rect.top;",
+    "        for (var i = boxes.length - 1; i >= 0; i--) {",
+    "            var b = boxes[i];",
+    "            if (x >= b.x && x < b.x + b.w && y >= b.y && y < b.y + rowHeight) {",
+    "                return b.node;",
+    "            }",
+    "        }",
+    "        return null;",
+    "    }",
+    "    function matched(node) {",
+    "        if (pattern.test(node.name)) {",
+    "            return node.value;",
+    "        }",
+    "        var total = 0;",
+    "        for (var name in node.children) {",
+    "            total += matched(node.children[name]);",
+    "        }",
+    "        return total;",
+    "    }",
+    "    canvas.onmousemove = function (event) {",
+    "        var node = find(event);",
+    "        info.textContent = node ? describe(node) : '';",
+    "    };",
+    "    canvas.onclick = function (event) {",
+    "        var node = find(event);",
+    "        if (node) {",
+    "            zoom = node;",
+    "            draw();",
+    "        }",
+    "    };",
+    "    document.getElementById('reset').onclick = function () {",
+    "        zoom = root;",
+    "        draw();",
+    "    };",
+    "    document.getElementById('mode').onclick = function () {",
+    "        flame = !flame;",
+    "        this.textContent = flame ? 'Icicle graph' : 'Flame graph';",
+    "        draw();",
+    "    };",
+    "    document.getElementById('search').oninput = function () {",
+    "        var text = document.getElementById('match');",
+    "        try {",
+    "            pattern = this.value ? new RegExp(this.value) : null;",
+    "        } catch (e) {",
+    "            pattern = null;",
+    "        }",
+    "        text.textContent = pattern ? 'Matched ' + (100 * matched(root) / root.value).toFixed(2) + '%' : '';",
+    "        draw();",
+    "    };",
+    "    window.onresize = draw;",
+    "    draw();",
+    "})();",
+    "</script>",
+    "</body>",
+    "</html>",
+    NULL
+};
+
+static void WriteLines(FILE* file, const char* const* lines)
+{
+    while (*lines) {
+        fputs(*lines++, file);
+        fputc('\n', file);
+    }
+}
+
+static void WriteJavaScriptString(FILE* file, const char* string)
+{
+    fputc('\'', file);
+
+    for (const unsigned char* c = (const unsigned char *)string; *c; c++) {
+        if (*c == '\\' || *c == '\'') {
+            fputc('\\', file);
+            fputc(*c, file);
+        } else if (*c < 0x20 || *c == '<') {
+            // '<' is escaped so that names can't terminate the script element
+            fprintf(file, "\\x%02x", *c);
+        } else {
+            fputc(*c, file);
+        }
+    }
+
+    fputc('\'', file);
+}
+
+static FILE* OpenFlameGraph(const char* fileName, const char* title, const BOOL differential)
+{
+    FILE* file = fopen(fileName, "w");
+
+    if (!file) {
+        printf("Failed to open '%s' for writing\n", fileName);
+        return NULL;
+    }
+
+    WriteLines(file, htmlHead);
+
+    fputs("    title: ", file);
+    WriteJavaScriptString(file, title);
+    fprintf(file, ",\n    differential: %s,\n    stacks: [\n", differential ? "true" : "false");
+
+    return file;
+}
+
+static void CloseFlameGraph(FILE* file, const char* fileName)
+{
+    fputs("    ]\n", file);
+
+    WriteLines(file, htmlTail);
+
+    fclose(file);
+
+    printf("Wrote flame graph to '%s'\n", fileName);
+}
+
+BOOL WriteFlameGraph(const char* fileName, const StackTrace* traces, const size_t count)
+{
+    char* buffer = AllocateMemory(FOLDED_STACK_LEN);
+
+    if (!buffer) {
+        puts("Failed to allocate stack buffer");
+        return FALSE;
+    }
+
+    FILE* file = OpenFlameGraph(fileName, VERSION_STRING " - stack traces", FALSE);
+
+    if (!file) {
+        FreeMemory(buffer);
+        return FALSE;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (traces[i].id == 0) {
+            // Empty stack traces have no frames to show
+            continue;
+        }
+
+        FormatFoldedStack(&traces[i], buffer, FOLDED_STACK_LEN);
+
+        fputs("        [", file);
+        WriteJavaScriptString(file, buffer);
+        fprintf(file, ", %u],\n", traces[i].count);
+    }
+
+    CloseFlameGraph(file, fileName);
+    FreeMemory(buffer);
+
+    return TRUE;
+}
+
+BOOL WriteDiffFlameGraph(const char* fileName, const char* title, const char* const* stacks,
+                         const uint32* counts, const uint32* baseCounts, const size_t count)
+{
+    FILE* file = OpenFlameGraph(fileName, title, TRUE);
+
+    if (!file) {
+        return FALSE;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        fputs("        [", file);
+        WriteJavaScriptString(file, stacks[i]);
+        fprintf(file, ", %lu, %lu],\n", counts[i], baseCounts[i]);
+    }
+
+    CloseFlameGraph(file, fileName);
+
+    return TRUE;
+}
@@ -0,0 +1,13 @@
+#ifndef FLAMEGRAPH_H
+#define FLAMEGRAPH_H
+
+#include "symbols.h"
+
+BOOL WriteFlameGraph(const char* fileName, const StackTrace* traces, size_t count);
+
+// Differential flame graph: widths come from counts, colors from the change of each
+// frame's share compared to baseCounts
+BOOL WriteDiffFlameGraph(const char* fileName, const char* title, const char* const* stacks,
+                         const uint32* counts, const uint32* baseCounts, size_t count);
+
+#endif
@@ -0,0 +1,95 @@
+#include "folded.h"
+#include "symbols.h"
+#include "profiler.h"
+#include "common.h"
+
+#include <stdio.h>
+
+// Collapsed stack format used by flame graph tools:
+// task;outermost frame;...;innermost frame count
+
+size_t AppendFoldedName(char* buffer, size_t length, const size_t size, const char* name)
+{
+    // Frames are separated by ';' and each stack must stay on its own line
+    for (const char* c = name; *c && length + 1 < size; c++) {
+        buffer[length++] = (*c == ';' || *c == '\n') ? '_' : *c;
+    }
+
+    buffer[length] = '\0';
+
+    return length;
+}
+
+size_t AppendFoldedFrame(char* buffer, size_t length, const size_t size, const uint32* ip)
+{
+    SymbolInfo si;
+    LookupSymbol(ip, &si);
+
+    length = AppendFoldedName(buffer, length, size, si.moduleName);
+
+    if (si.functionName[0]) {
+        length = AppendFoldedName(buffer, length, size, "`");
+        length = AppendFoldedName(buffer, length, size, si.functionName);
+    }
+
+    return length;
+}
+
+size_t FormatFoldedStack(const StackTrace* trace, char* buffer, const size_t size)
+{
+    ULONG* frames[MAX_STACK_DEPTH];
+    size_t depth = ExpandRepeats(trace->ip, trace->depth, frames, MAX_STACK_DEPTH);
+
+    SampleInfo sampleInfo = InitializeTaskData(trace->task);
+    size_t length = AppendFoldedName(buffer, 0, size, sampleInfo.nameBuffer);
+
+    while (depth > 0) {
+        if (length + 1 < size) {
+            buffer[length++] = ';';
+        }
+
+        length = AppendFoldedFrame(buffer, length, size, frames[--depth]);
+    }
+
+    return length;
+}
+
+BOOL WriteFoldedStacks(const char* fileName, const StackTrace* traces, const size_t count)
+{
+    char* buffer = AllocateMemory(FOLDED_STACK_LEN);
+
+    if (!buffer) {
+        puts("Failed to allocate stack buffer");
+        return FALSE;
+    }
+
+    FILE* file = fopen(fileName, "w");
+
+    if (!file) {
+        printf("Failed to open '%s' for writing\n", fileName);
+        FreeMemory(buffer);
+        return FALSE;
+    }
+
+    size_t written = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const StackTrace* trace = &traces[i];
+
+        if (trace->id == 0) {
+            // Empty stack traces have no frames to show
+            continue;
+        }
+
+        FormatFoldedStack(trace, buffer, FOLDED_STACK_LEN);
+        fprintf(file, "%s %u\n", buffer, trace->count);
+        written++;
+    }
+
+    fclose(file);
+    FreeMemory(buffer);
+
+    printf("Wrote %u stack traces to '%s'\n", written, fileName);
+
+    return TRUE;
+}
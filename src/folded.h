@@ -0,0 +1,20 @@
+#ifndef FOLDED_H
+#define FOLDED_H
+
+#include "symbols.h"
+
+#include <stdio.h>
+
+// Worst case length of a formatted stack: task name and module`function for each frame
+#define FOLDED_STACK_LEN ((2 * MAX_STACK_DEPTH + 1) * (NAME_LEN + 1))
+
+// Append name with separator characters replaced, returns the new length
+size_t AppendFoldedName(char* buffer, size_t length, size_t size, const char* name);
+// Append "module`function" of the address, returns the new length
+size_t AppendFoldedFrame(char* buffer, size_t length, size_t size, const uint32* ip);
+
+// Formats stack trace as "task;outermost;...;innermost" without the count
+size_t FormatFoldedStack(const StackTrace* trace, char* buffer, size_t size);
+BOOL WriteFoldedStacks(const char* fileName, const StackTrace* traces, size_t count);
+
+#endif
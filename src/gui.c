@@ -1,6 +1,14 @@
 #include "gui.h"
 #include "version.h"
 #include "profiler.h"
+#include "symbols.h"
+#include "continuous.h"
+#include "reservoir.h"
+#include "phases.h"
+#include "offcpu.h"
+#include "semaphores.h"
+#include "spin.h"
+#include "ports.h"
 #include "common.h"
 
 #define CATCOMP_NUMBERS
@@ -13,6 +21,7 @@
 #include <proto/icon.h>
 #include <proto/listbrowser.h>
 #include <proto/graphics.h>
+#include <interfaces/clicktab.h>
 
 #include <classes/requester.h>
 #include <classes/window.h>
@@ -22,11 +31,13 @@
 #include <gadgets/listbrowser.h>
 #include <gadgets/button.h>
 #include <gadgets/space.h>
+#include <gadgets/clicktab.h>
 
 #include <libraries/gadtools.h>
 #include <libraries/keymap.h>
 
 #include <stdio.h>
+#include <string.h>
 
 enum EObject {
     OID_Window,
@@ -40,14 +51,21 @@ enum EObject {
     OID_Forbid,
     OID_LoadAverage,
     OID_Space,
+    OID_Tabs,
     OID_Count // KEEP LAST
 };
 
 enum EGadget {
     GID_ListBrowser,
-    GID_Space
+    GID_Space,
+    GID_Tabs
 };
 
+typedef enum ETab {
+    TAB_Tasks,
+    TAB_Ports
+} ETab;
+
 typedef enum EMenu {
     MID_Iconify = 1,
     MID_About,
@@ -72,19 +90,33 @@ static struct ClassLibrary* RequesterBase;
 static struct ClassLibrary* LayoutBase;
 static struct ClassLibrary* ButtonBase;
 static struct ClassLibrary* SpaceBase;
+static struct ClassLibrary* ClickTabBase;
 
 static Class* WindowClass;
 static Class* RequesterClass;
 static Class* LayoutClass;
 static Class* ButtonClass;
 static Class* SpaceClass;
+static Class* ClickTabClass;
+
+// Tab nodes are allocated through the interface of the opened class library,
+// so libauto doesn't open clicktab.gadget a second time
+static struct ClickTabIFace* IClickTab;
 
 #define MAX_NODES MAX_TASKS
 
 static struct ColumnInfo* columnInfo;
+static struct ColumnInfo* portColumnInfo;
 static struct List* labelList;
 static struct Node* nodes[MAX_NODES];
 
+static struct List* tabList;
+static ETab currentTab = TAB_Tasks;
+
+static const LONG portColumnTitles[5] = { MSG_PORT, MSG_OWNER, MSG_QUEUED, MSG_AVERAGE, MSG_MAX };
+
+static Backlog backlogs[MAX_PORTS];
+
 static void RemoveLabelNodes(void)
 {
     while (IExec->RemHead(labelList) != NULL) {
@@ -126,6 +158,18 @@ static BOOL OpenClasses(void)
         return FALSE;
     }
 
+    ClickTabBase = IIntuition->OpenClass("gadgets/clicktab.gadget", version, &ClickTabClass);
+    if (!ClickTabBase) {
+        puts("Failed to open clicktab.gadget");
+        return FALSE;
+    }
+
+    IClickTab = (struct ClickTabIFace *)IExec->GetInterface((struct Library *)ClickTabBase, "main", 1, NULL);
+    if (!IClickTab) {
+        puts("Failed to get clicktab.gadget interface");
+        return FALSE;
+    }
+
     return TRUE;
 }
 
@@ -136,6 +180,13 @@ static void CloseClasses(void)
     IIntuition->CloseClass(LayoutBase);
     IIntuition->CloseClass(ButtonBase);
     IIntuition->CloseClass(SpaceBase);
+
+    if (IClickTab) {
+        IExec->DropInterface((struct Interface *)IClickTab);
+        IClickTab = NULL;
+    }
+
+    IIntuition->CloseClass(ClickTabBase);
 }
 
 static char* GetApplicationName(void)
@@ -327,7 +378,37 @@ static BOOL InitListBrowserData(void)
                                                  LBCIA_HorizJustify, LCJ_RIGHT,
                                                  TAG_DONE);
 
-    if (!columnInfo) {
+    portColumnInfo = IListBrowser->AllocLBColumnInfo(5,
+                                                     //
+                                                     LBCIA_Column, 0,
+                                                     LBCIA_Title, GetString(portColumnTitles[0]),
+                                                     LBCIA_Weight, 40,
+                                                     LBCIA_Separator, FALSE,
+                                                     //
+                                                     LBCIA_Column, 1,
+                                                     LBCIA_Title, GetString(portColumnTitles[1]),
+                                                     LBCIA_Weight, 30,
+                                                     LBCIA_Separator, FALSE,
+                                                     //
+                                                     LBCIA_Column, 2,
+                                                     LBCIA_Title, GetString(portColumnTitles[2]),
+                                                     LBCIA_Weight, 10,
+                                                     LBCIA_HorizJustify, LCJ_RIGHT,
+                                                     LBCIA_Separator, FALSE,
+                                                     //
+                                                     LBCIA_Column, 3,
+                                                     LBCIA_Title, GetString(portColumnTitles[3]),
+                                                     LBCIA_Weight, 10,
+                                                     LBCIA_HorizJustify, LCJ_RIGHT,
+                                                     LBCIA_Separator, FALSE,
+                                                     //
+                                                     LBCIA_Column, 4,
+                                                     LBCIA_Title, GetString(portColumnTitles[4]),
+                                                     LBCIA_Weight, 10,
+                                                     LBCIA_HorizJustify, LCJ_RIGHT,
+                                                     TAG_DONE);
+
+    if (!columnInfo || !portColumnInfo) {
         puts("Failed to allocate listbrowser column info");
         return FALSE;
     }
@@ -386,6 +467,48 @@ static Object* CreateTaskDisplay(void)
    }
 }
 
+static Object* CreateTabs(void)
+{
+    tabList = IExec->AllocSysObject(ASOT_LIST, TAG_DONE);
+
+    if (!tabList) {
+        puts("Failed to allocate tab list");
+        return NULL;
+    }
+
+    struct Node* tasksNode = IClickTab->AllocClickTabNode(TNA_Text, GetString(MSG_TASKS), TNA_Number, TAB_Tasks, TAG_DONE);
+    struct Node* portsNode = IClickTab->AllocClickTabNode(TNA_Text, GetString(MSG_PORTS), TNA_Number, TAB_Ports, TAG_DONE);
+
+    if (tasksNode) {
+        IExec->AddTail(tabList, tasksNode);
+    }
+
+    if (portsNode) {
+        IExec->AddTail(tabList, portsNode);
+    }
+
+    return objects[OID_Tabs] = IIntuition->NewObject(ClickTabClass, NULL,
+        GA_ID, GID_Tabs,
+        GA_RelVerify, TRUE,
+        CLICKTAB_Labels, tabList,
+        CLICKTAB_Current, currentTab,
+        TAG_DONE);
+}
+
+static void FreeTabs(void)
+{
+    if (tabList) {
+        struct Node* node;
+
+        while ((node = IExec->RemHead(tabList)) != NULL) {
+            IClickTab->FreeClickTabNode(node);
+        }
+
+        IExec->FreeSysObject(ASOT_LIST, tabList);
+        tabList = NULL;
+    }
+}
+
 static Object* CreateGui(struct MsgPort* port)
 {
     return IIntuition->NewObject(WindowClass, NULL,
@@ -459,6 +582,9 @@ static Object* CreateGui(struct MsgPort* port)
                 TAG_DONE), // horizontal layout.gadget
             CHILD_WeightedHeight, 10,
 
+            LAYOUT_AddChild, CreateTabs(),
+            CHILD_WeightedHeight, 0,
+
             LAYOUT_AddChild, CreateTaskDisplay(),
             CHILD_MinWidth, 600,
             CHILD_MinHeight, 200,
@@ -468,9 +594,23 @@ static Object* CreateGui(struct MsgPort* port)
         TAG_DONE); // window.class
 }
 
+static void UpdateTaskDisplay(void);
+
 static void HandleGadgets(int id)
 {
-    printf("Gadget %d\n", id);
+    if (id == GID_Tabs) {
+        uint32 current = TAB_Tasks;
+
+        IIntuition->GetAttr(CLICKTAB_Current, objects[OID_Tabs], &current);
+        currentTab = (ETab)current;
+
+        // Task list is prepared only when timer signals, so redraw what is there
+        if (ctx.front && window) {
+            UpdateTaskDisplay();
+        }
+    } else {
+        printf("Gadget %d\n", id);
+    }
 }
 
 static void HandleIconify(void)
@@ -499,112 +639,203 @@ static BOOL HandleMenupick(void)
     return TRUE;
 }
 
-static void UpdateBitMap(void)
+static void DrawTasks(const struct IBox* box)
 {
-    struct IBox box;
+    const int xOffset[5] = { 1,
+                             (int)(0.65f * box->Width), // Special adjustment, "Priority" column takes more space
+                             (int)(0.8f * box->Width),
+                             (int)(0.9f * box->Width),
+                             box->Width - 2 };
 
-    if (IIntuition->GetAttr(SPACE_RenderBox, objects[OID_Space], (uint32 *)&box)) {
-        if (box.Width > cr.width || box.Height > cr.height) {
-            ResizeBitMap(box.Width, box.Height);
-        }
+    static char buffer[NAME_LEN];
 
-        IGraphics->RectFillColor(&cr.rp,
-                                 0,
-                                 0,
-                                 (uint32)box.Width - 1,
-                                 (uint32)box.Height - 1,
-                                 0xFF000000);
+    WORD yOffset = (WORD)cr.rp.TxHeight;
 
-        IGraphics->SetRPAttrs(&cr.rp,
-                              RPTAG_APenColor, 0xFF00FF00,
-                              RPTAG_BPenColor, 0xFF000000,
-                              RPTAG_DrMd, JAM2,
-                              TAG_DONE);
+    {
+        /* Columns */
+        int len = snprintf(buffer, sizeof(buffer), GetString(MSG_COLUMN_TASK));
+
+        IGraphics->Move(&cr.rp, (WORD)xOffset[0], yOffset);
+        IGraphics->Text(&cr.rp, buffer, (UWORD)len);
+
+        len = snprintf(buffer, sizeof(buffer), GetString(MSG_COLUMN_CPU));
+
+        IGraphics->Move(&cr.rp, (WORD)(xOffset[1] - cr.columnWidth[1]), yOffset);
+        IGraphics->Text(&cr.rp, buffer, (UWORD)len);
+
+        len = snprintf(buffer, sizeof(buffer), GetString(MSG_COLUMN_PRIORITY));
+
+        IGraphics->Move(&cr.rp, (WORD)(xOffset[2] - cr.columnWidth[2]), yOffset);
+        IGraphics->Text(&cr.rp, buffer, (UWORD)len);
+
+        len = snprintf(buffer, sizeof(buffer), GetString(MSG_COLUMN_STACK));
 
-        const int xOffset[5] = { 1,
-                                 (int)(0.65f * box.Width), // Special adjustment, "Priority" column takes more space
-                                 (int)(0.8f * box.Width),
-                                 (int)(0.9f * box.Width),
-                                 box.Width - 2 };
+        IGraphics->Move(&cr.rp, (WORD)(xOffset[3] - cr.columnWidth[3]), yOffset);
+        IGraphics->Text(&cr.rp, buffer, (UWORD)len);
 
-        static char buffer[NAME_LEN];
+        len = snprintf(buffer, sizeof(buffer), GetString(MSG_COLUMN_PID));
 
-        WORD yOffset = (WORD)cr.rp.TxHeight;
+        IGraphics->Move(&cr.rp, (WORD)(xOffset[4] - cr.columnWidth[4]), yOffset);
+        IGraphics->Text(&cr.rp, buffer, (UWORD)len);
+    }
+
+    /* Dynamic content */
+    for (size_t i = 0; i < ctx.front->uniqueTasks; i++) {
+        SampleInfo* si = &ctx.sampleInfo[i];
+        const float cpu = 100.0f * (float)si->count / (float)ctx.totalSamples;
 
-        {
-            /* Columns */
-            int len = snprintf(buffer, sizeof(buffer), GetString(MSG_COLUMN_TASK));
+        yOffset += (WORD)cr.rp.TxHeight;
 
-            IGraphics->Move(&cr.rp, (WORD)xOffset[0], yOffset);
-            IGraphics->Text(&cr.rp, buffer, (UWORD)len);
+        int len = snprintf(buffer, sizeof(buffer), "%s", si->nameBuffer);
 
-            len = snprintf(buffer, sizeof(buffer), GetString(MSG_COLUMN_CPU));
+        IGraphics->Move(&cr.rp, (WORD)xOffset[0], yOffset);
+        IGraphics->Text(&cr.rp, buffer, (UWORD)len);
 
-            IGraphics->Move(&cr.rp, (WORD)(xOffset[1] - cr.columnWidth[1]), yOffset);
-            IGraphics->Text(&cr.rp, buffer, (UWORD)len);
+        len = snprintf(buffer, sizeof(buffer), "%3.1f", cpu);
+        WORD textLength = IGraphics->TextLength(&cr.rp, buffer, (UWORD)len);
 
-            len = snprintf(buffer, sizeof(buffer), GetString(MSG_COLUMN_PRIORITY));
+        IGraphics->Move(&cr.rp, (WORD)xOffset[1] - textLength, yOffset);
+        IGraphics->Text(&cr.rp, buffer, (UWORD)len);
 
-            IGraphics->Move(&cr.rp, (WORD)(xOffset[2] - cr.columnWidth[2]), yOffset);
-            IGraphics->Text(&cr.rp, buffer, (UWORD)len);
+        len = snprintf(buffer, sizeof(buffer), "%d", si->priority);
+        textLength = IGraphics->TextLength(&cr.rp, buffer, (UWORD)len);
 
-            len = snprintf(buffer, sizeof(buffer), GetString(MSG_COLUMN_STACK));
+        IGraphics->Move(&cr.rp, (WORD)xOffset[2] - textLength, yOffset);
+        IGraphics->Text(&cr.rp, buffer, (UWORD)len);
 
-            IGraphics->Move(&cr.rp, (WORD)(xOffset[3] - cr.columnWidth[3]), yOffset);
-            IGraphics->Text(&cr.rp, buffer, (UWORD)len);
+        len = snprintf(buffer, sizeof(buffer), "%3.1f", si->stackUsage);
+        textLength = IGraphics->TextLength(&cr.rp, buffer, (UWORD)len);
 
-            len = snprintf(buffer, sizeof(buffer), GetString(MSG_COLUMN_PID));
+        IGraphics->Move(&cr.rp, (WORD)xOffset[3] - textLength, yOffset);
+        IGraphics->Text(&cr.rp, buffer, (UWORD)len);
 
-            IGraphics->Move(&cr.rp, (WORD)(xOffset[4] - cr.columnWidth[4]), yOffset);
-            IGraphics->Text(&cr.rp, buffer, (UWORD)len);
+        if (si->pid > 0) {
+            len = snprintf(buffer, sizeof(buffer), "%lu", si->pid);
+        } else {
+            len = snprintf(buffer, sizeof(buffer), "(task)");
         }
 
-        /* Dynamic content */
-        for (size_t i = 0; i < ctx.front->uniqueTasks; i++) {
-            SampleInfo* si = &ctx.sampleInfo[i];
-            const float cpu = 100.0f * (float)si->count / (float)ctx.totalSamples;
+        textLength = IGraphics->TextLength(&cr.rp, buffer, (UWORD)len);
 
-            yOffset += (WORD)cr.rp.TxHeight;
+        IGraphics->Move(&cr.rp, (WORD)xOffset[4] - textLength, yOffset);
+        IGraphics->Text(&cr.rp, buffer, (UWORD)len);
+    }
+}
 
-            int len = snprintf(buffer, sizeof(buffer), "%s", si->nameBuffer);
+static void DrawCell(const char* text, const int x, const WORD y, const BOOL alignRight)
+{
+    const UWORD len = (UWORD)strlen(text);
+    const WORD textLength = alignRight ? IGraphics->TextLength(&cr.rp, text, len) : 0;
 
-            IGraphics->Move(&cr.rp, (WORD)xOffset[0], yOffset);
-            IGraphics->Text(&cr.rp, buffer, (UWORD)len);
+    IGraphics->Move(&cr.rp, (WORD)x - textLength, y);
+    IGraphics->Text(&cr.rp, text, len);
+}
 
-            len = snprintf(buffer, sizeof(buffer), "%3.1f", cpu);
-            WORD textLength = IGraphics->TextLength(&cr.rp, buffer, (UWORD)len);
+static void DrawPorts(const struct IBox* box)
+{
+    const int xOffset[5] = { 1,
+                             (int)(0.45f * box->Width),
+                             (int)(0.75f * box->Width),
+                             (int)(0.87f * box->Width),
+                             box->Width - 2 };
 
-            IGraphics->Move(&cr.rp, (WORD)xOffset[1] - textLength, yOffset);
-            IGraphics->Text(&cr.rp, buffer, (UWORD)len);
+    WORD yOffset = (WORD)cr.rp.TxHeight;
 
-            len = snprintf(buffer, sizeof(buffer), "%d", si->priority);
-            textLength = IGraphics->TextLength(&cr.rp, buffer, (UWORD)len);
+    for (int column = 0; column < 5; column++) {
+        DrawCell(GetString(portColumnTitles[column]), xOffset[column], yOffset, column >= 2);
+    }
 
-            IGraphics->Move(&cr.rp, (WORD)xOffset[2] - textLength, yOffset);
-            IGraphics->Text(&cr.rp, buffer, (UWORD)len);
+    const size_t count = GetPortBacklogs(backlogs, MAX_NODES);
 
-            len = snprintf(buffer, sizeof(buffer), "%3.1f", si->stackUsage);
-            textLength = IGraphics->TextLength(&cr.rp, buffer, (UWORD)len);
+    for (size_t i = 0; i < count; i++) {
+        static char buffer[16];
 
-            IGraphics->Move(&cr.rp, (WORD)xOffset[3] - textLength, yOffset);
-            IGraphics->Text(&cr.rp, buffer, (UWORD)len);
+        yOffset += (WORD)cr.rp.TxHeight;
 
-            if (si->pid > 0) {
-                len = snprintf(buffer, sizeof(buffer), "%lu", si->pid);
-            } else {
-                len = snprintf(buffer, sizeof(buffer), "(task)");
-            }
+        DrawCell(backlogs[i].name, xOffset[0], yOffset, FALSE);
+        DrawCell(backlogs[i].owner, xOffset[1], yOffset, FALSE);
+
+        snprintf(buffer, sizeof(buffer), "%lu", backlogs[i].queued);
+        DrawCell(buffer, xOffset[2], yOffset, TRUE);
 
-            textLength = IGraphics->TextLength(&cr.rp, buffer, (UWORD)len);
+        snprintf(buffer, sizeof(buffer), "%3.1f", backlogs[i].average);
+        DrawCell(buffer, xOffset[3], yOffset, TRUE);
 
-            IGraphics->Move(&cr.rp, (WORD)xOffset[4] - textLength, yOffset);
-            IGraphics->Text(&cr.rp, buffer, (UWORD)len);
+        snprintf(buffer, sizeof(buffer), "%lu", backlogs[i].max);
+        DrawCell(buffer, xOffset[4], yOffset, TRUE);
+    }
+}
+
+static void UpdateBitMap(void)
+{
+    struct IBox box;
+
+    if (IIntuition->GetAttr(SPACE_RenderBox, objects[OID_Space], (uint32 *)&box)) {
+        if (box.Width > cr.width || box.Height > cr.height) {
+            ResizeBitMap(box.Width, box.Height);
+        }
+
+        IGraphics->RectFillColor(&cr.rp,
+                                 0,
+                                 0,
+                                 (uint32)box.Width - 1,
+                                 (uint32)box.Height - 1,
+                                 0xFF000000);
+
+        IGraphics->SetRPAttrs(&cr.rp,
+                              RPTAG_APenColor, 0xFF00FF00,
+                              RPTAG_BPenColor, 0xFF000000,
+                              RPTAG_DrMd, JAM2,
+                              TAG_DONE);
+
+        if (currentTab == TAB_Ports) {
+            DrawPorts(&box);
+        } else {
+            DrawTasks(&box);
         }
     }
 
     IIntuition->RefreshGList((struct Gadget *)objects[OID_Space], window, NULL, 1);
 }
 
+static void UpdatePortNodes(void)
+{
+    const size_t count = GetPortBacklogs(backlogs, MAX_NODES);
+
+    for (size_t i = 0; i < count; i++) {
+        static char queuedBuffer[16];
+        static char averageBuffer[16];
+        static char maxBuffer[16];
+
+        snprintf(queuedBuffer, sizeof(queuedBuffer), "%lu", backlogs[i].queued);
+        snprintf(averageBuffer, sizeof(averageBuffer), "%3.1f", backlogs[i].average);
+        snprintf(maxBuffer, sizeof(maxBuffer), "%lu", backlogs[i].max);
+
+        IListBrowser->SetListBrowserNodeAttrs(nodes[i],
+                                              LBNA_Column, 0,
+                                                LBNCA_CopyText, TRUE,
+                                                LBNCA_Text, backlogs[i].name,
+                                              LBNA_Column, 1,
+                                                LBNCA_CopyText, TRUE,
+                                                LBNCA_Text, backlogs[i].owner,
+                                              LBNA_Column, 2,
+                                                LBNCA_CopyText, TRUE,
+                                                LBNCA_Text, queuedBuffer,
+                                                LBNCA_HorizJustify, LCJ_RIGHT,
+                                              LBNA_Column, 3,
+                                                LBNCA_CopyText, TRUE,
+                                                LBNCA_Text, averageBuffer,
+                                                LBNCA_HorizJustify, LCJ_RIGHT,
+                                              LBNA_Column, 4,
+                                                LBNCA_CopyText, TRUE,
+                                                LBNCA_Text, maxBuffer,
+                                                LBNCA_HorizJustify, LCJ_RIGHT,
+                                              TAG_DONE);
+
+        IExec->AddTail(labelList, nodes[i]);
+    }
+}
+
 static void UpdateListBrowser(void)
 {
     IIntuition->SetAttrs(objects[OID_ListBrowser],
@@ -613,6 +844,16 @@ static void UpdateListBrowser(void)
 
     RemoveLabelNodes();
 
+    if (currentTab == TAB_Ports) {
+        UpdatePortNodes();
+
+        IIntuition->RefreshSetGadgetAttrs((struct Gadget *)objects[OID_ListBrowser], window, NULL,
+                                          LISTBROWSER_ColumnInfo, portColumnInfo,
+                                          LISTBROWSER_Labels, labelList,
+                                          TAG_DONE);
+        return;
+    }
+
     for (size_t i = 0; i < ctx.front->uniqueTasks; i++) {
         SampleInfo* si = &ctx.sampleInfo[i];
         const float cpu = 100.0f * (float)si->count / (float)ctx.totalSamples;
@@ -655,10 +896,20 @@ static void UpdateListBrowser(void)
     }
 
     IIntuition->RefreshSetGadgetAttrs((struct Gadget *)objects[OID_ListBrowser], window, NULL,
+                                      LISTBROWSER_ColumnInfo, columnInfo,
                                       LISTBROWSER_Labels, labelList,
                                       TAG_DONE);
 }
 
+static void UpdateTaskDisplay(void)
+{
+    if (ctx.customRendering) {
+        UpdateBitMap();
+    } else {
+        UpdateListBrowser();
+    }
+}
+
 static void UpdateDisplay(void)
 {
     PrepareResults();
@@ -666,17 +917,18 @@ static void UpdateDisplay(void)
     static char idleString[16];
     static char forbidString[16];
     static char tasksString[16];
-    static char taskSwitchesString[32];
+    static char taskSwitchesString[64];
     static char uptimeString[64];
-    static char loadAverageString[32];
+    static char loadAverageString[80];
 
     snprintf(idleString, sizeof(idleString), "%s %3.1f%%", GetString(MSG_IDLE), ctx.idleCpu);
     snprintf(forbidString, sizeof(forbidString), "%s %3.1f%%", GetString(MSG_FORBID), GetForbidCpu());
     snprintf(tasksString, sizeof(tasksString), "%s %u", GetString(MSG_TASKS), GetTotalTaskCount());
-    snprintf(taskSwitchesString, sizeof(taskSwitchesString), "%s %lu", GetString(MSG_TASK_SWITCHES), ctx.taskSwitchesPerSecond);
+    snprintf(taskSwitchesString, sizeof(taskSwitchesString), "%s %lu, peak %lu", GetString(MSG_TASK_SWITCHES),
+             ctx.taskSwitchesPerSecond, ctx.peakSwitchesPerSecond);
     snprintf(uptimeString, sizeof(uptimeString), "%s %s", GetString(MSG_UPTIME), GetUptimeString());
-    snprintf(loadAverageString, sizeof(loadAverageString), "Load average %3.1f%% %3.1f%% %3.1f%%",
-             ctx.loadAverage1, ctx.loadAverage5, ctx.loadAverage15);
+    snprintf(loadAverageString, sizeof(loadAverageString), "Load average %3.1f%% %3.1f%% %3.1f%%, run queue %.2f %.2f %.2f",
+             ctx.loadAverage1, ctx.loadAverage5, ctx.loadAverage15, ctx.runQueue1, ctx.runQueue5, ctx.runQueue15);
 
     IIntuition->SetAttrs(objects[OID_Idle],
                          GA_Text, idleString,
@@ -704,11 +956,7 @@ static void UpdateDisplay(void)
 
     IIntuition->RefreshGList((struct Gadget *)objects[OID_InfoLayout], window, NULL, -1);
 
-    if (ctx.customRendering) {
-        UpdateBitMap();
-    } else {
-        UpdateListBrowser();
-    }
+    UpdateTaskDisplay();
 }
 
 static BOOL HandleRawKey(const int16 code)
@@ -733,17 +981,61 @@ static void HandleEvents(void)
     IIntuition->GetAttr(WINDOW_SigMask, objects[OID_Window], &signal);
 
     const uint32 timerSignal = 1L << ctx.timerSignal;
+    const uint32 semaphoreSignal = ctx.semaphoreSignal != -1 ? 1L << ctx.semaphoreSignal : 0;
 
     BOOL running = TRUE;
 
     while (running) {
-        uint32 wait = IExec->Wait(signal | timerSignal | SIGBREAKF_CTRL_C);
+        uint32 wait = IExec->Wait(signal | timerSignal | semaphoreSignal | SIGBREAKF_CTRL_C | SIGBREAKF_CTRL_F);
 
         if (wait & SIGBREAKF_CTRL_C) {
             puts("*** Break ***");
             running = FALSE;
         }
 
+        if (ctx.profiling.enabled && (wait & timerSignal)) {
+            CheckLinkRegisterFrames();
+        }
+
+        if (ctx.profiling.continuous) {
+            // Keep aggregating also while iconified
+            if (wait & timerSignal) {
+                UpdateContinuousProfiling();
+            }
+
+            if (wait & SIGBREAKF_CTRL_F) {
+                WriteProfileWindows();
+            }
+        }
+
+        if (ctx.profiling.reservoirSize && (wait & timerSignal)) {
+            UpdateReservoir();
+        }
+
+        if (ctx.profiling.phases && (wait & timerSignal)) {
+            UpdatePhases();
+        }
+
+        if (ctx.profiling.offCpuRate && (wait & timerSignal)) {
+            UpdateOffCpu();
+        }
+
+        if (wait & semaphoreSignal) {
+            SampleSemaphores();
+        }
+
+        if (ctx.profiling.semaphoreRate && (wait & timerSignal)) {
+            UpdateSemaphores();
+        }
+
+        if (ctx.profiling.spinDetection && (wait & timerSignal)) {
+            UpdateSpin();
+        }
+
+        if (ctx.portMonitor && (wait & timerSignal)) {
+            UpdatePorts();
+        }
+
         BOOL refresh = FALSE;
 
         if (wait & signal) {
@@ -829,6 +1121,8 @@ void GuiLoop(void)
 
         IExec->FreeSysObject(ASOT_PORT, port);
 
+        FreeTabs();
+
         if (ctx.customRendering) {
             IGraphics->FreeBitMap(cr.bitmap);
         } else {
@@ -839,6 +1133,7 @@ void GuiLoop(void)
             }
 
             IListBrowser->FreeLBColumnInfo(columnInfo);
+            IListBrowser->FreeLBColumnInfo(portColumnInfo);
 
             IExec->FreeSysObject(ASOT_LIST, labelList);
         }
@@ -0,0 +1,173 @@
+#include "hashmap.h"
+#include "common.h"
+
+#include <proto/exec.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define MIN_CAPACITY 64
+
+uint32 HashMapHash(uint32 key)
+{
+    key ^= key >> 16;
+    key *= 0x45d9f3b;
+    key ^= key >> 16;
+    key *= 0x45d9f3b;
+    key ^= key >> 16;
+
+    return key;
+}
+
+static size_t RoundUpCapacity(const size_t capacity)
+{
+    size_t result = MIN_CAPACITY;
+
+    while (result < capacity) {
+        result <<= 1;
+    }
+
+    return result;
+}
+
+BOOL InitHashMap(HashMap* map, const size_t capacity)
+{
+    map->count = 0;
+    map->capacity = RoundUpCapacity(capacity);
+    map->keys = AllocateMemory(map->capacity * sizeof(uint32));
+    map->values = AllocateMemory(map->capacity * sizeof(uint32));
+
+    if (!map->keys || !map->values) {
+        FreeHashMap(map);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void FreeHashMap(HashMap* map)
+{
+    if (map->keys) {
+        FreeMemory(map->keys);
+        map->keys = NULL;
+    }
+
+    if (map->values) {
+        FreeMemory(map->values);
+        map->values = NULL;
+    }
+
+    map->count = 0;
+    map->capacity = 0;
+}
+
+void ClearHashMap(HashMap* map)
+{
+    if (map->keys) {
+        memset(map->keys, 0, map->capacity * sizeof(uint32));
+    }
+
+    map->count = 0;
+}
+
+static size_t FindSlot(const HashMap* map, const uint32 key)
+{
+    const size_t mask = map->capacity - 1;
+    size_t slot = HashMapHash(key) & mask;
+
+    while (map->keys[slot] && map->keys[slot] != key) {
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+uint32* HashMapGet(const HashMap* map, const uint32 key)
+{
+    if (!key || !map->capacity) {
+        return NULL;
+    }
+
+    const size_t slot = FindSlot(map, key);
+
+    return map->keys[slot] ? &map->values[slot] : NULL;
+}
+
+static BOOL Grow(HashMap* map)
+{
+    HashMap bigger;
+
+    if (!InitHashMap(&bigger, map->capacity * 2)) {
+        puts("Failed to grow hash map");
+        return FALSE;
+    }
+
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->keys[i]) {
+            const size_t slot = FindSlot(&bigger, map->keys[i]);
+            bigger.keys[slot] = map->keys[i];
+            bigger.values[slot] = map->values[i];
+        }
+    }
+
+    bigger.count = map->count;
+
+    FreeHashMap(map);
+    *map = bigger;
+
+    return TRUE;
+}
+
+uint32* HashMapAdd(HashMap* map, const uint32 key)
+{
+    if (!key || !map->capacity) {
+        return NULL;
+    }
+
+    size_t slot = FindSlot(map, key);
+
+    if (!map->keys[slot]) {
+        // Keep load factor below 3/4
+        if ((map->count + 1) * 4 > map->capacity * 3) {
+            if (!Grow(map)) {
+                return NULL;
+            }
+
+            slot = FindSlot(map, key);
+        }
+
+        map->keys[slot] = key;
+        map->values[slot] = 0;
+        map->count++;
+    }
+
+    return &map->values[slot];
+}
+
+void HashMapRemove(HashMap* map, const uint32 key)
+{
+    if (!key || !map->capacity) {
+        return;
+    }
+
+    const size_t mask = map->capacity - 1;
+    size_t slot = FindSlot(map, key);
+
+    if (!map->keys[slot]) {
+        return;
+    }
+
+    // Shift following keys back into the hole, so that no probe sequence is broken
+    for (size_t next = (slot + 1) & mask; map->keys[next]; next = (next + 1) & mask) {
+        const size_t home = HashMapHash(map->keys[next]) & mask;
+
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            map->keys[slot] = map->keys[next];
+            map->values[slot] = map->values[next];
+            slot = next;
+        }
+    }
+
+    map->keys[slot] = 0;
+    map->count--;
+}
@@ -0,0 +1,32 @@
+#ifndef HASHMAP_H
+#define HASHMAP_H
+
+#include <exec/types.h>
+#include <stddef.h>
+
+// Open addressing map from non-zero 32-bit keys to 32-bit values.
+// Key 0 marks an empty slot.
+typedef struct HashMap {
+    uint32* keys;
+    uint32* values;
+    size_t count; // Number of keys stored
+    size_t capacity; // Number of slots, always a power of two
+} HashMap;
+
+BOOL InitHashMap(HashMap* map, size_t capacity);
+void FreeHashMap(HashMap* map);
+void ClearHashMap(HashMap* map);
+
+// Returns pointer to the value of the key or NULL if key is not found
+uint32* HashMapGet(const HashMap* map, uint32 key);
+
+// Returns pointer to the value of the key, adding the key with value 0 when needed.
+// Returns NULL if the map couldn't grow. Pointer is valid until next HashMapAdd().
+uint32* HashMapAdd(HashMap* map, uint32 key);
+
+// Removes the key if it's found. Pointers returned earlier are invalidated.
+void HashMapRemove(HashMap* map, uint32 key);
+
+uint32 HashMapHash(uint32 key);
+
+#endif
@@ -0,0 +1,165 @@
+#include "intern.h"
+#include "common.h"
+
+#include <proto/exec.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_CAPACITY 256
+
+static uint32 HashString(const char* string)
+{
+    // FNV-1a
+    uint32 hash = 2166136261u;
+
+    while (*string) {
+        hash ^= (uint8)*string++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static size_t FindSlot(const InternTable* table, const char* string, const uint32 hash)
+{
+    const size_t mask = table->slotCount - 1;
+    size_t slot = hash & mask;
+
+    while (table->slots[slot] && strcmp(table->strings[table->slots[slot] - 1], string) != 0) {
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+static BOOL GrowSlots(InternTable* table)
+{
+    const size_t slotCount = table->slotCount ? table->slotCount * 2 : INITIAL_CAPACITY * 2;
+    uint32* slots = AllocateMemory(slotCount * sizeof(uint32));
+
+    if (!slots) {
+        return FALSE;
+    }
+
+    if (table->slots) {
+        FreeMemory(table->slots);
+    }
+
+    table->slots = slots;
+    table->slotCount = slotCount;
+
+    for (size_t id = 0; id < table->count; id++) {
+        const size_t slot = FindSlot(table, table->strings[id], HashString(table->strings[id]));
+        table->slots[slot] = (uint32)id + 1;
+    }
+
+    return TRUE;
+}
+
+static BOOL GrowStrings(InternTable* table)
+{
+    const size_t capacity = table->capacity ? table->capacity * 2 : INITIAL_CAPACITY;
+    char** strings = AllocateMemory(capacity * sizeof(char *));
+
+    if (!strings) {
+        return FALSE;
+    }
+
+    if (table->strings) {
+        memcpy(strings, table->strings, table->count * sizeof(char *));
+        FreeMemory(table->strings);
+    }
+
+    table->strings = strings;
+    table->capacity = capacity;
+
+    return TRUE;
+}
+
+BOOL InitInternTable(InternTable* table)
+{
+    table->strings = NULL;
+    table->slots = NULL;
+    table->count = 0;
+    table->capacity = 0;
+    table->slotCount = 0;
+
+    if (!GrowStrings(table) || !GrowSlots(table)) {
+        FreeInternTable(table);
+        return FALSE;
+    }
+
+    return InternString(table, "") == 0 && table->count == 1;
+}
+
+void FreeInternTable(InternTable* table)
+{
+    for (size_t id = 0; id < table->count; id++) {
+        free(table->strings[id]);
+    }
+
+    if (table->strings) {
+        FreeMemory(table->strings);
+        table->strings = NULL;
+    }
+
+    if (table->slots) {
+        FreeMemory(table->slots);
+        table->slots = NULL;
+    }
+
+    table->count = 0;
+    table->capacity = 0;
+    table->slotCount = 0;
+}
+
+uint32 InternString(InternTable* table, const char* string)
+{
+    if (!table->slotCount) {
+        return 0;
+    }
+
+    const uint32 hash = HashString(string);
+    size_t slot = FindSlot(table, string, hash);
+
+    if (table->slots[slot]) {
+        return table->slots[slot] - 1;
+    }
+
+    if ((table->count + 1) * 2 > table->slotCount) {
+        if (!GrowSlots(table)) {
+            puts("Failed to grow string table");
+            return 0;
+        }
+
+        slot = FindSlot(table, string, hash);
+    }
+
+    if (table->count >= table->capacity && !GrowStrings(table)) {
+        puts("Failed to grow string table");
+        return 0;
+    }
+
+    char* copy = strdup(string);
+
+    if (!copy) {
+        puts("Failed to duplicate string");
+        return 0;
+    }
+
+    table->strings[table->count] = copy;
+    table->slots[slot] = (uint32)table->count + 1;
+
+    return (uint32)table->count++;
+}
+
+const char* GetInternedString(const InternTable* table, const uint32 id)
+{
+    if (id < table->count) {
+        return table->strings[id];
+    }
+
+    return "";
+}
@@ -0,0 +1,24 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <exec/types.h>
+#include <stddef.h>
+
+// Stores each distinct string once and identifies it by a small integer.
+// Id 0 is always the empty string.
+typedef struct InternTable {
+    char** strings; // Indexed by id
+    uint32* slots; // Open addressing buckets storing id + 1, 0 when empty
+    size_t count; // Number of strings stored
+    size_t capacity; // Size of strings array
+    size_t slotCount; // Number of buckets, always a power of two
+} InternTable;
+
+BOOL InitInternTable(InternTable* table);
+void FreeInternTable(InternTable* table);
+
+// Returns id of the string, adding it when needed. Returns 0 on failure.
+uint32 InternString(InternTable* table, const char* string);
+const char* GetInternedString(const InternTable* table, uint32 id);
+
+#endif
@@ -58,6 +58,12 @@
 #define MSG_UNKNOWN_TASK 20
 #define MSG_TASK_SWITCHES 21
 #define MSG_FORBID 22
+#define MSG_PORTS 23
+#define MSG_PORT 24
+#define MSG_OWNER 25
+#define MSG_QUEUED 26
+#define MSG_AVERAGE 27
+#define MSG_MAX 28
 
 #endif /* CATCOMP_NUMBERS */
 
@@ -90,6 +96,12 @@
 #define MSG_UNKNOWN_TASK_STR "Unknown task"
 #define MSG_TASK_SWITCHES_STR "Task switches / s"
 #define MSG_FORBID_STR "Forbid"
+#define MSG_PORTS_STR "Ports"
+#define MSG_PORT_STR "Port"
+#define MSG_OWNER_STR "Owner"
+#define MSG_QUEUED_STR "Queued"
+#define MSG_AVERAGE_STR "Average"
+#define MSG_MAX_STR "Max"
 
 #endif /* CATCOMP_STRINGS */
 
@@ -130,6 +142,12 @@ STATIC CONST struct CatCompArrayType CatCompArray[] =
     {MSG_UNKNOWN_TASK,(CONST_STRPTR)MSG_UNKNOWN_TASK_STR},
     {MSG_TASK_SWITCHES,(CONST_STRPTR)MSG_TASK_SWITCHES_STR},
     {MSG_FORBID,(CONST_STRPTR)MSG_FORBID_STR},
+    {MSG_PORTS,(CONST_STRPTR)MSG_PORTS_STR},
+    {MSG_PORT,(CONST_STRPTR)MSG_PORT_STR},
+    {MSG_OWNER,(CONST_STRPTR)MSG_OWNER_STR},
+    {MSG_QUEUED,(CONST_STRPTR)MSG_QUEUED_STR},
+    {MSG_AVERAGE,(CONST_STRPTR)MSG_AVERAGE_STR},
+    {MSG_MAX,(CONST_STRPTR)MSG_MAX_STR},
 };
 
 #endif /* CATCOMP_ARRAY */
@@ -188,6 +206,18 @@ STATIC CONST UBYTE CatCompBlock[] =
     MSG_TASK_SWITCHES_STR "\x00"
     "\x00\x00\x00\x16\x00\x08"
     MSG_FORBID_STR "\x00\x00"
+    "\x00\x00\x00\x17\x00\x06"
+    MSG_PORTS_STR "\x00"
+    "\x00\x00\x00\x18\x00\x06"
+    MSG_PORT_STR "\x00\x00"
+    "\x00\x00\x00\x19\x00\x06"
+    MSG_OWNER_STR "\x00"
+    "\x00\x00\x00\x1A\x00\x08"
+    MSG_QUEUED_STR "\x00\x00"
+    "\x00\x00\x00\x1B\x00\x08"
+    MSG_AVERAGE_STR "\x00"
+    "\x00\x00\x00\x1C\x00\x04"
+    MSG_MAX_STR "\x00"
 };
 
 #endif /* CATCOMP_BLOCK */
@@ -3,6 +3,16 @@
 #include "profiler.h"
 #include "version.h"
 #include "symbols.h"
+#include "continuous.h"
+#include "symbolizer.h"
+#include "diff.h"
+#include "reservoir.h"
+#include "phases.h"
+#include "offcpu.h"
+#include "semaphores.h"
+#include "ports.h"
+#include "switches.h"
+#include "spin.h"
 #include "common.h"
 #include "locale.h"
 
@@ -15,6 +25,8 @@
 
 #include <workbench/startup.h>
 
+#define AVERAGE_STACK_DEPTH 16
+
 static const char* const version __attribute__((used)) = "$VER: " VERSION_STRING DATE_STRING;
 static const char* stackCookie __attribute__((used)) = "$STACK:64000";
 
@@ -26,15 +38,40 @@ typedef struct Params {
     LONG showTaskDisplay;
     LONG gui;
     LONG customRendering;
+    char* folded;
+    char* pprof;
+    char* html;
+    char* chromeTrace;
+    char* speedscope;
+    LONG continuous;
+    LONG* window;
+    LONG* windows;
+    char* windowDir;
+    char* taskFilter;
+    LONG* depth;
+    char* baseline;
+    char* candidate;
+    char* diffHtml;
+    LONG* annotate;
+    LONG* reservoir;
+    LONG phases;
+    char* phaseCsv;
+    LONG* offCpu;
+    LONG* semaphores;
+    LONG ports;
+    char* switchCsv;
+    LONG spin;
 } Params;
 
-static Params params = { NULL, NULL, 0, 0, 0, 0, 0 };
+static Params params = { NULL, NULL, 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, NULL, NULL, NULL, 0, NULL, 0 };
 
 Context ctx;
 
+static BOOL symbolsOpen;
+
 static void ParseArgs(void)
 {
-    const char* const pattern = "SAMPLES/N,INTERVAL/N,DEBUG/S,PROFILE/S,SHOWTASKDISPLAY/S,GUI/S,CUSTOMRENDERING/S";
+    const char* const pattern = "SAMPLES/N,INTERVAL/N,DEBUG/S,PROFILE/S,SHOWTASKDISPLAY/S,GUI/S,CUSTOMRENDERING/S,FOLDED/K,PPROF/K,HTML/K,CHROMETRACE/K,SPEEDSCOPE/K,CONTINUOUS/S,WINDOW/N,WINDOWS/N,WINDOWDIR/K,TASKFILTER/K,DEPTH/N,BASELINE/K,CANDIDATE/K,DIFFHTML/K,ANNOTATE/N,RESERVOIR/N,PHASES/S,PHASECSV/K,OFFCPU/N,SEMAPHORES/N,PORTS/S,SWITCHCSV/K,SPIN/S";
 
     struct RDArgs* result = IDOS->ReadArgs(pattern, (int32 *)&params, NULL);
 
@@ -54,14 +91,114 @@ static void ParseArgs(void)
         ctx.gui = (BOOL)params.gui;
         ctx.customRendering = (BOOL)params.customRendering;
 
+        if (params.folded) {
+            snprintf(ctx.profiling.foldedFile, NAME_LEN, "%s", params.folded);
+        }
+
+        if (params.pprof) {
+            snprintf(ctx.profiling.pprofFile, NAME_LEN, "%s", params.pprof);
+        }
+
+        if (params.html) {
+            snprintf(ctx.profiling.htmlFile, NAME_LEN, "%s", params.html);
+        }
+
+        if (params.chromeTrace) {
+            snprintf(ctx.profiling.chromeTraceFile, NAME_LEN, "%s", params.chromeTrace);
+        }
+
+        if (params.speedscope) {
+            snprintf(ctx.profiling.speedscopeFile, NAME_LEN, "%s", params.speedscope);
+        }
+
+        ctx.profiling.continuous = (BOOL)params.continuous;
+
+        if (params.window) {
+            ctx.profiling.windowLength = (ULONG)*params.window;
+        }
+
+        if (params.windows) {
+            ctx.profiling.maxWindows = (ULONG)*params.windows;
+        }
+
+        if (params.windowDir) {
+            snprintf(ctx.profiling.windowDir, NAME_LEN, "%s", params.windowDir);
+        }
+
+        if (params.taskFilter) {
+            snprintf(ctx.profiling.taskFilter, NAME_LEN, "%s", params.taskFilter);
+        }
+
+        if (params.depth) {
+            ctx.profiling.maxDepth = (ULONG)*params.depth;
+        }
+
+        if (params.baseline) {
+            snprintf(ctx.profiling.baselineFile, NAME_LEN, "%s", params.baseline);
+        }
+
+        if (params.candidate) {
+            snprintf(ctx.profiling.candidateFile, NAME_LEN, "%s", params.candidate);
+        }
+
+        if (params.diffHtml) {
+            snprintf(ctx.profiling.diffHtmlFile, NAME_LEN, "%s", params.diffHtml);
+        }
+
+        if (params.annotate) {
+            ctx.profiling.annotatedFunctions = (ULONG)*params.annotate;
+        }
+
+        if (params.reservoir) {
+            ctx.profiling.reservoirSize = (ULONG)*params.reservoir;
+        }
+
+        ctx.profiling.phases = (BOOL)params.phases;
+
+        if (params.phaseCsv) {
+            snprintf(ctx.profiling.phaseCsvFile, NAME_LEN, "%s", params.phaseCsv);
+        }
+
+        if (params.offCpu) {
+            ctx.profiling.offCpuRate = (ULONG)*params.offCpu;
+        }
+
+        if (params.semaphores) {
+            ctx.profiling.semaphoreRate = (ULONG)*params.semaphores;
+        }
+
+        ctx.portMonitor = (BOOL)params.ports;
+
+        if (params.switchCsv) {
+            snprintf(ctx.switchCsvFile, NAME_LEN, "%s", params.switchCsv);
+        }
+
+        ctx.profiling.spinDetection = (BOOL)params.spin;
+
         IDOS->FreeArgs(result);
     } else {
         printf("Supported arguments: %s\n", pattern);
     }
 }
 
+static BOOL IsComparing(void)
+{
+    return ctx.profiling.baselineFile[0] && ctx.profiling.candidateFile[0];
+}
+
 static void ValidateArgs(void)
 {
+    if ((ctx.profiling.baselineFile[0] != '\0') != (ctx.profiling.candidateFile[0] != '\0')) {
+        puts("Both BASELINE and CANDIDATE are needed for comparison");
+        ctx.profiling.baselineFile[0] = ctx.profiling.candidateFile[0] = '\0';
+    }
+
+    if (IsComparing() && (ctx.profiling.enabled || ctx.profiling.continuous)) {
+        puts("Comparing saved profiles, profiling is disabled");
+        ctx.profiling.enabled = FALSE;
+        ctx.profiling.continuous = FALSE;
+    }
+
     if (ctx.samples < 99) {
         puts("Min samples (freq) 99 Hz");
         ctx.samples = 99;
@@ -80,6 +217,124 @@ static void ValidateArgs(void)
         ctx.interval = 5;
     }
 
+    const BOOL outputRequested = ctx.profiling.foldedFile[0] ||
+                                 ctx.profiling.pprofFile[0] ||
+                                 ctx.profiling.htmlFile[0] ||
+                                 ctx.profiling.chromeTraceFile[0] ||
+                                 ctx.profiling.speedscopeFile[0];
+
+    if (outputRequested && !ctx.profiling.enabled) {
+        puts("Profile output enables profiling");
+        ctx.profiling.enabled = TRUE;
+    }
+
+    if (ctx.profiling.continuous) {
+        if (!ctx.profiling.enabled) {
+            puts("Continuous mode enables profiling");
+            ctx.profiling.enabled = TRUE;
+        }
+
+        if (ctx.profiling.windowLength < 10) {
+            puts("Min window 10 seconds");
+            ctx.profiling.windowLength = 10;
+        } else if (ctx.profiling.windowLength > 3600) {
+            puts("Max window 3600 seconds");
+            ctx.profiling.windowLength = 3600;
+        }
+
+        if (ctx.profiling.maxWindows < 1) {
+            puts("Min windows 1");
+            ctx.profiling.maxWindows = 1;
+        } else if (ctx.profiling.maxWindows > 10080) {
+            puts("Max windows 10080");
+            ctx.profiling.maxWindows = 10080;
+        }
+    }
+
+    if (ctx.profiling.reservoirSize) {
+        if (!ctx.profiling.enabled) {
+            puts("Reservoir sampling enables profiling");
+            ctx.profiling.enabled = TRUE;
+        }
+
+        if (ctx.profiling.reservoirSize < 1000) {
+            puts("Min reservoir 1000 stack traces");
+            ctx.profiling.reservoirSize = 1000;
+        } else if (ctx.profiling.reservoirSize > 200000) {
+            puts("Max reservoir 200000 stack traces");
+            ctx.profiling.reservoirSize = 200000;
+        }
+    }
+
+    if (ctx.profiling.phaseCsvFile[0] && !ctx.profiling.phases) {
+        puts("Time bucket output enables phases");
+        ctx.profiling.phases = TRUE;
+    }
+
+    if (ctx.profiling.phases && !ctx.profiling.enabled) {
+        puts("Phases enable profiling");
+        ctx.profiling.enabled = TRUE;
+    }
+
+    if (ctx.profiling.offCpuRate) {
+        if (!ctx.profiling.enabled) {
+            puts("Off-CPU profiling enables profiling");
+            ctx.profiling.enabled = TRUE;
+        }
+
+        if (ctx.profiling.offCpuRate > 100) {
+            puts("Max off-CPU rate 100 Hz");
+            ctx.profiling.offCpuRate = 100;
+        }
+
+        // Snapshots are taken by the sampling timer
+        if (ctx.profiling.offCpuRate > ctx.samples) {
+            printf("Max off-CPU rate is the sampling rate %lu Hz\n", ctx.samples);
+            ctx.profiling.offCpuRate = ctx.samples;
+        }
+    }
+
+    if (ctx.profiling.semaphoreRate) {
+        if (!ctx.profiling.enabled) {
+            puts("Semaphore profiling enables profiling");
+            ctx.profiling.enabled = TRUE;
+        }
+
+        if (ctx.profiling.semaphoreRate > 100) {
+            puts("Max semaphore rate 100 Hz");
+            ctx.profiling.semaphoreRate = 100;
+        }
+
+        // Snapshots are requested by the sampling timer
+        if (ctx.profiling.semaphoreRate > ctx.samples) {
+            printf("Max semaphore rate is the sampling rate %lu Hz\n", ctx.samples);
+            ctx.profiling.semaphoreRate = ctx.samples;
+        }
+    }
+
+    if (ctx.profiling.spinDetection && !ctx.profiling.enabled) {
+        puts("Spin detection enables profiling");
+        ctx.profiling.enabled = TRUE;
+    }
+
+    if (ctx.profiling.maxDepth < 1) {
+        puts("Min depth 1");
+        ctx.profiling.maxDepth = 1;
+    } else if (ctx.profiling.maxDepth > MAX_STACK_DEPTH) {
+        printf("Max depth %u\n", MAX_STACK_DEPTH);
+        ctx.profiling.maxDepth = MAX_STACK_DEPTH;
+    }
+
+    if (ctx.profiling.annotatedFunctions > 50) {
+        puts("Max annotate 50 functions");
+        ctx.profiling.annotatedFunctions = 50;
+    }
+
+    if (ctx.gui) {
+        // Window has a tab for message ports
+        ctx.portMonitor = TRUE;
+    }
+
     if (ctx.profiling.enabled) {
         if (!ctx.profiling.showTaskDisplay) {
             puts("Starting in profile-only mode");
@@ -89,14 +344,29 @@ static void ValidateArgs(void)
     }
 }
 
-static int ToolTypeToNumber(struct DiskObject* diskObject, const char* const name)
+// Tooltypes are read also when started from shell, so values are set only when
+// the tooltype is there and shell arguments and defaults are kept otherwise
+static void ToolTypeToNumber(struct DiskObject* diskObject, const char* const name, ULONG* value)
 {
     const char* const valueString = IIcon->FindToolType(diskObject->do_ToolTypes, name);
     if (valueString) {
-        return atoi(valueString);
+        *value = (ULONG)atoi(valueString);
     }
+}
 
-    return 0;
+static void ToolTypeToFlag(struct DiskObject* diskObject, const char* const name, BOOL* flag)
+{
+    if (IIcon->FindToolType(diskObject->do_ToolTypes, name)) {
+        *flag = TRUE;
+    }
+}
+
+static void ToolTypeToString(struct DiskObject* diskObject, const char* const name, char* buffer)
+{
+    const char* const valueString = IIcon->FindToolType(diskObject->do_ToolTypes, name);
+    if (valueString) {
+        snprintf(buffer, NAME_LEN, "%s", valueString);
+    }
 }
 
 static void ReadToolTypes(const char* const name)
@@ -104,27 +374,69 @@ static void ReadToolTypes(const char* const name)
     if (name) {
         struct DiskObject* diskObject = IIcon->GetDiskObject(name);
         if (diskObject) {
-            ctx.samples = (ULONG)ToolTypeToNumber(diskObject, "SAMPLES");
-            ctx.interval = (ULONG)ToolTypeToNumber(diskObject, "INTERVAL");
-            ctx.debugMode = IIcon->FindToolType(diskObject->do_ToolTypes, "DEBUG") != NULL;
-            ctx.profiling.enabled = IIcon->FindToolType(diskObject->do_ToolTypes, "PROFILE") != NULL;
-            ctx.profiling.showTaskDisplay = IIcon->FindToolType(diskObject->do_ToolTypes, "SHOWTASKDISPLAY") != NULL;
+            ToolTypeToNumber(diskObject, "SAMPLES", &ctx.samples);
+            ToolTypeToNumber(diskObject, "INTERVAL", &ctx.interval);
+            ToolTypeToFlag(diskObject, "DEBUG", &ctx.debugMode);
+            ToolTypeToFlag(diskObject, "PROFILE", &ctx.profiling.enabled);
+            ToolTypeToFlag(diskObject, "SHOWTASKDISPLAY", &ctx.profiling.showTaskDisplay);
             //if (ctx.profiling.enabled) {
             //    ctx.profiling.task = IExec->FindTask(IIcon->FindToolType(diskObject->do_ToolTypes, "PROFILE"));
             //}
-            ctx.gui = IIcon->FindToolType(diskObject->do_ToolTypes, "GUI") != NULL;
-            ctx.customRendering = IIcon->FindToolType(diskObject->do_ToolTypes, "CUSTOMRENDERING") != NULL;
+            ToolTypeToFlag(diskObject, "GUI", &ctx.gui);
+            ToolTypeToFlag(diskObject, "CUSTOMRENDERING", &ctx.customRendering);
+            ToolTypeToString(diskObject, "FOLDED", ctx.profiling.foldedFile);
+            ToolTypeToString(diskObject, "PPROF", ctx.profiling.pprofFile);
+            ToolTypeToString(diskObject, "HTML", ctx.profiling.htmlFile);
+            ToolTypeToString(diskObject, "CHROMETRACE", ctx.profiling.chromeTraceFile);
+            ToolTypeToString(diskObject, "SPEEDSCOPE", ctx.profiling.speedscopeFile);
+            ToolTypeToFlag(diskObject, "CONTINUOUS", &ctx.profiling.continuous);
+            ToolTypeToNumber(diskObject, "WINDOW", &ctx.profiling.windowLength);
+            ToolTypeToNumber(diskObject, "WINDOWS", &ctx.profiling.maxWindows);
+            ToolTypeToString(diskObject, "WINDOWDIR", ctx.profiling.windowDir);
+            ToolTypeToString(diskObject, "TASKFILTER", ctx.profiling.taskFilter);
+            ToolTypeToNumber(diskObject, "DEPTH", &ctx.profiling.maxDepth);
+            ToolTypeToString(diskObject, "BASELINE", ctx.profiling.baselineFile);
+            ToolTypeToString(diskObject, "CANDIDATE", ctx.profiling.candidateFile);
+            ToolTypeToString(diskObject, "DIFFHTML", ctx.profiling.diffHtmlFile);
+            ToolTypeToNumber(diskObject, "ANNOTATE", &ctx.profiling.annotatedFunctions);
+            ToolTypeToNumber(diskObject, "RESERVOIR", &ctx.profiling.reservoirSize);
+            ToolTypeToFlag(diskObject, "PHASES", &ctx.profiling.phases);
+            ToolTypeToString(diskObject, "PHASECSV", ctx.profiling.phaseCsvFile);
+            ToolTypeToNumber(diskObject, "OFFCPU", &ctx.profiling.offCpuRate);
+            ToolTypeToNumber(diskObject, "SEMAPHORES", &ctx.profiling.semaphoreRate);
+            ToolTypeToFlag(diskObject, "PORTS", &ctx.portMonitor);
+            ToolTypeToString(diskObject, "SWITCHCSV", ctx.switchCsvFile);
+            ToolTypeToFlag(diskObject, "SPIN", &ctx.profiling.spinDetection);
             IIcon->FreeDiskObject(diskObject);
         }
     }
 }
 
+static uint32 GetFrameArenaSize(void)
+{
+    // Typical stacks are shallower than the limit, so the arena is sized for an average
+    // depth. Deeper stacks make the arena wrap around before the sample ring buffer
+    const uint32 averageDepth = ctx.profiling.maxDepth < AVERAGE_STACK_DEPTH ? ctx.profiling.maxDepth : AVERAGE_STACK_DEPTH;
+    const uint32 wanted = (uint32)ctx.profiling.maxStackTraces * averageDepth;
+    uint32 size = 2 * MAX_STACK_DEPTH;
+
+    while (size < wanted) {
+        size <<= 1;
+    }
+
+    return size;
+}
+
 static BOOL InitContext(const int argc, char* argv[])
 {
     ctx.timerSignal = -1;
     ctx.lastSignal = -1;
+    ctx.semaphoreSignal = -1;
     ctx.samples = 999;
     ctx.interval = 1;
+    ctx.profiling.maxDepth = DEFAULT_STACK_DEPTH;
+    ctx.profiling.windowLength = 60;
+    ctx.profiling.maxWindows = 24 * 60;
 
     if (argc > 0) {
         ParseArgs();
@@ -139,6 +451,11 @@ static BOOL InitContext(const int argc, char* argv[])
 
     ValidateArgs();
 
+    if (IsComparing()) {
+        // Saved profiles are compared without sampling
+        return TRUE;
+    }
+
     ctx.totalSamples = ctx.interval * ctx.samples;
 
     ctx.interrupt = (struct Interrupt *) IExec->AllocSysObjectTags(ASOT_INTERRUPT,
@@ -163,18 +480,62 @@ static BOOL InitContext(const int argc, char* argv[])
     if (ctx.profiling.enabled) {
         ctx.profiling.maxStackTraces = 30 * ctx.samples;
         ctx.profiling.samples = AllocateMemory(ctx.profiling.maxStackTraces * sizeof(StackTraceSample));
+        ctx.profiling.frameArenaSize = GetFrameArenaSize();
+        ctx.profiling.frames = AllocateMemory(ctx.profiling.frameArenaSize * sizeof(ULONG *));
 
-        if (!ctx.profiling.samples) {
+        if (!ctx.profiling.samples || !ctx.profiling.frames) {
             puts("Failed to allocate stack trace buffer");
             return FALSE;
         }
+
+        if (ctx.profiling.continuous && !InitContinuousProfiling()) {
+            return FALSE;
+        }
+
+        if (ctx.profiling.reservoirSize && !InitReservoir()) {
+            return FALSE;
+        }
+
+        if (ctx.profiling.phases && !InitPhases()) {
+            return FALSE;
+        }
+
+        if (ctx.profiling.offCpuRate && !InitOffCpu()) {
+            return FALSE;
+        }
+
+        if (ctx.profiling.semaphoreRate && !InitSemaphores()) {
+            return FALSE;
+        }
+
+        if (ctx.profiling.spinDetection && !InitSpin()) {
+            return FALSE;
+        }
+
+        // Resolve symbols in the background, the cache stays until exit
+        symbolsOpen = OpenSymbols();
+
+        if (symbolsOpen) {
+            StartSymbolizer();
+        } else {
+            puts("Failed to get IDebug");
+        }
+    }
+
+    if (ctx.portMonitor && !InitPorts()) {
+        return FALSE;
+    }
+
+    if (!InitSwitches()) {
+        return FALSE;
     }
 
     ctx.back = &ctx.sampleData[0];
     ctx.front = NULL;
 
     ctx.loadAverage = AllocateMemory(MAX_LOAD_AVERAGES / ctx.interval * sizeof(float));
-    if (!ctx.loadAverage) {
+    ctx.runQueueAverage = AllocateMemory(MAX_LOAD_AVERAGES / ctx.interval * sizeof(float));
+    if (!ctx.loadAverage || !ctx.runQueueAverage) {
         puts("Failed to allocate load average buffer");
         return FALSE;
     }
@@ -194,10 +555,22 @@ static BOOL InitContext(const int argc, char* argv[])
         return FALSE;
     }
 
+    if (ctx.profiling.semaphoreRate) {
+        ctx.semaphoreSignal = IExec->AllocSignal(-1);
+
+        if (ctx.semaphoreSignal == -1) {
+            puts("Failed to allocate signal");
+            return FALSE;
+        }
+    }
+
     TimerInit(&ctx.sampler, ctx.interrupt);
 
     ctx.running = TRUE;
 
+    // First sample counts the task switches since here
+    ctx.sampledDispCount = ((struct ExecBase *)SysBase)->DispCount;
+
     TimerStart(ctx.sampler.request, ctx.period);
 
     ctx.lastDispCount = ((struct ExecBase *)SysBase)->DispCount;
@@ -224,6 +597,11 @@ static void CleanupContext()
         ctx.lastSignal = -1;
     }
 
+    if (ctx.semaphoreSignal != -1) {
+        IExec->FreeSignal(ctx.semaphoreSignal);
+        ctx.semaphoreSignal = -1;
+    }
+
     TimerQuit(&ctx.sampler);
 
     FreeMemory(ctx.cliNameBuffer);
@@ -231,47 +609,130 @@ static void CleanupContext()
     ctx.cliNameBuffer = NULL;
 
     FreeMemory(ctx.loadAverage);
+    FreeMemory(ctx.runQueueAverage);
     FreeMemory(ctx.sampleData[0].sampleBuffer);
     FreeMemory(ctx.sampleData[1].sampleBuffer);
 
     ctx.sampleData[0].sampleBuffer = ctx.sampleData[1].sampleBuffer = NULL;
 
     if (ctx.profiling.enabled) {
+        StopSymbolizer();
+
+        if (ctx.profiling.continuous) {
+            FreeContinuousProfiling();
+        }
+
+        if (ctx.profiling.reservoirSize) {
+            FreeReservoir();
+        }
+
+        if (ctx.profiling.phases) {
+            FreePhases();
+        }
+
+        if (ctx.profiling.offCpuRate) {
+            FreeOffCpu();
+        }
+
+        if (ctx.profiling.semaphoreRate) {
+            FreeSemaphores();
+        }
+
+        if (ctx.profiling.spinDetection) {
+            FreeSpin();
+        }
+
+        if (symbolsOpen) {
+            CloseSymbols();
+            symbolsOpen = FALSE;
+        }
+
         FreeMemory(ctx.profiling.samples);
         ctx.profiling.samples = NULL;
+
+        FreeMemory(ctx.profiling.frames);
+        ctx.profiling.frames = NULL;
     }
 
+    if (ctx.portMonitor) {
+        FreePorts();
+    }
+
+    FreeSwitches();
+
     if (ctx.interrupt) {
         IExec->FreeSysObject(ASOT_INTERRUPT, ctx.interrupt);
         ctx.interrupt = NULL;
     }
 }
 
-int main(int argc, char* argv[])
+static void Run(void)
 {
-    signal(SIGINT, SIG_IGN);
+    if (ctx.gui) {
+        GuiLoop();
+    } else {
+        ShellLoop();
+    }
 
-    LocaleInit();
+    const uint32 signalMask = 1L << ctx.lastSignal;
+    const uint32 signal = IExec->Wait(signalMask);
+    if (ctx.debugMode && (signal & signalMask)) {
+        puts("Last signal received");
+    }
 
-    if (InitContext(argc, argv)) {
-        if (ctx.gui) {
-            GuiLoop();
+    StopSymbolizer();
+
+    if (ctx.profiling.enabled) {
+        CheckLinkRegisterFrames();
+    }
+
+    if (ctx.profiling.continuous) {
+        // Flush the last window while symbols of running programs are still available
+        FreeContinuousProfiling();
+    }
+
+    if (ctx.profiling.reservoirSize) {
+        UpdateReservoir();
+    }
+
+    if (ctx.profiling.enabled) {
+        if (ctx.profiling.stackTraces) {
+            ShowSymbols();
         } else {
-            ShellLoop();
+            puts("No stack traces collected");
+        }
+
+        if (ctx.profiling.phases) {
+            ShowPhases();
+        }
+
+        if (ctx.profiling.offCpuRate) {
+            ShowOffCpu();
+        }
+
+        if (ctx.profiling.semaphoreRate) {
+            ShowSemaphores();
         }
 
-        const uint32 signalMask = 1L << ctx.lastSignal;
-        const uint32 signal = IExec->Wait(signalMask);
-        if (ctx.debugMode && (signal & signalMask)) {
-            puts("Last signal received");
+        if (ctx.profiling.spinDetection) {
+            ShowSpin();
         }
+    }
+
+    ShowSwitches();
+}
+
+int main(int argc, char* argv[])
+{
+    signal(SIGINT, SIG_IGN);
+
+    LocaleInit();
 
-        if (ctx.profiling.enabled) {
-            if (ctx.profiling.stackTraces) {
-                ShowSymbols();
-            } else {
-                puts("No stack traces collected");
-            }
+    if (InitContext(argc, argv)) {
+        if (IsComparing()) {
+            ShowProfileDiff(ctx.profiling.baselineFile, ctx.profiling.candidateFile, ctx.profiling.diffHtmlFile);
+        } else {
+            Run();
         }
     }
 
@@ -0,0 +1,303 @@
+#include "offcpu.h"
+#include "hashmap.h"
+#include "intern.h"
+#include "profiler.h"
+#include "symbols.h"
+#include "tasknames.h"
+#include "waittraces.h"
+#include "common.h"
+
+#include <proto/exec.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Off-CPU mode takes a snapshot of the wait list at a lower rate than the CPU
+// sampling. Every waiting task is recorded with its stack and the signals it waits
+// for, so the report tells where tasks block and for about how long. Stacks of
+// waiting tasks are walked from the stack pointer saved at the task switch.
+
+#define MAX_WAIT_TRACES 4096
+#define MAX_RING_FRAMES (1024 * 1024) // Ring is at most 4 MB of instruction pointers
+#define MAX_SHOWN_WAIT_TASKS 20
+#define MAX_SHOWN_WAIT_TRACES 20
+
+typedef struct WaitSample {
+    struct Task* task; // Waiting task
+    uint32 sigWait; // Signals the task waits for
+    uint32 depth; // Number of instruction pointers, innermost first
+} WaitSample;
+
+typedef struct WaitTask {
+    uint32 name; // Interned task name
+    size_t count; // Number of snapshots the task was waiting
+} WaitTask;
+
+typedef struct OffCpu {
+    // Interrupt side
+    WaitSample* samples; // Ring of waiting task samples
+    ULONG** frames; // Fixed-size record of maxDepth instruction pointers per ring slot
+    size_t capacity; // Number of ring slots
+    uint64 totalSamples; // Number of waiting task samples collected since start
+    uint32 snapshots; // Number of wait list snapshots taken
+    uint32 period; // Timer ticks between snapshots
+    uint32 ticks; // Timer ticks since the last snapshot
+    uint32 skippedTasks; // Waiting tasks left out when a snapshot had more than MAX_TASKS
+
+    // Main task side
+    uint64 readSamples; // Number of samples drained from the ring
+    uint64 lostSamples; // Number of samples overwritten before draining
+    WaitTraces traces; // Unique wait stacks, waiting for the signal mask
+    HashMap tasks; // Task -> task name string id, cleared with each update
+    InternTable names; // Task names
+} OffCpu;
+
+static OffCpu offCpu;
+
+void SampleWaitingTasks(struct ExecBase* sysBase)
+{
+    if (++offCpu.ticks < offCpu.period) {
+        return;
+    }
+
+    offCpu.ticks = 0;
+    offCpu.snapshots++;
+
+    size_t tasks = 0;
+
+    // Software interrupt can be interrupted, and the wait list changes with hardware interrupts
+    IExec->Disable();
+
+    for (struct Node* node = IExec->GetHead(&sysBase->TaskWait); node; node = IExec->GetSucc(node)) {
+        struct Task* task = (struct Task *)node;
+
+        if (task == ctx.mainTask) {
+            continue;
+        }
+
+        if (tasks++ >= MAX_TASKS) {
+            offCpu.skippedTasks++;
+            continue;
+        }
+
+        const size_t slot = (size_t)(offCpu.totalSamples % offCpu.capacity);
+        ULONG** addresses = &offCpu.frames[slot * ctx.profiling.maxDepth];
+
+        WaitSample* sample = &offCpu.samples[slot];
+        sample->task = task;
+        sample->sigWait = task->tc_SigWait;
+        sample->depth = (uint32)GetSavedStackTrace(task, addresses);
+
+        offCpu.totalSamples++;
+    }
+
+    IExec->Enable();
+}
+
+static void AddWaitSample(const WaitSample* sample, ULONG** addresses)
+{
+    const uint32 task = InternTaskName(sample->task, &offCpu.tasks, &offCpu.names);
+
+    AddWaitTrace(&offCpu.traces, task, sample->sigWait, addresses, sample->depth);
+}
+
+void UpdateOffCpu(void)
+{
+    IExec->Disable();
+
+    const uint64 total = offCpu.totalSamples;
+
+    IExec->Enable();
+
+    uint64 pending = total - offCpu.readSamples;
+
+    if (pending > offCpu.capacity) {
+        offCpu.lostSamples += pending - offCpu.capacity;
+        pending = offCpu.capacity;
+    }
+
+    // Ring holds two display intervals of snapshots, so the slots being read are not
+    // overwritten before the next update
+    for (uint64 i = total - pending; i < total; i++) {
+        const size_t slot = (size_t)(i % offCpu.capacity);
+
+        AddWaitSample(&offCpu.samples[slot], &offCpu.frames[slot * ctx.profiling.maxDepth]);
+    }
+
+    offCpu.readSamples = total;
+
+    // Task pointers are reused by new tasks, refresh names for the next update
+    ClearHashMap(&offCpu.tasks);
+}
+
+static int CompareWaitTasks(const void* first, const void* second)
+{
+    const WaitTask* a = first;
+    const WaitTask* b = second;
+
+    if (a->count > b->count) return -1;
+    if (a->count < b->count) return 1;
+
+    return 0;
+}
+
+// Snapshots are taken every period ticks, so the achieved rate differs from OFFCPU
+// when it doesn't divide the sampling rate
+static float GetWaitSeconds(const size_t count)
+{
+    return (float)count * (float)offCpu.period / (float)ctx.samples;
+}
+
+static void ShowWaitTasks(void)
+{
+    HashMap taskMap = { NULL, NULL, 0, 0 };
+    WaitTask* tasks = AllocateMemory((offCpu.traces.count + 1) * sizeof(WaitTask));
+    size_t taskCount = 0;
+
+    if (!tasks || !InitHashMap(&taskMap, 0)) {
+        puts("Failed to allocate waiting task table");
+        goto out;
+    }
+
+    for (size_t i = 0; i < offCpu.traces.count; i++) {
+        uint32* index = HashMapAdd(&taskMap, offCpu.traces.traces[i].task);
+
+        if (!index) {
+            continue;
+        }
+
+        if (*index == 0) {
+            tasks[taskCount].name = offCpu.traces.traces[i].task;
+            *index = (uint32)++taskCount;
+        }
+
+        tasks[*index - 1].count += offCpu.traces.traces[i].count;
+    }
+
+    qsort(tasks, taskCount, sizeof(WaitTask), CompareWaitTasks);
+
+    printf("\n%10s %10s %64s\n", "Waiting %", "Seconds", "Task");
+
+    for (size_t i = 0; i < taskCount && i < MAX_SHOWN_WAIT_TASKS; i++) {
+        printf("%10.2f %10.2f %64s\n",
+               100.0f * (float)tasks[i].count / (float)offCpu.snapshots,
+               GetWaitSeconds(tasks[i].count),
+               GetInternedString(&offCpu.names, tasks[i].name));
+    }
+
+out:
+    FreeHashMap(&taskMap);
+
+    if (tasks) {
+        FreeMemory(tasks);
+    }
+}
+
+static void ShowWaitTraces(void)
+{
+    SortWaitTraces(&offCpu.traces);
+
+    printf("\nTop wait stacks:\n");
+
+    for (size_t i = 0; i < offCpu.traces.count && i < MAX_SHOWN_WAIT_TRACES; i++) {
+        const WaitTrace* trace = &offCpu.traces.traces[i];
+
+        printf("\nWait stack %u (%.2f seconds - %.2f%% of snapshots - task %s - waiting for signals 0x%08lx):\n",
+               i,
+               GetWaitSeconds(trace->count),
+               100.0f * (float)trace->count / (float)offCpu.snapshots,
+               GetInternedString(&offCpu.names, trace->task),
+               trace->object);
+
+        ShowWaitTraceFrames(trace);
+    }
+}
+
+void ShowOffCpu(void)
+{
+    UpdateOffCpu();
+
+    printf("\nOff-CPU profile: %lu snapshots of the wait list at %.1f Hz, %llu waiting task samples\n",
+           offCpu.snapshots, (float)ctx.samples / (float)offCpu.period, offCpu.readSamples);
+
+    if (offCpu.skippedTasks) {
+        printf("%lu waiting task(s) were left out from snapshots with more than %u tasks\n", offCpu.skippedTasks, MAX_TASKS);
+    }
+
+    if (offCpu.lostSamples) {
+        printf("%llu waiting task sample(s) were overwritten before they could be counted\n", offCpu.lostSamples);
+    }
+
+    if (offCpu.traces.droppedSamples) {
+        printf("%u waiting task sample(s) were not counted, over %u unique wait stacks\n", offCpu.traces.droppedSamples, MAX_WAIT_TRACES);
+    }
+
+    if (!offCpu.snapshots || !offCpu.traces.count) {
+        puts("No waiting tasks sampled");
+        return;
+    }
+
+    if (!OpenSymbols()) {
+        puts("Failed to get IDebug");
+        return;
+    }
+
+    ShowWaitTasks();
+    ShowWaitTraces();
+
+    CloseSymbols();
+}
+
+BOOL InitOffCpu(void)
+{
+    memset(&offCpu, 0, sizeof(offCpu));
+
+    offCpu.period = ctx.samples / ctx.profiling.offCpuRate;
+
+    if (offCpu.period < 1) {
+        offCpu.period = 1;
+    }
+
+    // Two display intervals of snapshots with every task waiting, unless that would
+    // take too much memory with deep stacks. Overwritten samples are reported
+    offCpu.capacity = 2 * ctx.interval * ctx.profiling.offCpuRate * MAX_TASKS;
+
+    if (offCpu.capacity * ctx.profiling.maxDepth > MAX_RING_FRAMES) {
+        offCpu.capacity = MAX_RING_FRAMES / ctx.profiling.maxDepth;
+    }
+
+    offCpu.samples = AllocateMemory(offCpu.capacity * sizeof(WaitSample));
+    offCpu.frames = AllocateMemory(offCpu.capacity * ctx.profiling.maxDepth * sizeof(ULONG *));
+
+    if (!offCpu.samples || !offCpu.frames) {
+        puts("Failed to allocate off-CPU buffers");
+        return FALSE;
+    }
+
+    if (!InitWaitTraces(&offCpu.traces, MAX_WAIT_TRACES, ctx.profiling.maxDepth) ||
+        !InitHashMap(&offCpu.tasks, 0) ||
+        !InitInternTable(&offCpu.names)) {
+        puts("Failed to allocate off-CPU tables");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void FreeOffCpu(void)
+{
+    FreeWaitTraces(&offCpu.traces);
+    FreeHashMap(&offCpu.tasks);
+    FreeInternTable(&offCpu.names);
+
+    if (offCpu.frames) {
+        FreeMemory(offCpu.frames);
+        offCpu.frames = NULL;
+    }
+
+    if (offCpu.samples) {
+        FreeMemory(offCpu.samples);
+        offCpu.samples = NULL;
+    }
+}
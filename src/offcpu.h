@@ -0,0 +1,21 @@
+#ifndef OFFCPU_H
+#define OFFCPU_H
+
+#include <exec/types.h>
+
+struct ExecBase;
+
+BOOL InitOffCpu(void);
+void FreeOffCpu(void);
+
+// Called by the timer interrupt on every sample, takes a snapshot of the wait list
+// at the OFFCPU rate
+void SampleWaitingTasks(struct ExecBase* sysBase);
+
+// Counts new waiting task samples by task and stack. Called once per display interval
+void UpdateOffCpu(void);
+
+// Shows the tasks waiting most and where they wait
+void ShowOffCpu(void);
+
+#endif
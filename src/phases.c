@@ -0,0 +1,514 @@
+#include "phases.h"
+#include "hashmap.h"
+#include "intern.h"
+#include "profiler.h"
+#include "symbols.h"
+#include "tasknames.h"
+#include "common.h"
+
+#include <proto/exec.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Samples of each display interval go to a bucket of their own, stored as sparse
+// vectors of innermost function and task counts. When all buckets are in use,
+// neighbours are merged and buckets become twice as long, so a run of any length
+// fits in fixed memory.
+
+#define MAX_BUCKETS 1024
+#define MAX_PHASE_FUNCTIONS 10
+#define MAX_PHASE_TASKS 5
+#define MAX_CSV_FUNCTIONS 20
+#define MAX_CSV_TASKS 10
+#define MAX_HEAT_MAP_COLUMNS 60
+#define HEAT_MAP_LABEL_LEN 40
+
+typedef struct BucketEntry {
+    uint32 name; // Interned name
+    uint32 count; // Number of samples
+} BucketEntry;
+
+typedef struct Bucket {
+    uint32 samples; // Number of samples, including empty stack traces
+    size_t functionCount;
+    size_t taskCount;
+    BucketEntry* functions; // Sorted by name
+    BucketEntry* tasks; // Sorted by name
+} Bucket;
+
+typedef struct Phases {
+    Bucket* buckets;
+    size_t bucketCount;
+    uint32 bucketIntervals; // Display intervals per bucket, doubles when buckets are merged
+    uint32 currentIntervals; // Display intervals collected to the current bucket
+    uint32 currentSamples;
+    HashMap functionCounts; // Function name id -> samples of the current bucket
+    HashMap taskCounts; // Task name id -> samples of the current bucket
+    HashMap functionNames; // Address -> function name id, cleared with each bucket
+    HashMap taskNames; // Task -> task name id, cleared with each bucket
+    InternTable names;
+    uint64 readStackTraces; // Number of stack traces drained from the ring buffer
+    uint64 lostStackTraces; // Number of stack traces overwritten before draining
+} Phases;
+
+static Phases phases;
+
+static uint32 GetFunctionName(ULONG* address)
+{
+    uint32* name = HashMapGet(&phases.functionNames, (uint32)address);
+
+    if (name) {
+        return *name;
+    }
+
+    SymbolInfo si;
+    LookupSymbol(address, &si);
+
+    char buffer[2 * NAME_LEN];
+    snprintf(buffer, sizeof(buffer), "%s %s", si.moduleName, si.functionName);
+
+    const uint32 id = InternString(&phases.names, buffer);
+
+    name = HashMapAdd(&phases.functionNames, (uint32)address);
+    if (name) {
+        *name = id;
+    }
+
+    return id;
+}
+
+static void AddCount(HashMap* map, const uint32 name, const uint32 count)
+{
+    if (name) {
+        uint32* value = HashMapAdd(map, name);
+        if (value) {
+            *value += count;
+        }
+    }
+}
+
+static void AddSample(const StackTraceSample* sample)
+{
+    phases.currentSamples++;
+
+    AddCount(&phases.taskCounts, InternTaskName(sample->task, &phases.taskNames, &phases.names), 1);
+
+    ULONG** addresses = GetStackTraceAddresses(sample);
+
+    if (addresses && sample->depth > 0) {
+        AddCount(&phases.functionCounts, GetFunctionName(addresses[0]), 1);
+    }
+}
+
+static int CompareNames(const void* first, const void* second)
+{
+    const BucketEntry* a = first;
+    const BucketEntry* b = second;
+
+    if (a->name < b->name) return -1;
+    if (a->name > b->name) return 1;
+
+    return 0;
+}
+
+static int CompareCounts(const void* first, const void* second)
+{
+    const BucketEntry* a = first;
+    const BucketEntry* b = second;
+
+    if (a->count > b->count) return -1;
+    if (a->count < b->count) return 1;
+
+    return 0;
+}
+
+// Returns entries of the map sorted by name, or NULL when map is empty
+static BucketEntry* GetEntries(const HashMap* map)
+{
+    if (!map->count) {
+        return NULL;
+    }
+
+    BucketEntry* entries = AllocateMemory(map->count * sizeof(BucketEntry));
+
+    if (!entries) {
+        puts("Failed to allocate bucket");
+        return NULL;
+    }
+
+    size_t count = 0;
+
+    for (size_t slot = 0; slot < map->capacity; slot++) {
+        if (map->keys[slot]) {
+            entries[count].name = map->keys[slot];
+            entries[count].count = map->values[slot];
+            count++;
+        }
+    }
+
+    qsort(entries, count, sizeof(BucketEntry), CompareNames);
+
+    return entries;
+}
+
+// Merges two sorted sparse vectors, returns NULL when both are empty
+static BucketEntry* MergeEntries(const BucketEntry* a, const size_t countA, const BucketEntry* b, const size_t countB, size_t* count)
+{
+    *count = 0;
+
+    if (!countA && !countB) {
+        return NULL;
+    }
+
+    BucketEntry* merged = AllocateMemory((countA + countB) * sizeof(BucketEntry));
+
+    if (!merged) {
+        puts("Failed to allocate merged bucket");
+        return NULL;
+    }
+
+    size_t i = 0;
+    size_t j = 0;
+
+    while (i < countA || j < countB) {
+        if (j >= countB || (i < countA && a[i].name < b[j].name)) {
+            merged[(*count)++] = a[i++];
+        } else if (i >= countA || b[j].name < a[i].name) {
+            merged[(*count)++] = b[j++];
+        } else {
+            merged[*count] = a[i++];
+            merged[(*count)++].count += b[j++].count;
+        }
+    }
+
+    return merged;
+}
+
+static void FreeBucket(Bucket* bucket)
+{
+    if (bucket->functions) {
+        FreeMemory(bucket->functions);
+    }
+
+    if (bucket->tasks) {
+        FreeMemory(bucket->tasks);
+    }
+
+    memset(bucket, 0, sizeof(Bucket));
+}
+
+static void MergeBuckets(void)
+{
+    for (size_t i = 0; i < phases.bucketCount / 2; i++) {
+        Bucket* first = &phases.buckets[2 * i];
+        Bucket* second = &phases.buckets[2 * i + 1];
+        Bucket merged;
+
+        merged.samples = first->samples + second->samples;
+        merged.functions = MergeEntries(first->functions, first->functionCount, second->functions, second->functionCount, &merged.functionCount);
+        merged.tasks = MergeEntries(first->tasks, first->taskCount, second->tasks, second->taskCount, &merged.taskCount);
+
+        FreeBucket(first);
+        FreeBucket(second);
+
+        phases.buckets[i] = merged;
+    }
+
+    // Odd bucket out starts the next pair
+    if (phases.bucketCount % 2) {
+        phases.buckets[phases.bucketCount / 2] = phases.buckets[phases.bucketCount - 1];
+        memset(&phases.buckets[phases.bucketCount - 1], 0, sizeof(Bucket));
+    }
+
+    phases.bucketCount = (phases.bucketCount + 1) / 2;
+    phases.bucketIntervals *= 2;
+}
+
+static void CloseBucket(void)
+{
+    if (phases.bucketCount >= MAX_BUCKETS) {
+        MergeBuckets();
+    }
+
+    Bucket* bucket = &phases.buckets[phases.bucketCount++];
+
+    bucket->samples = phases.currentSamples;
+    bucket->functions = GetEntries(&phases.functionCounts);
+    bucket->functionCount = bucket->functions ? phases.functionCounts.count : 0;
+    bucket->tasks = GetEntries(&phases.taskCounts);
+    bucket->taskCount = bucket->tasks ? phases.taskCounts.count : 0;
+
+    phases.currentSamples = 0;
+    phases.currentIntervals = 0;
+
+    ClearHashMap(&phases.functionCounts);
+    ClearHashMap(&phases.taskCounts);
+
+    // Tasks and modules come and go, refresh names for the next bucket
+    ClearHashMap(&phases.functionNames);
+    ClearHashMap(&phases.taskNames);
+}
+
+void UpdatePhases(void)
+{
+    size_t index;
+    size_t pending = GetNewStackTraces(&phases.readStackTraces, &index, &phases.lostStackTraces);
+
+    while (pending > 0) {
+        AddSample(&ctx.profiling.samples[index]);
+
+        if (++index >= ctx.profiling.maxStackTraces) {
+            index = 0;
+        }
+
+        pending--;
+    }
+
+    if (++phases.currentIntervals >= phases.bucketIntervals) {
+        CloseBucket();
+    }
+}
+
+static uint32 GetCount(const BucketEntry* entries, const size_t count, const uint32 name)
+{
+    const BucketEntry key = { name, 0 };
+    const BucketEntry* entry = bsearch(&key, entries, count, sizeof(BucketEntry), CompareNames);
+
+    return entry ? entry->count : 0;
+}
+
+// Returns the highest totals over all buckets, sorted by count
+static size_t GetTop(const BOOL tasks, BucketEntry* top, const size_t max)
+{
+    HashMap totals;
+
+    if (!InitHashMap(&totals, 0)) {
+        puts("Failed to allocate phase totals");
+        return 0;
+    }
+
+    for (size_t b = 0; b < phases.bucketCount; b++) {
+        const Bucket* bucket = &phases.buckets[b];
+        const BucketEntry* entries = tasks ? bucket->tasks : bucket->functions;
+        const size_t count = tasks ? bucket->taskCount : bucket->functionCount;
+
+        for (size_t i = 0; i < count; i++) {
+            AddCount(&totals, entries[i].name, entries[i].count);
+        }
+    }
+
+    BucketEntry* all = GetEntries(&totals);
+    const size_t allCount = all ? totals.count : 0;
+    size_t count = 0;
+
+    if (all) {
+        qsort(all, allCount, sizeof(BucketEntry), CompareCounts);
+
+        count = allCount < max ? allCount : max;
+        memcpy(top, all, count * sizeof(BucketEntry));
+
+        FreeMemory(all);
+    }
+
+    FreeHashMap(&totals);
+
+    return count;
+}
+
+static char GetHeatChar(const float share)
+{
+    static const char heat[] = " .:-=+*#%@";
+    const size_t levels = sizeof(heat) - 1;
+
+    if (share <= 0.0f) {
+        return heat[0];
+    }
+
+    // Any sample at all is visible
+    size_t level = 1 + (size_t)(share * (float)(levels - 1));
+
+    if (level >= levels) {
+        level = levels - 1;
+    }
+
+    return heat[level];
+}
+
+static void ShowHeatMap(const char* title, const BOOL tasks, const BucketEntry* top, const size_t topCount)
+{
+    const size_t bucketsPerColumn = (phases.bucketCount + MAX_HEAT_MAP_COLUMNS - 1) / MAX_HEAT_MAP_COLUMNS;
+    const size_t columns = (phases.bucketCount + bucketsPerColumn - 1) / bucketsPerColumn;
+
+    printf("\n%-*s |%s\n", HEAT_MAP_LABEL_LEN, title, "Share of samples over time, from ' ' (none) to '@' (all)");
+
+    for (size_t t = 0; t < topCount; t++) {
+        char line[MAX_HEAT_MAP_COLUMNS + 1];
+
+        for (size_t c = 0; c < columns; c++) {
+            uint32 count = 0;
+            uint32 samples = 0;
+
+            for (size_t b = c * bucketsPerColumn; b < (c + 1) * bucketsPerColumn && b < phases.bucketCount; b++) {
+                const Bucket* bucket = &phases.buckets[b];
+
+                count += tasks ? GetCount(bucket->tasks, bucket->taskCount, top[t].name) :
+                                 GetCount(bucket->functions, bucket->functionCount, top[t].name);
+                samples += bucket->samples;
+            }
+
+            line[c] = GetHeatChar(samples ? (float)count / (float)samples : 0.0f);
+        }
+
+        line[columns] = '\0';
+
+        printf("%-*.*s |%s|\n", HEAT_MAP_LABEL_LEN, HEAT_MAP_LABEL_LEN, GetInternedString(&phases.names, top[t].name), line);
+    }
+}
+
+static void WriteCsvName(FILE* file, const char* prefix, const char* name)
+{
+    // Quotes are doubled inside a quoted field
+    fprintf(file, ",\"%s", prefix);
+
+    for (const char* c = name; *c; c++) {
+        if (*c == '"') {
+            fputc('"', file);
+        }
+        fputc(*c, file);
+    }
+
+    fputc('"', file);
+}
+
+static void WriteCsv(const char* fileName)
+{
+    BucketEntry functions[MAX_CSV_FUNCTIONS];
+    BucketEntry tasks[MAX_CSV_TASKS];
+
+    const size_t functionCount = GetTop(FALSE, functions, MAX_CSV_FUNCTIONS);
+    const size_t taskCount = GetTop(TRUE, tasks, MAX_CSV_TASKS);
+
+    FILE* file = fopen(fileName, "w");
+
+    if (!file) {
+        printf("Failed to open '%s' for writing\n", fileName);
+        return;
+    }
+
+    fprintf(file, "\"Start (s)\",\"Samples\"");
+
+    for (size_t i = 0; i < functionCount; i++) {
+        WriteCsvName(file, "Function: ", GetInternedString(&phases.names, functions[i].name));
+    }
+
+    for (size_t i = 0; i < taskCount; i++) {
+        WriteCsvName(file, "Task: ", GetInternedString(&phases.names, tasks[i].name));
+    }
+
+    fputc('\n', file);
+
+    const uint32 bucketLength = phases.bucketIntervals * ctx.interval;
+
+    for (size_t b = 0; b < phases.bucketCount; b++) {
+        const Bucket* bucket = &phases.buckets[b];
+
+        fprintf(file, "%lu,%lu", (uint32)b * bucketLength, bucket->samples);
+
+        for (size_t i = 0; i < functionCount; i++) {
+            fprintf(file, ",%lu", GetCount(bucket->functions, bucket->functionCount, functions[i].name));
+        }
+
+        for (size_t i = 0; i < taskCount; i++) {
+            fprintf(file, ",%lu", GetCount(bucket->tasks, bucket->taskCount, tasks[i].name));
+        }
+
+        fputc('\n', file);
+    }
+
+    fclose(file);
+
+    printf("Wrote %u time bucket(s) to '%s'\n", phases.bucketCount, fileName);
+}
+
+void ShowPhases(void)
+{
+    // Include the partial bucket collected before quitting
+    UpdatePhases();
+
+    if (phases.currentSamples) {
+        CloseBucket();
+    }
+
+    if (!phases.bucketCount) {
+        puts("No time buckets collected");
+        return;
+    }
+
+    const uint32 bucketLength = phases.bucketIntervals * ctx.interval;
+    const size_t bucketsPerColumn = (phases.bucketCount + MAX_HEAT_MAP_COLUMNS - 1) / MAX_HEAT_MAP_COLUMNS;
+
+    printf("\nPhases (%u bucket(s) of %lu second(s), one column is %lu second(s)):\n",
+           phases.bucketCount, bucketLength, (uint32)bucketsPerColumn * bucketLength);
+
+    BucketEntry top[MAX_PHASE_FUNCTIONS];
+
+    size_t count = GetTop(FALSE, top, MAX_PHASE_FUNCTIONS);
+    ShowHeatMap("Innermost function", FALSE, top, count);
+
+    count = GetTop(TRUE, top, MAX_PHASE_TASKS);
+    ShowHeatMap("Task", TRUE, top, count);
+
+    if (phases.lostStackTraces) {
+        printf("%llu stack trace(s) were overwritten before they could be bucketed\n", phases.lostStackTraces);
+    }
+
+    if (ctx.profiling.phaseCsvFile[0]) {
+        WriteCsv(ctx.profiling.phaseCsvFile);
+    }
+}
+
+BOOL InitPhases(void)
+{
+    memset(&phases, 0, sizeof(phases));
+
+    phases.bucketIntervals = 1;
+    phases.buckets = AllocateMemory(MAX_BUCKETS * sizeof(Bucket));
+
+    if (!phases.buckets) {
+        puts("Failed to allocate time buckets");
+        return FALSE;
+    }
+
+    if (!InitHashMap(&phases.functionCounts, 0) ||
+        !InitHashMap(&phases.taskCounts, 0) ||
+        !InitHashMap(&phases.functionNames, 0) ||
+        !InitHashMap(&phases.taskNames, 0) ||
+        !InitInternTable(&phases.names)) {
+        puts("Failed to allocate time bucket tables");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void FreePhases(void)
+{
+    if (phases.buckets) {
+        for (size_t i = 0; i < phases.bucketCount; i++) {
+            FreeBucket(&phases.buckets[i]);
+        }
+
+        FreeMemory(phases.buckets);
+        phases.buckets = NULL;
+    }
+
+    phases.bucketCount = 0;
+
+    FreeHashMap(&phases.functionCounts);
+    FreeHashMap(&phases.taskCounts);
+    FreeHashMap(&phases.functionNames);
+    FreeHashMap(&phases.taskNames);
+    FreeInternTable(&phases.names);
+}
@@ -0,0 +1,17 @@
+#ifndef PHASES_H
+#define PHASES_H
+
+#include <exec/types.h>
+
+BOOL InitPhases(void);
+void FreePhases(void);
+
+// Moves new stack trace samples from the interrupt ring buffer to a bucket of
+// their own. Called once per display interval
+void UpdatePhases(void);
+
+// Shows how the top functions and tasks change over the run, and writes them as CSV
+// when PHASECSV is given
+void ShowPhases(void);
+
+#endif
@@ -0,0 +1,298 @@
+#include "ports.h"
+#include "hashmap.h"
+#include "intern.h"
+#include "profiler.h"
+#include "tasknames.h"
+#include "common.h"
+
+#include <proto/exec.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Port monitor counts the messages queued at each public message port once per
+// display interval. A queue that keeps growing tells that the owner task doesn't
+// keep up with its clients. Ports are told apart by name, owners by task name.
+
+#define MAX_SHOWN_BACKLOGS 20
+
+typedef struct PortSnapshot {
+    char name[NAME_LEN]; // Copied while the port list is locked
+    struct Task* owner; // Signalled task, NULL when port doesn't signal
+    uint32 queued; // Number of messages in the queue
+} PortSnapshot;
+
+typedef struct BacklogStats {
+    uint32 name; // Interned port or task name
+    uint32 owner; // Interned owner task name of a port, 0 for tasks
+    uint32 queued; // Messages queued at the last sample
+    uint32 max; // Longest queue seen
+    uint64 sum; // Sum of queue lengths, for the average
+    uint32 samples; // Number of samples the port or task was seen
+    uint32 lastSample; // Last sample the port or task was seen
+    uint32 ports; // Number of ports owned at the last sample, tasks only
+} BacklogStats;
+
+typedef struct BacklogTable {
+    BacklogStats* stats;
+    size_t count;
+    HashMap map; // Interned name -> stats index + 1
+} BacklogTable;
+
+typedef struct Ports {
+    PortSnapshot* snapshot; // Ports of the latest sample
+    size_t snapshotCount; // Number of ports in the latest sample
+    uint32 sample; // Number of samples taken
+    uint32 skippedPorts; // Ports left out when there were more than MAX_PORTS
+    BacklogTable ports;
+    BacklogTable tasks;
+    HashMap taskNames; // Task -> task name string id, cleared with each update
+    InternTable names; // Port and task names
+} Ports;
+
+static Ports ports;
+
+static uint32 GetTaskName(struct Task* task)
+{
+    if (!task) {
+        return InternString(&ports.names, "(no task)");
+    }
+
+    return InternTaskName(task, &ports.taskNames, &ports.names);
+}
+
+static size_t CountMessages(struct List* list)
+{
+    size_t count = 0;
+    for (struct Node* node = IExec->GetHead(list); node; node = IExec->GetSucc(node)) {
+        count++;
+    }
+
+    return count;
+}
+
+static void TakeSnapshot(void)
+{
+    struct ExecBase* eb = (struct ExecBase *)SysBase;
+
+    ports.snapshotCount = 0;
+
+    // Names are copied, so nothing is allocated while the list is locked
+    IExec->Forbid();
+
+    for (struct Node* node = IExec->GetHead(&eb->PortList); node; node = IExec->GetSucc(node)) {
+        struct MsgPort* port = (struct MsgPort *)node;
+
+        if (ports.snapshotCount >= MAX_PORTS) {
+            ports.skippedPorts++;
+            continue;
+        }
+
+        PortSnapshot* snapshot = &ports.snapshot[ports.snapshotCount++];
+
+        snprintf(snapshot->name, NAME_LEN, "%s", node->ln_Name ? node->ln_Name : "(unnamed)");
+        snapshot->owner = (port->mp_Flags & PF_ACTION) == PA_SIGNAL ? port->mp_SigTask : NULL;
+        // Interrupts can PutMsg() too, so the queue is counted with them disabled
+        IExec->Disable();
+        snapshot->queued = (uint32)CountMessages(&port->mp_MsgList);
+        IExec->Enable();
+    }
+
+    IExec->Permit();
+}
+
+static BacklogStats* GetStats(BacklogTable* table, const uint32 name)
+{
+    if (!name) {
+        return NULL;
+    }
+
+    uint32* index = HashMapAdd(&table->map, name);
+
+    if (!index) {
+        return NULL;
+    }
+
+    if (*index == 0) {
+        if (table->count >= MAX_PORTS) {
+            HashMapRemove(&table->map, name);
+            return NULL;
+        }
+
+        table->stats[table->count].name = name;
+        *index = (uint32)++table->count;
+    }
+
+    return &table->stats[*index - 1];
+}
+
+// Several ports of one owner are summed within a sample, so queued is reset first
+static void AddQueued(BacklogStats* stats, const uint32 queued)
+{
+    if (stats->lastSample != ports.sample) {
+        stats->lastSample = ports.sample;
+        stats->queued = 0;
+        stats->ports = 0;
+        stats->samples++;
+    }
+
+    stats->queued += queued;
+    stats->sum += queued;
+    stats->ports++;
+
+    if (stats->queued > stats->max) {
+        stats->max = stats->queued;
+    }
+}
+
+void UpdatePorts(void)
+{
+    TakeSnapshot();
+
+    ports.sample++;
+
+    for (size_t i = 0; i < ports.snapshotCount; i++) {
+        const PortSnapshot* snapshot = &ports.snapshot[i];
+        const uint32 owner = GetTaskName(snapshot->owner);
+
+        BacklogStats* port = GetStats(&ports.ports, InternString(&ports.names, snapshot->name));
+
+        if (port) {
+            port->owner = owner;
+            AddQueued(port, snapshot->queued);
+        }
+
+        BacklogStats* task = GetStats(&ports.tasks, owner);
+
+        if (task) {
+            AddQueued(task, snapshot->queued);
+        }
+    }
+
+    // Task pointers are reused by new tasks, refresh names for the next update
+    ClearHashMap(&ports.taskNames);
+}
+
+static int CompareBacklogs(const void* first, const void* second)
+{
+    const Backlog* a = first;
+    const Backlog* b = second;
+
+    if (a->queued != b->queued) return a->queued > b->queued ? -1 : 1;
+    if (a->max != b->max) return a->max > b->max ? -1 : 1;
+    if (a->average > b->average) return -1;
+    if (a->average < b->average) return 1;
+
+    return 0;
+}
+
+// Only ports and tasks seen in the latest sample are listed
+static size_t GetBacklogs(const BacklogTable* table, Backlog* backlogs, const size_t max)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < table->count; i++) {
+        const BacklogStats* stats = &table->stats[i];
+
+        if (stats->lastSample != ports.sample) {
+            continue;
+        }
+
+        Backlog* backlog = &backlogs[count++];
+        backlog->name = GetInternedString(&ports.names, stats->name);
+        backlog->owner = stats->owner ? GetInternedString(&ports.names, stats->owner) : "";
+        backlog->queued = stats->queued;
+        backlog->average = (float)stats->sum / (float)stats->samples;
+        backlog->max = stats->max;
+        backlog->ports = stats->ports;
+    }
+
+    qsort(backlogs, count, sizeof(Backlog), CompareBacklogs);
+
+    return count < max ? count : max;
+}
+
+size_t GetPortBacklogs(Backlog* backlogs, const size_t max)
+{
+    return GetBacklogs(&ports.ports, backlogs, max);
+}
+
+size_t GetTaskBacklogs(Backlog* backlogs, const size_t max)
+{
+    return GetBacklogs(&ports.tasks, backlogs, max);
+}
+
+void ShowPorts(void)
+{
+    static Backlog backlogs[MAX_PORTS];
+
+    size_t count = GetPortBacklogs(backlogs, MAX_SHOWN_BACKLOGS);
+
+    printf("\n%-32s %-32s %8s %8s %8s\n", "Port", "Owner", "Queued", "Average", "Max");
+
+    for (size_t i = 0; i < count; i++) {
+        printf("%-32s %-32s %8lu %8.1f %8lu\n",
+               backlogs[i].name, backlogs[i].owner, backlogs[i].queued, backlogs[i].average, backlogs[i].max);
+    }
+
+    count = GetTaskBacklogs(backlogs, MAX_SHOWN_BACKLOGS);
+
+    printf("\n%-40s %6s %8s %8s %8s\n", "Port owner", "Ports", "Queued", "Average", "Max");
+
+    for (size_t i = 0; i < count; i++) {
+        printf("%-40s %6lu %8lu %8.1f %8lu\n",
+               backlogs[i].name, backlogs[i].ports, backlogs[i].queued, backlogs[i].average, backlogs[i].max);
+    }
+
+    if (ports.skippedPorts) {
+        printf("%lu port(s) were left out from samples with more than %u ports\n", ports.skippedPorts, MAX_PORTS);
+    }
+}
+
+BOOL InitPorts(void)
+{
+    memset(&ports, 0, sizeof(ports));
+
+    ports.snapshot = AllocateMemory(MAX_PORTS * sizeof(PortSnapshot));
+    ports.ports.stats = AllocateMemory(MAX_PORTS * sizeof(BacklogStats));
+    ports.tasks.stats = AllocateMemory(MAX_PORTS * sizeof(BacklogStats));
+
+    if (!ports.snapshot || !ports.ports.stats || !ports.tasks.stats) {
+        puts("Failed to allocate port monitor buffers");
+        return FALSE;
+    }
+
+    if (!InitHashMap(&ports.ports.map, 0) ||
+        !InitHashMap(&ports.tasks.map, 0) ||
+        !InitHashMap(&ports.taskNames, 0) ||
+        !InitInternTable(&ports.names)) {
+        puts("Failed to allocate port monitor tables");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void FreePorts(void)
+{
+    FreeHashMap(&ports.ports.map);
+    FreeHashMap(&ports.tasks.map);
+    FreeHashMap(&ports.taskNames);
+    FreeInternTable(&ports.names);
+
+    if (ports.tasks.stats) {
+        FreeMemory(ports.tasks.stats);
+        ports.tasks.stats = NULL;
+    }
+
+    if (ports.ports.stats) {
+        FreeMemory(ports.ports.stats);
+        ports.ports.stats = NULL;
+    }
+
+    if (ports.snapshot) {
+        FreeMemory(ports.snapshot);
+        ports.snapshot = NULL;
+    }
+}
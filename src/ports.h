@@ -0,0 +1,31 @@
+#ifndef PORTS_H
+#define PORTS_H
+
+#include <exec/types.h>
+
+#define MAX_PORTS 256
+
+typedef struct Backlog {
+    const char* name; // Port or task name, valid until the next update
+    const char* owner; // Owner task name of a port, empty for tasks
+    uint32 queued; // Messages queued at the latest sample
+    float average; // Average queue length
+    uint32 max; // Longest queue seen
+    uint32 ports; // Number of ports of a task at the latest sample
+} Backlog;
+
+BOOL InitPorts(void);
+void FreePorts(void);
+
+// Counts messages queued at public message ports. Called once per display interval
+void UpdatePorts(void);
+
+// Fill backlogs of ports or their owner tasks, the longest queues first, and return
+// at most max of them. Array must have room for MAX_PORTS entries
+size_t GetPortBacklogs(Backlog* backlogs, size_t max);
+size_t GetTaskBacklogs(Backlog* backlogs, size_t max);
+
+// Shows the longest port queues and their owners
+void ShowPorts(void);
+
+#endif
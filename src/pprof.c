@@ -0,0 +1,708 @@
+#include "pprof.h"
+#include "symbols.h"
+#include "profiler.h"
+#include "hashmap.h"
+#include "intern.h"
+#include "common.h"
+
+#include <proto/exec.h>
+
+#include <stdio.h>
+#include <string.h>
+
+// Minimal writer for the pprof profile.proto format:
+// https://github.com/google/pprof/blob/main/proto/profile.proto
+// Profile is protobuf encoded and gzipped. Deflate uses LZ77 matches and the fixed
+// Huffman codes, which shrink the repetitive protobuf well without code tables.
+
+#define WINDOW_SIZE 32768 // Deflate distances reach 32 KB back
+#define HASH_SIZE 32768
+#define MAX_CHAIN 64 // Earlier positions tried per match, bounds the time on repetitive data
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+
+enum ProfileField {
+    PROFILE_SampleType = 1,
+    PROFILE_Sample = 2,
+    PROFILE_Mapping = 3,
+    PROFILE_Location = 4,
+    PROFILE_Function = 5,
+    PROFILE_StringTable = 6,
+    PROFILE_DurationNanos = 10,
+    PROFILE_PeriodType = 11,
+    PROFILE_Period = 12
+};
+
+enum WireType {
+    WIRE_Varint = 0,
+    WIRE_LengthDelimited = 2
+};
+
+typedef struct Buffer {
+    uint8* data;
+    size_t size;
+    size_t capacity;
+    BOOL failed; // Set when buffer couldn't grow
+} Buffer;
+
+typedef struct Mapping {
+    uint32 filename; // String table index
+    uint32 start; // Lowest address seen
+    uint32 limit; // Highest address seen + instruction size
+} Mapping;
+
+typedef struct Builder {
+    InternTable strings;
+    HashMap locationIds; // Address -> location id
+    InternTable functionKeys; // "module`function", static functions of different modules may share names
+    HashMap functionIds; // Function key + 1 -> function id
+    HashMap mappingIds; // Module name string index + 1 -> mapping id
+    Mapping* mappings;
+    size_t mappingCount;
+    size_t locationCount;
+    size_t functionCount;
+    Buffer samples;
+    Buffer locations;
+    Buffer functions;
+    Buffer scratch; // Nested message being encoded
+    Buffer line; // Innermost nested message being encoded
+} Builder;
+
+static BOOL Reserve(Buffer* buffer, const size_t extra)
+{
+    if (buffer->failed) {
+        return FALSE;
+    }
+
+    if (buffer->size + extra > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 1024;
+
+        while (capacity < buffer->size + extra) {
+            capacity *= 2;
+        }
+
+        uint8* data = AllocateMemory(capacity);
+
+        if (!data) {
+            buffer->failed = TRUE;
+            return FALSE;
+        }
+
+        if (buffer->data) {
+            memcpy(data, buffer->data, buffer->size);
+            FreeMemory(buffer->data);
+        }
+
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+
+    return TRUE;
+}
+
+static void FreeBuffer(Buffer* buffer)
+{
+    if (buffer->data) {
+        FreeMemory(buffer->data);
+    }
+
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->capacity = 0;
+}
+
+static void PutBytes(Buffer* buffer, const void* data, const size_t size)
+{
+    if (size && Reserve(buffer, size)) {
+        memcpy(buffer->data + buffer->size, data, size);
+        buffer->size += size;
+    }
+}
+
+static void PutVarint(Buffer* buffer, uint64 value)
+{
+    uint8 bytes[10];
+    size_t size = 0;
+
+    do {
+        bytes[size] = (uint8)(value & 0x7F);
+        value >>= 7;
+        if (value) {
+            bytes[size] |= 0x80;
+        }
+        size++;
+    } while (value);
+
+    PutBytes(buffer, bytes, size);
+}
+
+static void PutKey(Buffer* buffer, const uint32 field, const uint32 wireType)
+{
+    PutVarint(buffer, (field << 3) | wireType);
+}
+
+// Zero is the default value in proto3 and can be left out
+static void PutVarintField(Buffer* buffer, const uint32 field, const uint64 value)
+{
+    if (value) {
+        PutKey(buffer, field, WIRE_Varint);
+        PutVarint(buffer, value);
+    }
+}
+
+static void PutLengthDelimited(Buffer* buffer, const uint32 field, const void* data, const size_t size)
+{
+    PutKey(buffer, field, WIRE_LengthDelimited);
+    PutVarint(buffer, size);
+    PutBytes(buffer, data, size);
+}
+
+static void PutMessageField(Buffer* buffer, const uint32 field, Buffer* message)
+{
+    PutLengthDelimited(buffer, field, message->data, message->size);
+    buffer->failed |= message->failed;
+    message->size = 0;
+}
+
+static void PutPackedField(Buffer* buffer, const uint32 field, const uint64* values, const size_t count)
+{
+    Buffer packed = { NULL, 0, 0, FALSE };
+
+    for (size_t i = 0; i < count; i++) {
+        PutVarint(&packed, values[i]);
+    }
+
+    PutMessageField(buffer, field, &packed);
+    FreeBuffer(&packed);
+}
+
+static uint32 String(Builder* builder, const char* string)
+{
+    return InternString(&builder->strings, string);
+}
+
+static uint32 AddFunction(Builder* builder, const SymbolInfo* si)
+{
+    char key[2 * NAME_LEN];
+    snprintf(key, sizeof(key), "%s`%s", si->moduleName, si->functionName);
+
+    const uint32 keyId = InternString(&builder->functionKeys, key);
+    uint32* id = keyId ? HashMapAdd(&builder->functionIds, keyId + 1) : NULL;
+
+    if (!id) {
+        return 0;
+    }
+
+    if (!*id) {
+        const uint32 name = String(builder, si->functionName);
+
+        *id = (uint32)++builder->functionCount;
+
+        Buffer* function = &builder->scratch;
+        PutVarintField(function, 1, *id); // id
+        PutVarintField(function, 2, name); // name
+        PutVarintField(function, 3, name); // system_name
+        PutVarintField(function, 4, String(builder, si->sourceFile)); // filename
+        PutMessageField(&builder->functions, PROFILE_Function, function);
+    }
+
+    return *id;
+}
+
+static uint32 AddMapping(Builder* builder, const SymbolInfo* si, const uint32 address)
+{
+    const uint32 filename = String(builder, si->moduleName);
+    uint32* id = HashMapAdd(&builder->mappingIds, filename + 1);
+
+    if (!id) {
+        return 0;
+    }
+
+    if (!*id) {
+        Mapping* mappings = AllocateMemory((builder->mappingCount + 1) * sizeof(Mapping));
+
+        if (!mappings) {
+            return 0;
+        }
+
+        if (builder->mappings) {
+            memcpy(mappings, builder->mappings, builder->mappingCount * sizeof(Mapping));
+            FreeMemory(builder->mappings);
+        }
+
+        builder->mappings = mappings;
+        builder->mappings[builder->mappingCount].filename = filename;
+        builder->mappings[builder->mappingCount].start = address;
+        builder->mappings[builder->mappingCount].limit = address + 4;
+
+        *id = (uint32)++builder->mappingCount;
+    }
+
+    Mapping* mapping = &builder->mappings[*id - 1];
+
+    if (address < mapping->start) {
+        mapping->start = address;
+    }
+
+    if (address + 4 > mapping->limit) {
+        mapping->limit = address + 4;
+    }
+
+    return *id;
+}
+
+static uint32 AddLocation(Builder* builder, uint32* ip)
+{
+    const uint32 address = (uint32)ip;
+    uint32* id = HashMapGet(&builder->locationIds, address);
+
+    if (id) {
+        return *id;
+    }
+
+    SymbolInfo si;
+    uint32 mappingId = 0;
+    uint32 functionId = 0;
+
+    if (LookupSymbol(ip, &si)) {
+        mappingId = AddMapping(builder, &si, address);
+
+        if (si.functionName[0]) {
+            functionId = AddFunction(builder, &si);
+        }
+    }
+
+    id = HashMapAdd(&builder->locationIds, address);
+
+    if (!id) {
+        return 0;
+    }
+
+    *id = (uint32)++builder->locationCount;
+
+    Buffer* location = &builder->scratch;
+    PutVarintField(location, 1, *id); // id
+    PutVarintField(location, 2, mappingId); // mapping_id
+    PutVarintField(location, 3, address); // address
+
+    if (functionId) {
+        PutVarintField(&builder->line, 1, functionId); // function_id
+        PutVarintField(&builder->line, 2, si.line); // line
+        PutMessageField(location, 4, &builder->line); // line
+    }
+
+    PutMessageField(&builder->locations, PROFILE_Location, location);
+
+    return *id;
+}
+
+static void AddSample(Builder* builder, const StackTrace* trace, const uint64 period)
+{
+    uint64 locationIds[MAX_STACK_DEPTH];
+    ULONG* frames[MAX_STACK_DEPTH];
+    const size_t frameCount = ExpandRepeats(trace->ip, trace->depth, frames, MAX_STACK_DEPTH);
+    size_t depth = 0;
+
+    // pprof expects the innermost frame first, like Tequila stores them
+    while (depth < frameCount) {
+        locationIds[depth] = AddLocation(builder, frames[depth]);
+        depth++;
+    }
+
+    const uint64 values[2] = { trace->count, trace->count * period };
+    const SampleInfo sampleInfo = InitializeTaskData(trace->task);
+
+    Buffer* sample = &builder->scratch;
+    PutPackedField(sample, 1, locationIds, depth); // location_id
+    PutPackedField(sample, 2, values, 2); // value
+
+    PutVarintField(&builder->line, 1, String(builder, "task")); // key
+    PutVarintField(&builder->line, 2, String(builder, sampleInfo.nameBuffer)); // str
+    PutMessageField(sample, 3, &builder->line); // label
+
+    PutMessageField(&builder->samples, PROFILE_Sample, sample);
+}
+
+static void PutValueType(Buffer* buffer, const uint32 field, Builder* builder, const char* type, const char* unit)
+{
+    PutVarintField(&builder->scratch, 1, String(builder, type));
+    PutVarintField(&builder->scratch, 2, String(builder, unit));
+    PutMessageField(buffer, field, &builder->scratch);
+}
+
+static void BuildProfile(Builder* builder, Buffer* profile, const StackTrace* traces, const size_t count)
+{
+    const uint64 period = 1000000000ULL / ctx.samples;
+
+    PutValueType(profile, PROFILE_SampleType, builder, "samples", "count");
+    PutValueType(profile, PROFILE_SampleType, builder, "cpu", "nanoseconds");
+
+    for (size_t i = 0; i < count; i++) {
+        // Empty stack traces have no locations to show
+        if (traces[i].id != 0) {
+            AddSample(builder, &traces[i], period);
+        }
+    }
+
+    PutBytes(profile, builder->samples.data, builder->samples.size);
+
+    for (size_t m = 0; m < builder->mappingCount; m++) {
+        const Mapping* mapping = &builder->mappings[m];
+
+        PutVarintField(&builder->scratch, 1, m + 1); // id
+        PutVarintField(&builder->scratch, 2, mapping->start); // memory_start
+        PutVarintField(&builder->scratch, 3, mapping->limit); // memory_limit
+        PutVarintField(&builder->scratch, 5, mapping->filename); // filename
+        PutVarintField(&builder->scratch, 7, 1); // has_functions
+        PutMessageField(profile, PROFILE_Mapping, &builder->scratch);
+    }
+
+    PutBytes(profile, builder->locations.data, builder->locations.size);
+    PutBytes(profile, builder->functions.data, builder->functions.size);
+
+    PutVarintField(profile, PROFILE_DurationNanos, ctx.profiling.stackTraces * period);
+    PutValueType(profile, PROFILE_PeriodType, builder, "cpu", "nanoseconds");
+    PutVarintField(profile, PROFILE_Period, period);
+
+    // String table goes last because it must contain every string referenced above.
+    // Index 0 is the empty string and it has to be present.
+    for (size_t s = 0; s < builder->strings.count; s++) {
+        const char* string = GetInternedString(&builder->strings, (uint32)s);
+        PutLengthDelimited(profile, PROFILE_StringTable, string, strlen(string));
+    }
+
+    profile->failed |= builder->samples.failed | builder->locations.failed | builder->functions.failed |
+                       builder->scratch.failed | builder->line.failed;
+}
+
+static uint32 Crc32(const uint8* data, const size_t size)
+{
+    static uint32 table[256];
+
+    if (!table[1]) {
+        for (uint32 n = 0; n < 256; n++) {
+            uint32 c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+    }
+
+    uint32 crc = 0xFFFFFFFF;
+
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc ^ 0xFFFFFFFF;
+}
+
+static void PutLittleEndian32(uint8* bytes, const uint32 value)
+{
+    bytes[0] = (uint8)value;
+    bytes[1] = (uint8)(value >> 8);
+    bytes[2] = (uint8)(value >> 16);
+    bytes[3] = (uint8)(value >> 24);
+}
+
+typedef struct BitWriter {
+    Buffer* buffer;
+    uint32 bits; // Bits not yet written, first bit lowest
+    uint32 count; // Number of bits not yet written
+} BitWriter;
+
+static void PutBits(BitWriter* writer, const uint32 value, const uint32 count)
+{
+    writer->bits |= value << writer->count;
+    writer->count += count;
+
+    while (writer->count >= 8) {
+        const uint8 byte = (uint8)writer->bits;
+        PutBytes(writer->buffer, &byte, 1);
+        writer->bits >>= 8;
+        writer->count -= 8;
+    }
+}
+
+// Huffman codes are packed starting from their highest bit
+static void PutCode(BitWriter* writer, const uint32 code, const uint32 length)
+{
+    uint32 reversed = 0;
+
+    for (uint32 bit = 0; bit < length; bit++) {
+        reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+    }
+
+    PutBits(writer, reversed, length);
+}
+
+// Fixed literal/length code of RFC 1951 section 3.2.6
+static void PutSymbol(BitWriter* writer, const uint32 symbol)
+{
+    if (symbol < 144) {
+        PutCode(writer, 0x30 + symbol, 8);
+    } else if (symbol < 256) {
+        PutCode(writer, 0x190 + symbol - 144, 9);
+    } else if (symbol < 280) {
+        PutCode(writer, symbol - 256, 7);
+    } else {
+        PutCode(writer, 0xC0 + symbol - 280, 8);
+    }
+}
+
+static void PutMatch(BitWriter* writer, const uint32 length, const uint32 distance)
+{
+    static const uint16 lengthBase[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+    static const uint8 lengthExtra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+    };
+    static const uint16 distanceBase[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+    };
+    static const uint8 distanceExtra[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+    };
+
+    uint32 l = 28;
+    while (lengthBase[l] > length) {
+        l--;
+    }
+
+    PutSymbol(writer, 257 + l);
+    PutBits(writer, length - lengthBase[l], lengthExtra[l]);
+
+    uint32 d = 29;
+    while (distanceBase[d] > distance) {
+        d--;
+    }
+
+    // Distance codes are all 5 bits long
+    PutCode(writer, d, 5);
+    PutBits(writer, distance - distanceBase[d], distanceExtra[d]);
+}
+
+static uint32 Hash(const uint8* bytes)
+{
+    return (((uint32)bytes[0] << 10) ^ ((uint32)bytes[1] << 5) ^ bytes[2]) & (HASH_SIZE - 1);
+}
+
+// Chains store position + 1, 0 ends a chain
+static void InsertPosition(const Buffer* data, uint32* head, uint32* previous, const size_t position)
+{
+    if (position + MIN_MATCH <= data->size) {
+        const uint32 hash = Hash(data->data + position);
+        previous[position & (WINDOW_SIZE - 1)] = head[hash];
+        head[hash] = (uint32)position + 1;
+    }
+}
+
+// Finds the longest earlier match of the bytes at position, returns its length
+static size_t FindMatch(const Buffer* data, const uint32* head, const uint32* previous, const size_t position,
+                        size_t* distance)
+{
+    if (position + MIN_MATCH > data->size) {
+        return 0;
+    }
+
+    const size_t maxLength = (data->size - position > MAX_MATCH) ? MAX_MATCH : data->size - position;
+    size_t bestLength = 0;
+    uint32 candidate = head[Hash(data->data + position)];
+
+    for (size_t chain = 0; candidate && chain < MAX_CHAIN; chain++) {
+        const size_t match = candidate - 1;
+
+        if (position - match > WINDOW_SIZE) {
+            break;
+        }
+
+        size_t length = 0;
+
+        while (length < maxLength && data->data[match + length] == data->data[position + length]) {
+            length++;
+        }
+
+        if (length > bestLength) {
+            bestLength = length;
+            *distance = position - match;
+
+            if (length == maxLength) {
+                break;
+            }
+        }
+
+        candidate = previous[match & (WINDOW_SIZE - 1)];
+    }
+
+    return bestLength;
+}
+
+// Compresses data into one final deflate block with fixed Huffman codes
+static BOOL Deflate(const Buffer* data, Buffer* compressed)
+{
+    uint32* head = AllocateMemory(HASH_SIZE * sizeof(uint32));
+    uint32* previous = AllocateMemory(WINDOW_SIZE * sizeof(uint32));
+    BitWriter writer = { compressed, 0, 0 };
+    size_t position = 0;
+
+    if (!head || !previous) {
+        compressed->failed = TRUE;
+        goto out;
+    }
+
+    PutBits(&writer, 1, 1); // BFINAL
+    PutBits(&writer, 1, 2); // BTYPE 01 (fixed Huffman codes)
+
+    while (position < data->size) {
+        size_t distance = 0;
+        const size_t length = FindMatch(data, head, previous, position, &distance);
+
+        if (length >= MIN_MATCH) {
+            PutMatch(&writer, (uint32)length, (uint32)distance);
+
+            for (size_t i = 0; i < length; i++) {
+                InsertPosition(data, head, previous, position++);
+            }
+        } else {
+            PutSymbol(&writer, data->data[position]);
+            InsertPosition(data, head, previous, position++);
+        }
+    }
+
+    PutSymbol(&writer, 256); // End of block
+    PutBits(&writer, 0, 7); // Pad the last byte
+
+out:
+    if (previous) {
+        FreeMemory(previous);
+    }
+
+    if (head) {
+        FreeMemory(head);
+    }
+
+    return !compressed->failed;
+}
+
+// Stored blocks for data that doesn't compress, 5 bytes of overhead per 64 KB
+static void Store(const Buffer* data, Buffer* compressed)
+{
+    size_t offset = 0;
+
+    compressed->size = 0;
+
+    do {
+        const size_t blockSize = (data->size - offset > 0xFFFF) ? 0xFFFF : data->size - offset;
+        const BOOL last = (offset + blockSize == data->size);
+        const uint8 blockHeader[5] = {
+            last ? 1 : 0, // BFINAL, BTYPE 00 (stored)
+            (uint8)blockSize,
+            (uint8)(blockSize >> 8),
+            (uint8)~blockSize,
+            (uint8)(~blockSize >> 8)
+        };
+
+        PutBytes(compressed, blockHeader, sizeof(blockHeader));
+        PutBytes(compressed, data->data + offset, blockSize);
+
+        offset += blockSize;
+    } while (offset < data->size);
+}
+
+static BOOL WriteGzip(FILE* file, const Buffer* data)
+{
+    // ID1, ID2, deflate, no flags, no mtime, no extra flags, unknown OS
+    const uint8 header[10] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF };
+    Buffer compressed = { NULL, 0, 0, FALSE };
+    BOOL success = FALSE;
+
+    if (Deflate(data, &compressed) && compressed.size > data->size) {
+        Store(data, &compressed);
+    }
+
+    if (compressed.failed) {
+        puts("Failed to allocate compression buffers");
+        goto out;
+    }
+
+    uint8 trailer[8];
+    PutLittleEndian32(trailer, Crc32(data->data, data->size));
+    PutLittleEndian32(trailer + 4, (uint32)data->size);
+
+    success = fwrite(header, sizeof(header), 1, file) == 1 &&
+              fwrite(compressed.data, compressed.size, 1, file) == 1 &&
+              fwrite(trailer, sizeof(trailer), 1, file) == 1;
+
+out:
+    FreeBuffer(&compressed);
+
+    return success;
+}
+
+BOOL WritePprofProfile(const char* fileName, const StackTrace* traces, const size_t count)
+{
+    Builder builder;
+    Buffer profile = { NULL, 0, 0, FALSE };
+    BOOL success = FALSE;
+
+    memset(&builder, 0, sizeof(builder));
+
+    if (!InitInternTable(&builder.strings) ||
+        !InitInternTable(&builder.functionKeys) ||
+        !InitHashMap(&builder.locationIds, 1024) ||
+        !InitHashMap(&builder.functionIds, 256) ||
+        !InitHashMap(&builder.mappingIds, 64))
+    {
+        puts("Failed to allocate pprof tables");
+        goto out;
+    }
+
+    BuildProfile(&builder, &profile, traces, count);
+
+    if (profile.failed) {
+        puts("Failed to allocate pprof buffer");
+        goto out;
+    }
+
+    FILE* file = fopen(fileName, "wb");
+
+    if (!file) {
+        printf("Failed to open '%s' for writing\n", fileName);
+        goto out;
+    }
+
+    success = WriteGzip(file, &profile);
+    fclose(file);
+
+    if (success) {
+        printf("Wrote pprof profile with %u locations and %u functions to '%s'\n",
+               builder.locationCount, builder.functionCount, fileName);
+    } else {
+        printf("Failed to write '%s'\n", fileName);
+    }
+
+out:
+    FreeBuffer(&profile);
+    FreeBuffer(&builder.samples);
+    FreeBuffer(&builder.locations);
+    FreeBuffer(&builder.functions);
+    FreeBuffer(&builder.scratch);
+    FreeBuffer(&builder.line);
+    if (builder.mappings) {
+        FreeMemory(builder.mappings);
+    }
+
+    FreeHashMap(&builder.mappingIds);
+    FreeHashMap(&builder.functionIds);
+    FreeHashMap(&builder.locationIds);
+    FreeInternTable(&builder.functionKeys);
+    FreeInternTable(&builder.strings);
+
+    return success;
+}
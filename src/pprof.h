@@ -0,0 +1,8 @@
+#ifndef PPROF_H
+#define PPROF_H
+
+#include "symbols.h"
+
+BOOL WritePprofProfile(const char* fileName, const StackTrace* traces, size_t count);
+
+#endif
@@ -2,6 +2,14 @@
 #include "timer.h"
 #include "symbols.h"
 #include "profiler.h"
+#include "continuous.h"
+#include "reservoir.h"
+#include "phases.h"
+#include "offcpu.h"
+#include "semaphores.h"
+#include "ports.h"
+#include "switches.h"
+#include "spin.h"
 
 #define CATCOMP_NUMBERS
 #include "locale_generated.h"
@@ -14,74 +22,149 @@
 #include <stdlib.h>
 #include <string.h>
 
-struct StackFrame {
-    struct StackFrame* backChain;
-    uint32* linkRegister;
-};
+#define MSR_PR 0x4000 // Problem state (user mode) bit of machine state register
 
-typedef struct StackFrame StackFrame;
+// Interrupted registers belong to the task when its stack pointer is within the task stack
+static BOOL IsTaskContext(const struct Task* task, const struct ExceptionContext* context)
+{
+    if (!context || !context->ip) {
+        return FALSE;
+    }
+
+    const uint32 sp = context->gpr[1];
+
+    return sp >= (uint32)task->tc_SPLower && sp < (uint32)task->tc_SPUpper;
+}
 
-static void GetStackTrace(struct Task* task)
+static void GetStackTrace(struct Task* task, const struct ExceptionContext* context, uint32 flags, const uint64 timestamp)
 {
-    static size_t stackTraceCounter = 0;
+    const uint32 mask = ctx.profiling.frameArenaSize - 1;
+    uint32 position = ctx.profiling.framePosition;
 
-    const StackFrame* frame = task->tc_SPReg;
-    const StackFrame* const lower = task->tc_SPLower;
-    const StackFrame* const upper = task->tc_SPUpper;
+    // Records are contiguous, start from the beginning when the end doesn't have room
+    if ((position & mask) + ctx.profiling.maxDepth > ctx.profiling.frameArenaSize) {
+        position += ctx.profiling.frameArenaSize - (position & mask);
+    }
 
-    StackTraceSample* sample = &ctx.profiling.samples[stackTraceCounter];
-    sample->task = task;
+    ULONG** addresses = &ctx.profiling.frames[position & mask];
 
-    for (size_t i = 0; i < MAX_STACK_DEPTH; i++) {
-        if (frame && frame >= lower && frame < upper) {
-            sample->addresses[i] = frame->linkRegister;
-            if (frame == frame->backChain) {
-                if (ctx.debugMode) {
-                    IExec->DebugPrintF("Stack frame back chain loop %p\n", frame);
-                }
-                ctx.profiling.stackFrameLoopDetected++;
-                frame = NULL;
-                // TODO: how about identical/repeated IPs?
-            } else {
-                if (frame->backChain) {
-                    const uint32 diff = (uint32)frame->backChain - (uint32)frame;
-                    const uint32 modulo = diff % 16;
-                    if (modulo) {
-                        if (ctx.debugMode) {
-                            IExec->DebugPrintF("Stack frames not aligned %p vs %p\n", frame, frame->backChain);
-                        }
-                        ctx.profiling.stackFrameNotAligned++;
-                    }
-                }
-                frame = frame->backChain;
-            }
-        } else {
-            if (frame) {
-                if (ctx.debugMode) {
-                    IExec->DebugPrintF("Stack frame pointer %p out of bounds\n", frame);
-                }
-                ctx.profiling.stackFrameOutOfBounds++;
-            }
-            sample->addresses[i] = NULL;
-            break;
+    StackTraceSample* sample = &ctx.profiling.samples[ctx.profiling.nextStackTrace];
+
+    // Store only the distance to previous sample, absolute times can be recovered
+    // backwards from the most recent timestamp
+    if (ctx.profiling.lastTimestamp) {
+        const uint64 delta = timestamp - ctx.profiling.lastTimestamp;
+        sample->delta = (delta > 0xFFFFFFFF) ? 0xFFFFFFFF : (uint32)delta;
+    } else {
+        sample->delta = 0;
+    }
+
+    ctx.profiling.lastTimestamp = timestamp;
+
+    const StackImage image = {
+        (const uint32 *)task->tc_SPLower,
+        (uint32)task->tc_SPLower,
+        (uint32)task->tc_SPUpper
+    };
+
+    StackRegisters registers = { 0, 0, (uint32)task->tc_SPReg };
+
+    if (IsTaskContext(task, context)) {
+        // Saved stack pointer is only updated at task switches, interrupted registers
+        // tell what is executing now
+        registers.ip = (uint32)context->ip;
+        registers.lr = (uint32)context->lr;
+        registers.sp = context->gpr[1];
+
+        // Machine state belongs to the task only when the rest of the context does,
+        // otherwise the mode stays unknown
+        flags |= (context->msr & MSR_PR) ? STACK_TRACE_USER : STACK_TRACE_SUPERVISOR;
+    } else {
+        ctx.profiling.savedContextWalks++;
+    }
+
+    StackWalk walk;
+    WalkStack(&image, &registers, addresses, ctx.profiling.maxDepth, &walk);
+
+    if (walk.linkRegisterFrame) {
+        flags |= STACK_TRACE_LINK_REGISTER;
+    }
+
+    if (walk.loopDetected) {
+        if (ctx.debugMode) {
+            IExec->DebugPrintF("Stack frame back chain loop %p\n", (void *)walk.badFrame);
+        }
+        ctx.profiling.stackFrameLoopDetected++;
+    }
+
+    if (walk.notAligned) {
+        if (ctx.debugMode) {
+            IExec->DebugPrintF("Stack frames not aligned at %p\n", (void *)walk.badFrame);
         }
+        ctx.profiling.stackFrameNotAligned += walk.notAligned;
     }
 
-    if (++stackTraceCounter >= ctx.profiling.maxStackTraces) {
-        stackTraceCounter = 0;
+    if (walk.outOfBounds) {
+        if (ctx.debugMode) {
+            IExec->DebugPrintF("Stack frame pointer %p out of bounds\n", (void *)walk.badFrame);
+        }
+        ctx.profiling.stackFrameOutOfBounds++;
+    }
+
+    if (walk.truncated) {
+        ctx.profiling.stackTracesTruncated++;
+    }
+
+    sample->task = task;
+    sample->flags = flags;
+    sample->position = position;
+    sample->depth = (uint32)walk.depth;
+
+    ctx.profiling.framePosition = position + (uint32)walk.depth;
+    ctx.profiling.depthHistogram[walk.depth]++;
+
+    if (++ctx.profiling.nextStackTrace >= ctx.profiling.maxStackTraces) {
+        ctx.profiling.nextStackTrace = 0;
     }
 
     if (ctx.profiling.stackTraces < ctx.profiling.maxStackTraces) {
         ++ctx.profiling.stackTraces;
     }
+
+    ++ctx.profiling.totalStackTraces;
+}
+
+size_t GetSavedStackTrace(const struct Task* task, ULONG** addresses)
+{
+    const StackFrame* frame = task->tc_SPReg;
+    const StackFrame* const lower = task->tc_SPLower;
+    const StackFrame* const upper = task->tc_SPUpper;
+
+    size_t depth = 0;
+
+    // Task doesn't run, so its saved stack is stable while it is walked
+    while (depth < ctx.profiling.maxDepth && frame && frame >= lower && frame < upper) {
+        addresses[depth++] = frame->linkRegister;
+
+        if (frame->backChain <= frame) {
+            break;
+        }
+
+        frame = frame->backChain;
+    }
+
+    return depth;
 }
 
-void InterruptCode(void)
+void InterruptCode(struct ExceptionContext* context, struct ExecBase* sysBase, APTR data)
 {
+    (void)sysBase;
+    (void)data;
+
     BOOL quit = FALSE;
     struct MyClock start, finish;
 
-    if (ctx.debugMode) {
+    if (ctx.debugMode || ctx.profiling.enabled) {
         ITimer->ReadEClock(&start.un.clockVal);
     }
 
@@ -89,13 +172,40 @@ void InterruptCode(void)
     struct Task* task = sysbase->ThisTask;
     static size_t counter = 0;
 
+    const BOOL forbidden = sysbase->TDNestCnt > 0;
+
+    const ULONG dispCount = sysbase->DispCount;
+
     ctx.back->sampleBuffer[counter].task = task;
-    if (sysbase->TDNestCnt > 0) {
+    ctx.back->sampleBuffer[counter].switches = dispCount - ctx.sampledDispCount;
+    ctx.sampledDispCount = dispCount;
+
+    if (forbidden) {
         ctx.back->forbidCount++;
     }
 
+    // idle.task is ready whenever it doesn't run, so the ready list is as long as the
+    // number of runnable tasks, counting the running one
+    uint32 runnable = 0;
+    for (struct Node* node = IExec->GetHead(&sysbase->TaskReady); node && runnable < MAX_TASKS; node = IExec->GetSucc(node)) {
+        runnable++;
+    }
+
+    ctx.back->runQueueSum += runnable;
+    ctx.back->runQueueHistogram[runnable < RUN_QUEUE_BINS ? runnable : RUN_QUEUE_BINS - 1]++;
+
     if (ctx.profiling.enabled /*&& task == ctx.profiling.profiledTask*/) {
-        GetStackTrace(task);
+        const uint32 flags = forbidden ? STACK_TRACE_FORBID : 0;
+
+        GetStackTrace(task, context, flags, start.un.ticks);
+
+        if (ctx.profiling.offCpuRate) {
+            SampleWaitingTasks(sysbase);
+        }
+
+        if (ctx.profiling.semaphoreRate) {
+            RequestSemaphoreSnapshot();
+        }
     }
 
     if (++counter >= ctx.totalSamples) {
@@ -107,6 +217,11 @@ void InterruptCode(void)
         ctx.back = &ctx.sampleData[flip];
         ctx.back->uniqueTasks = 0;
         ctx.back->forbidCount = 0;
+        ctx.back->runQueueSum = 0;
+
+        for (size_t bin = 0; bin < RUN_QUEUE_BINS; bin++) {
+            ctx.back->runQueueHistogram[bin] = 0;
+        }
 
         //IExec->DebugPrintF("Signal %d -> main\n", mainSig);
         IExec->Signal(ctx.mainTask, 1L << ctx.timerSignal);
@@ -134,6 +249,44 @@ void InterruptCode(void)
     }
 }
 
+ULONG** GetStackTraceAddresses(const StackTraceSample* sample)
+{
+    // Newer records overwrite the oldest ones in the arena
+    if (ctx.profiling.framePosition - sample->position > ctx.profiling.frameArenaSize) {
+        return NULL;
+    }
+
+    return &ctx.profiling.frames[sample->position & (ctx.profiling.frameArenaSize - 1)];
+}
+
+size_t GetNewStackTraces(uint64* read, size_t* first, uint64* lost)
+{
+    const size_t max = ctx.profiling.maxStackTraces;
+
+    IExec->Disable();
+
+    const uint64 total = ctx.profiling.totalStackTraces;
+    const size_t next = ctx.profiling.nextStackTrace;
+
+    IExec->Enable();
+
+    uint64 pending = total - *read;
+
+    if (pending > max) {
+        if (lost) {
+            *lost += pending - max;
+        }
+        pending = max;
+    }
+
+    // Interrupt keeps writing ahead of the snapshot, but the buffer holds 30 seconds
+    // of samples so the oldest pending ones are not overwritten while reading
+    *first = (next + max - (size_t)pending) % max;
+    *read = total;
+
+    return (size_t)pending;
+}
+
 static size_t CopyProcessData(struct Task* task, SampleInfo* info)
 {
     ctx.cliNameBuffer[0] = '\0';
@@ -282,10 +435,21 @@ static int Comparison(const void* first, const void* second)
     return 0;
 }
 
+// Averages the most recent count values of a history ring, next is the slot of the next value
+static float GetAverage(const float* history, const uint32 next, const uint32 size, const uint32 count)
+{
+    float sum = 0.0f;
+
+    for (uint32 i = 1; i <= count; i++) {
+        sum += history[(next + size - i) % size];
+    }
+
+    return sum / (float)count;
+}
+
 static void CalculateLoadAverages()
 {
     static uint32 loadAverageCounter;
-    uint32 i = 0;
 
     ctx.idleCpu = GetIdleCpu();
     if (ctx.idleCpu > 100.0f) {
@@ -299,34 +463,19 @@ static void CalculateLoadAverages()
     const uint32 max5 = 5 * 60 / ctx.interval;
     const uint32 max15 = MAX_LOAD_AVERAGES / ctx.interval;
 
-    const uint32 offset1 = 14 * 60 / ctx.interval;
-    const uint32 offset5 = 10 * 60 / ctx.interval;
-
-    ctx.loadAverage[loadAverageCounter++ % max15] = cpu;
-    ctx.loadAverage1 = 0.0f;
+    const uint32 slot = loadAverageCounter++ % max15;
+    const uint32 next = (slot + 1) % max15;
 
-    while (i < max1) {
-        ctx.loadAverage1 += ctx.loadAverage[(loadAverageCounter + i + offset1) % max15];
-        i++;
-    }
-
-    ctx.loadAverage5 = ctx.loadAverage1;
-
-    while (i < max5) {
-        ctx.loadAverage5 += ctx.loadAverage[(loadAverageCounter + i + offset5) % max15];
-        i++;
-    }
-
-    ctx.loadAverage15 = ctx.loadAverage5;
+    ctx.loadAverage[slot] = cpu;
+    ctx.runQueueAverage[slot] = ctx.runQueue;
 
-    while (i < max15) {
-        ctx.loadAverage15 += ctx.loadAverage[i];
-        i++;
-    }
+    ctx.loadAverage1 = GetAverage(ctx.loadAverage, next, max15, max1);
+    ctx.loadAverage5 = GetAverage(ctx.loadAverage, next, max15, max5);
+    ctx.loadAverage15 = GetAverage(ctx.loadAverage, next, max15, max15);
 
-    ctx.loadAverage1 /= (float)max1;
-    ctx.loadAverage5 /= (float)max5;
-    ctx.loadAverage15 /= (float)max15;
+    ctx.runQueue1 = GetAverage(ctx.runQueueAverage, next, max15, max1);
+    ctx.runQueue5 = GetAverage(ctx.runQueueAverage, next, max15, max5);
+    ctx.runQueue15 = GetAverage(ctx.runQueueAverage, next, max15, max15);
 }
 
 void PrepareResults(void)
@@ -357,13 +506,19 @@ void PrepareResults(void)
     ctx.taskSwitchesPerSecond = (dispCount - ctx.lastDispCount) / ctx.interval;
     ctx.lastDispCount = dispCount;
 
+    UpdateSwitches(ctx.front);
+
+    ctx.runQueue = (float)ctx.front->runQueueSum / (float)ctx.totalSamples;
+
+    for (size_t bin = 0; bin < RUN_QUEUE_BINS; bin++) {
+        ctx.runQueueHistogram[bin] += ctx.front->runQueueHistogram[bin];
+    }
+
     CalculateLoadAverages();
 }
 
-float GetIdleCpu(void)
+BOOL IsIdleTask(const char* name)
 {
-    float idleCpu = 0.0f;
-
     // Following tasks are considered idle.task which are running
     // when there is nothing else to schedule.
     const char* const knownIdleTaskNames[4] = {
@@ -373,11 +528,22 @@ float GetIdleCpu(void)
         "CPUInfo.CPUTask", // CPUInfo docky
     };
 
+    for (size_t n = 0; n < sizeof(knownIdleTaskNames) / sizeof(knownIdleTaskNames[0]); n++) {
+        if (strcmp(name, knownIdleTaskNames[n]) == 0) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+float GetIdleCpu(void)
+{
+    float idleCpu = 0.0f;
+
     for (size_t i = 0; i < ctx.front->uniqueTasks; i++) {
-        for (size_t n = 0; n < sizeof(knownIdleTaskNames) / sizeof(knownIdleTaskNames[0]); n++) {
-            if (strcmp(ctx.sampleInfo[i].nameBuffer, knownIdleTaskNames[n]) == 0) {
-                idleCpu += 100.0f * (float)ctx.sampleInfo[i].count / (float)ctx.totalSamples;
-            }
+        if (IsIdleTask(ctx.sampleInfo[i].nameBuffer)) {
+            idleCpu += 100.0f * (float)ctx.sampleInfo[i].count / (float)ctx.totalSamples;
         }
     }
 
@@ -389,6 +555,29 @@ float GetForbidCpu(void)
     return 100.0f * (float)ctx.front->forbidCount / (float)ctx.totalSamples;
 }
 
+// Shares of all samples by number of runnable tasks, since start
+static void ShowRunQueueHistogram(void)
+{
+    uint64 total = 0;
+
+    for (size_t bin = 0; bin < RUN_QUEUE_BINS; bin++) {
+        total += ctx.runQueueHistogram[bin];
+    }
+
+    if (!total) {
+        return;
+    }
+
+    printf("Runnable tasks");
+
+    for (size_t bin = 0; bin < RUN_QUEUE_BINS; bin++) {
+        printf(" %u%s %.1f%%", bin, bin == RUN_QUEUE_BINS - 1 ? "+" : ":",
+               100.0 * (double)ctx.runQueueHistogram[bin] / (double)total);
+    }
+
+    printf("\n");
+}
+
 static void ShowResults(void)
 {
     MyClock start, finish;
@@ -412,7 +601,11 @@ static void ShowResults(void)
            GetString(MSG_UPTIME),
            GetUptimeString());
 
+    printf("Task switch peak / s %lu (100 ms), %lu (tick)\n", ctx.peakSwitchesPerSecond, ctx.peakTickSwitchesPerSecond);
     printf("Load average %3.1f %3.1f %3.1f\n", ctx.loadAverage1, ctx.loadAverage5, ctx.loadAverage15);
+    printf("Run queue %.2f (%.2f %.2f %.2f)\n", ctx.runQueue, ctx.runQueue1, ctx.runQueue5, ctx.runQueue15);
+
+    ShowRunQueueHistogram();
 
     printf("%-40s %6s %10s %10s %6s\n",
            GetString(MSG_COLUMN_TASK),
@@ -441,6 +634,10 @@ static void ShowResults(void)
                pidBuffer);
     }
 
+    if (ctx.portMonitor) {
+        ShowPorts();
+    }
+
     if (ctx.debugMode) {
         ITimer->ReadEClock(&finish.un.clockVal);
 
@@ -460,14 +657,55 @@ static void ShowResults(void)
 void ShellLoop(void)
 {
     const uint32 signalMask = 1L << ctx.timerSignal;
+    const uint32 semaphoreMask = ctx.semaphoreSignal != -1 ? 1L << ctx.semaphoreSignal : 0;
 
     while (ctx.running) {
-        const uint32 wait = IExec->Wait(signalMask | SIGBREAKF_CTRL_C);
+        const uint32 wait = IExec->Wait(signalMask | semaphoreMask | SIGBREAKF_CTRL_C | SIGBREAKF_CTRL_F);
+
+        if (wait & semaphoreMask) {
+            SampleSemaphores();
+        }
+
+        if ((wait & signalMask) && ctx.profiling.enabled) {
+            CheckLinkRegisterFrames();
+        }
+
+        if ((wait & signalMask) && ctx.profiling.continuous) {
+            UpdateContinuousProfiling();
+        }
+
+        if ((wait & signalMask) && ctx.profiling.reservoirSize) {
+            UpdateReservoir();
+        }
+
+        if ((wait & signalMask) && ctx.profiling.phases) {
+            UpdatePhases();
+        }
+
+        if ((wait & signalMask) && ctx.profiling.offCpuRate) {
+            UpdateOffCpu();
+        }
+
+        if ((wait & signalMask) && ctx.profiling.semaphoreRate) {
+            UpdateSemaphores();
+        }
+
+        if ((wait & signalMask) && ctx.profiling.spinDetection) {
+            UpdateSpin();
+        }
+
+        if ((wait & signalMask) && ctx.portMonitor) {
+            UpdatePorts();
+        }
 
         if ((wait & signalMask) && ctx.profiling.showTaskDisplay) {
             ShowResults();
         }
 
+        if ((wait & SIGBREAKF_CTRL_F) && ctx.profiling.continuous) {
+            WriteProfileWindows();
+        }
+
         if (wait & SIGBREAKF_CTRL_C) {
             ctx.running = FALSE;
         }
@@ -5,7 +5,15 @@
 
 #include "common.h"
 
-void InterruptCode(void);
+struct StackFrame {
+    struct StackFrame* backChain;
+    uint32* linkRegister;
+};
+
+typedef struct StackFrame StackFrame;
+
+// Timer interrupt, context has the registers of the interrupted code
+void InterruptCode(struct ExceptionContext* context, struct ExecBase* sysBase, APTR data);
 void ShellLoop(void);
 void PrepareResults(void);
 size_t GetTotalTaskCount(void);
@@ -13,4 +21,20 @@ float GetIdleCpu(void);
 float GetForbidCpu(void);
 SampleInfo InitializeTaskData(struct Task* task);
 
+// Returns TRUE for idle.task and the tasks that run only when nothing else does
+BOOL IsIdleTask(const char* name);
+
+// Walks the stack of a task that is not running from its saved stack pointer. Stores at
+// most maxDepth instruction pointers, innermost first, and returns their number
+size_t GetSavedStackTrace(const struct Task* task, ULONG** addresses);
+
+// Returns instruction pointers of the sample, innermost first, or NULL when they are
+// already overwritten
+ULONG** GetStackTraceAddresses(const StackTraceSample* sample);
+
+// Returns number of stack traces collected after the *read counter and the ring buffer
+// index of the first one, then advances the counter. Stack traces overwritten before
+// reading are skipped and added to *lost when it's not NULL.
+size_t GetNewStackTraces(uint64* read, size_t* first, uint64* lost);
+
 #endif
@@ -0,0 +1,149 @@
+#include "reservoir.h"
+#include "profiler.h"
+#include "common.h"
+
+#include <proto/exec.h>
+
+#include <stdio.h>
+#include <string.h>
+
+// Reservoir mode keeps a uniform random subset of all stack traces collected
+// during the run (Vitter's algorithm R). Memory use is fixed however long the
+// run is, and each stack trace has the same chance to be in the report.
+
+typedef struct Reservoir {
+    StackTraceSample* samples; // Position of each sample is its slot * maxDepth
+    ULONG** frames; // Fixed-size record of maxDepth instruction pointers per slot
+    size_t count; // Number of slots in use
+    uint64 seen; // Number of stack traces offered to the reservoir
+    uint64 readStackTraces; // Number of stack traces drained from the ring buffer
+    uint64 lostStackTraces; // Number of stack traces overwritten before draining
+    uint64 random; // Xorshift state, never zero
+} Reservoir;
+
+static Reservoir reservoir;
+
+static uint64 NextRandom(void)
+{
+    uint64 x = reservoir.random;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    reservoir.random = x;
+
+    return x;
+}
+
+static void Store(const size_t slot, const StackTraceSample* sample, ULONG** addresses)
+{
+    StackTraceSample* stored = &reservoir.samples[slot];
+
+    stored->task = sample->task;
+    stored->flags = sample->flags;
+    stored->delta = 0; // Reservoir has no timeline
+    stored->position = (uint32)(slot * ctx.profiling.maxDepth);
+    stored->depth = addresses ? sample->depth : 0;
+
+    if (stored->depth) {
+        memcpy(&reservoir.frames[stored->position], addresses, stored->depth * sizeof(ULONG *));
+    }
+}
+
+static void Offer(const StackTraceSample* sample)
+{
+    ULONG** addresses = GetStackTraceAddresses(sample);
+
+    if (!addresses) {
+        reservoir.lostStackTraces++;
+        return;
+    }
+
+    if (reservoir.count < ctx.profiling.reservoirSize) {
+        Store(reservoir.count++, sample, addresses);
+    } else {
+        // Replace a random slot with probability size / seen
+        const uint64 index = NextRandom() % (reservoir.seen + 1);
+
+        if (index < reservoir.count) {
+            Store((size_t)index, sample, addresses);
+        }
+    }
+
+    reservoir.seen++;
+}
+
+void UpdateReservoir(void)
+{
+    size_t index;
+    size_t pending = GetNewStackTraces(&reservoir.readStackTraces, &index, &reservoir.lostStackTraces);
+
+    while (pending > 0) {
+        Offer(&ctx.profiling.samples[index]);
+
+        if (++index >= ctx.profiling.maxStackTraces) {
+            index = 0;
+        }
+
+        pending--;
+    }
+}
+
+size_t GetReservoirCount(void)
+{
+    return reservoir.count;
+}
+
+uint64 GetReservoirSeen(void)
+{
+    return reservoir.seen;
+}
+
+const StackTraceSample* GetReservoirSample(const size_t index)
+{
+    return &reservoir.samples[index];
+}
+
+ULONG** GetReservoirAddresses(const StackTraceSample* sample)
+{
+    return &reservoir.frames[sample->position];
+}
+
+BOOL InitReservoir(void)
+{
+    memset(&reservoir, 0, sizeof(reservoir));
+
+    reservoir.samples = AllocateMemory(ctx.profiling.reservoirSize * sizeof(StackTraceSample));
+    reservoir.frames = AllocateMemory(ctx.profiling.reservoirSize * ctx.profiling.maxDepth * sizeof(ULONG *));
+
+    if (!reservoir.samples || !reservoir.frames) {
+        puts("Failed to allocate reservoir");
+        return FALSE;
+    }
+
+    MyClock clock;
+    ITimer->ReadEClock(&clock.un.clockVal);
+
+    reservoir.random = clock.un.ticks | 1;
+
+    return TRUE;
+}
+
+void FreeReservoir(void)
+{
+    if (reservoir.lostStackTraces) {
+        printf("%llu stack trace(s) were overwritten before they could be sampled into the reservoir\n",
+               reservoir.lostStackTraces);
+    }
+
+    if (reservoir.frames) {
+        FreeMemory(reservoir.frames);
+        reservoir.frames = NULL;
+    }
+
+    if (reservoir.samples) {
+        FreeMemory(reservoir.samples);
+        reservoir.samples = NULL;
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef RESERVOIR_H
+#define RESERVOIR_H
+
+#include "common.h"
+
+BOOL InitReservoir(void);
+void FreeReservoir(void);
+
+// Moves new stack trace samples from the interrupt ring buffer to the reservoir
+void UpdateReservoir(void);
+
+// Number of stack traces kept, at most RESERVOIR size
+size_t GetReservoirCount(void);
+// Number of stack traces the reservoir was sampled from
+uint64 GetReservoirSeen(void);
+
+const StackTraceSample* GetReservoirSample(size_t index);
+// Returns instruction pointers of a reservoir sample, innermost first
+ULONG** GetReservoirAddresses(const StackTraceSample* sample);
+
+#endif
@@ -0,0 +1,423 @@
+#include "semaphores.h"
+#include "hashmap.h"
+#include "intern.h"
+#include "profiler.h"
+#include "symbols.h"
+#include "tasknames.h"
+#include "waittraces.h"
+#include "common.h"
+
+#include <proto/exec.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Semaphore mode inspects the public semaphores on SysBase->SemaphoreList at a
+// lower rate than the CPU sampling. The timer interrupt only signals when a snapshot
+// is due, and the main task takes it under Forbid(): semaphores, their wait queues
+// and the waiters are changed by tasks, not by interrupts. Every waiter of a
+// contended semaphore is recorded with the owner, queue length and the stack of the
+// blocked waiter. Private semaphores of libraries and programs are not on the list.
+
+#define MAX_SNAPSHOT_WAITERS 64
+#define MAX_SEMAPHORES 256
+#define MAX_BLOCKED_TRACES 4096
+#define MAX_SHOWN_SEMAPHORES 20
+#define MAX_SHOWN_TASKS 5
+#define MAX_SHOWN_BLOCKED_TRACES 20
+
+typedef struct SemaphoreSample {
+    char name[NAME_LEN]; // Semaphore name, copied while the list is locked
+    struct Task* owner; // Exclusive owner, NULL when shared
+    struct Task* waiter; // Blocked task
+    uint32 waiters; // Queue length when sampled
+    uint32 depth; // Number of instruction pointers of the waiter, innermost first
+} SemaphoreSample;
+
+typedef struct SemaphoreStats {
+    uint32 name; // Interned semaphore name
+    uint32 lastSnapshot; // Last snapshot counted for this semaphore
+    size_t contended; // Number of snapshots with waiters
+    size_t waiterSum; // Sum of queue lengths, for the average
+    uint32 maxWaiters; // Longest queue seen
+    HashMap owners; // Interned owner task name -> snapshots
+    HashMap waiters; // Interned waiter task name -> samples
+} SemaphoreStats;
+
+typedef struct Semaphores {
+    // Interrupt side
+    uint32 period; // Timer ticks between snapshots
+    uint32 ticks; // Timer ticks since the last snapshot
+
+    // Main task side
+    SemaphoreSample* samples; // Blocked waiters of the latest snapshot
+    ULONG** frames; // Fixed-size record of maxDepth instruction pointers per waiter
+    uint64 totalSamples; // Number of waiter samples collected since start
+    uint32 snapshots; // Number of semaphore list snapshots taken
+    uint32 skippedWaiters; // Waiters left out when a snapshot had more than MAX_SNAPSHOT_WAITERS
+    SemaphoreStats* stats; // Contended semaphores
+    size_t statCount; // Number of contended semaphores
+    WaitTraces traces; // Unique blocked waiter stacks, waiting for the semaphore stats index
+    size_t droppedSamples; // Samples not counted because the semaphore table was full
+    HashMap nameMap; // Interned semaphore name -> stats index + 1
+    HashMap tasks; // Task -> task name string id, cleared with each update
+    InternTable names; // Semaphore and task names
+} Semaphores;
+
+static Semaphores sems;
+
+void RequestSemaphoreSnapshot(void)
+{
+    if (++sems.ticks < sems.period) {
+        return;
+    }
+
+    sems.ticks = 0;
+
+    IExec->Signal(ctx.mainTask, 1L << ctx.semaphoreSignal);
+}
+
+// Names are copied and stacks walked while the list is locked. Waiters are blocked,
+// so their saved stacks don't change before Permit()
+static size_t TakeSnapshot(void)
+{
+    struct ExecBase* eb = (struct ExecBase *)SysBase;
+    size_t count = 0;
+
+    IExec->Forbid();
+
+    for (struct Node* node = IExec->GetHead(&eb->SemaphoreList); node; node = IExec->GetSucc(node)) {
+        struct SignalSemaphore* semaphore = (struct SignalSemaphore *)node;
+
+        // Queue count is -1 when free and 0 when owned without waiters
+        if (semaphore->ss_QueueCount <= 0) {
+            continue;
+        }
+
+        const uint32 waiters = (uint32)semaphore->ss_QueueCount;
+
+        for (struct Node* request = IExec->GetHead((struct List *)&semaphore->ss_WaitQueue); request; request = IExec->GetSucc(request)) {
+            // Shared requests are flagged in the lowest bit of the waiter
+            struct Task* waiter = (struct Task *)((uint32)((struct SemaphoreRequest *)request)->sr_Waiter & ~1u);
+
+            if (!waiter) {
+                continue;
+            }
+
+            if (count >= MAX_SNAPSHOT_WAITERS) {
+                sems.skippedWaiters++;
+                continue;
+            }
+
+            SemaphoreSample* sample = &sems.samples[count];
+            snprintf(sample->name, NAME_LEN, "%s", node->ln_Name ? node->ln_Name : "(unnamed)");
+            sample->owner = semaphore->ss_Owner;
+            sample->waiter = waiter;
+            sample->waiters = waiters;
+            sample->depth = (uint32)GetSavedStackTrace(waiter, &sems.frames[count * ctx.profiling.maxDepth]);
+
+            count++;
+        }
+    }
+
+    IExec->Permit();
+
+    return count;
+}
+
+// Semaphores are told apart by name, so one removed and added again is counted once
+static SemaphoreStats* GetStats(const char* semaphoreName, uint32* index)
+{
+    const uint32 name = InternString(&sems.names, semaphoreName);
+
+    if (!name) {
+        return NULL;
+    }
+
+    uint32* named = HashMapAdd(&sems.nameMap, name);
+
+    if (!named) {
+        return NULL;
+    }
+
+    if (*named == 0) {
+        if (sems.statCount >= MAX_SEMAPHORES) {
+            HashMapRemove(&sems.nameMap, name);
+            return NULL;
+        }
+
+        SemaphoreStats* stats = &sems.stats[sems.statCount];
+
+        if (!InitHashMap(&stats->owners, 0) || !InitHashMap(&stats->waiters, 0)) {
+            FreeHashMap(&stats->owners);
+            FreeHashMap(&stats->waiters);
+            HashMapRemove(&sems.nameMap, name);
+            return NULL;
+        }
+
+        stats->name = name;
+        *named = (uint32)++sems.statCount;
+    }
+
+    *index = *named - 1;
+
+    return &sems.stats[*index];
+}
+
+static void AddCount(HashMap* map, const uint32 name)
+{
+    if (name) {
+        uint32* count = HashMapAdd(map, name);
+        if (count) {
+            (*count)++;
+        }
+    }
+}
+
+static void AddSemaphoreSample(const SemaphoreSample* sample, ULONG** addresses)
+{
+    uint32 index;
+    SemaphoreStats* stats = GetStats(sample->name, &index);
+
+    if (!stats) {
+        sems.droppedSamples++;
+        return;
+    }
+
+    // Owner and queue length are counted once per snapshot
+    if (stats->lastSnapshot != sems.snapshots) {
+        stats->lastSnapshot = sems.snapshots;
+        stats->contended++;
+        stats->waiterSum += sample->waiters;
+
+        if (sample->waiters > stats->maxWaiters) {
+            stats->maxWaiters = sample->waiters;
+        }
+
+        if (sample->owner) {
+            AddCount(&stats->owners, InternTaskName(sample->owner, &sems.tasks, &sems.names));
+        } else {
+            AddCount(&stats->owners, InternString(&sems.names, "(shared)"));
+        }
+    }
+
+    const uint32 waiter = InternTaskName(sample->waiter, &sems.tasks, &sems.names);
+
+    AddCount(&stats->waiters, waiter);
+    AddWaitTrace(&sems.traces, waiter, index, addresses, sample->depth);
+}
+
+void SampleSemaphores(void)
+{
+    const size_t count = TakeSnapshot();
+
+    sems.snapshots++;
+
+    for (size_t i = 0; i < count; i++) {
+        AddSemaphoreSample(&sems.samples[i], &sems.frames[i * ctx.profiling.maxDepth]);
+    }
+
+    sems.totalSamples += count;
+}
+
+void UpdateSemaphores(void)
+{
+    // Task pointers are reused, refresh names for the next interval
+    ClearHashMap(&sems.tasks);
+}
+
+static int CompareContention(const void* first, const void* second)
+{
+    const SemaphoreStats* a = *(const SemaphoreStats* const *)first;
+    const SemaphoreStats* b = *(const SemaphoreStats* const *)second;
+
+    if (a->waiterSum > b->waiterSum) return -1;
+    if (a->waiterSum < b->waiterSum) return 1;
+
+    return 0;
+}
+
+// Shows the tasks with the biggest counts, like "name (12.3%), other (4.5%)"
+static void ShowTasks(const char* title, const HashMap* counts, const size_t total)
+{
+    uint32 shown[MAX_SHOWN_TASKS];
+    size_t shownCount = 0;
+
+    printf("    %s:", title);
+
+    while (shownCount < MAX_SHOWN_TASKS) {
+        uint32 best = 0;
+        uint32 bestCount = 0;
+
+        for (size_t slot = 0; slot < counts->capacity; slot++) {
+            const uint32 name = counts->keys[slot];
+            BOOL already = FALSE;
+
+            for (size_t i = 0; i < shownCount; i++) {
+                already = already || shown[i] == name;
+            }
+
+            if (name && !already && counts->values[slot] > bestCount) {
+                best = name;
+                bestCount = counts->values[slot];
+            }
+        }
+
+        if (!best) {
+            break;
+        }
+
+        printf("%s %s (%.1f%%)", shownCount ? "," : "", GetInternedString(&sems.names, best),
+               100.0f * (float)bestCount / (float)total);
+
+        shown[shownCount++] = best;
+    }
+
+    printf("\n");
+}
+
+static void ShowContendedSemaphores(void)
+{
+    const SemaphoreStats** sorted = AllocateMemory((sems.statCount + 1) * sizeof(SemaphoreStats *));
+
+    if (!sorted) {
+        puts("Failed to allocate semaphore table");
+        return;
+    }
+
+    for (size_t i = 0; i < sems.statCount; i++) {
+        sorted[i] = &sems.stats[i];
+    }
+
+    qsort(sorted, sems.statCount, sizeof(SemaphoreStats *), CompareContention);
+
+    printf("\n%11s %12s %12s %64s\n", "Contended %", "Avg waiters", "Max waiters", "Semaphore");
+
+    for (size_t i = 0; i < sems.statCount && i < MAX_SHOWN_SEMAPHORES; i++) {
+        const SemaphoreStats* stats = sorted[i];
+        size_t waiterSamples = 0;
+
+        for (size_t slot = 0; slot < stats->waiters.capacity; slot++) {
+            waiterSamples += stats->waiters.values[slot];
+        }
+
+        printf("%11.2f %12.2f %12lu %64s\n",
+               100.0f * (float)stats->contended / (float)sems.snapshots,
+               (float)stats->waiterSum / (float)stats->contended,
+               stats->maxWaiters,
+               GetInternedString(&sems.names, stats->name));
+
+        ShowTasks("Owners", &stats->owners, stats->contended);
+        ShowTasks("Waiters", &stats->waiters, waiterSamples);
+    }
+
+    FreeMemory(sorted);
+}
+
+static void ShowBlockedTraces(void)
+{
+    SortWaitTraces(&sems.traces);
+
+    printf("\nTop stacks of blocked waiters:\n");
+
+    for (size_t i = 0; i < sems.traces.count && i < MAX_SHOWN_BLOCKED_TRACES; i++) {
+        const WaitTrace* trace = &sems.traces.traces[i];
+
+        printf("\nBlocked stack %u (%.2f%% of snapshots - task %s - semaphore %s):\n",
+               i,
+               100.0f * (float)trace->count / (float)sems.snapshots,
+               GetInternedString(&sems.names, trace->task),
+               GetInternedString(&sems.names, sems.stats[trace->object].name));
+
+        ShowWaitTraceFrames(trace);
+    }
+}
+
+void ShowSemaphores(void)
+{
+    printf("\nSemaphore contention: %lu snapshots of public semaphores at %.1f Hz, %llu blocked waiter samples\n",
+           sems.snapshots, (float)ctx.samples / (float)sems.period, sems.totalSamples);
+
+    if (sems.skippedWaiters) {
+        printf("%lu waiter(s) were left out from snapshots with more than %u waiters\n", sems.skippedWaiters, MAX_SNAPSHOT_WAITERS);
+    }
+
+    if (sems.droppedSamples || sems.traces.droppedSamples) {
+        printf("%u waiter sample(s) were not counted, over %u semaphores or %u unique stacks\n",
+               sems.droppedSamples + sems.traces.droppedSamples, MAX_SEMAPHORES, MAX_BLOCKED_TRACES);
+    }
+
+    if (!sems.snapshots || !sems.statCount) {
+        puts("No contended semaphores found");
+        return;
+    }
+
+    if (!OpenSymbols()) {
+        puts("Failed to get IDebug");
+        return;
+    }
+
+    ShowContendedSemaphores();
+    ShowBlockedTraces();
+
+    CloseSymbols();
+}
+
+BOOL InitSemaphores(void)
+{
+    memset(&sems, 0, sizeof(sems));
+
+    sems.period = ctx.samples / ctx.profiling.semaphoreRate;
+
+    if (sems.period < 1) {
+        sems.period = 1;
+    }
+
+    sems.samples = AllocateMemory(MAX_SNAPSHOT_WAITERS * sizeof(SemaphoreSample));
+    sems.frames = AllocateMemory(MAX_SNAPSHOT_WAITERS * ctx.profiling.maxDepth * sizeof(ULONG *));
+    sems.stats = AllocateMemory(MAX_SEMAPHORES * sizeof(SemaphoreStats));
+
+    if (!sems.samples || !sems.frames || !sems.stats) {
+        puts("Failed to allocate semaphore buffers");
+        return FALSE;
+    }
+
+    if (!InitHashMap(&sems.nameMap, 0) ||
+        !InitWaitTraces(&sems.traces, MAX_BLOCKED_TRACES, ctx.profiling.maxDepth) ||
+        !InitHashMap(&sems.tasks, 0) ||
+        !InitInternTable(&sems.names)) {
+        puts("Failed to allocate semaphore tables");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void FreeSemaphores(void)
+{
+    if (sems.stats) {
+        for (size_t i = 0; i < sems.statCount; i++) {
+            FreeHashMap(&sems.stats[i].owners);
+            FreeHashMap(&sems.stats[i].waiters);
+        }
+
+        FreeMemory(sems.stats);
+        sems.stats = NULL;
+    }
+
+    FreeHashMap(&sems.nameMap);
+    FreeWaitTraces(&sems.traces);
+    FreeHashMap(&sems.tasks);
+    FreeInternTable(&sems.names);
+
+    if (sems.frames) {
+        FreeMemory(sems.frames);
+        sems.frames = NULL;
+    }
+
+    if (sems.samples) {
+        FreeMemory(sems.samples);
+        sems.samples = NULL;
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef SEMAPHORES_H
+#define SEMAPHORES_H
+
+#include <exec/types.h>
+
+BOOL InitSemaphores(void);
+void FreeSemaphores(void);
+
+// Called by the timer interrupt on every sample, signals the main task at the
+// SEMAPHORES rate
+void RequestSemaphoreSnapshot(void);
+
+// Takes a snapshot of contended public semaphores and counts the blocked waiters by
+// semaphore, task and stack. Called by the main task when signalled
+void SampleSemaphores(void);
+
+// Refreshes task names. Called once per display interval
+void UpdateSemaphores(void);
+
+// Shows the most contended semaphores with their owners, waiters and blocked stacks
+void ShowSemaphores(void);
+
+#endif
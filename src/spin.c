@@ -0,0 +1,532 @@
+#include "spin.h"
+#include "hashmap.h"
+#include "intern.h"
+#include "profiler.h"
+#include "symbols.h"
+#include "common.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Spin detection follows the stack traces of each task. A run lasts while the task
+// keeps being sampled in the same few addresses: the two innermost frames, or the
+// polling call and its call site when the stack has a call like CheckSignal() or
+// Delay(). A long run with polling calls means that the task polls instead of
+// waiting for a signal. Loops that never call a polling function are not reported,
+// a few hot addresses alone are just as likely a computation. Runs are grouped by
+// task and by the most common address, which is inside the loop or calls it.
+
+#define MAX_LOOP_IPS 32 // More distinct addresses than this is not a small loop
+#define MAX_GAP_MS 250 // Longer pause between samples of a task ends its run
+#define MAX_POLL_GAP_MS 2000 // Pollers sleep in Delay() and the like between samples
+#define MAX_POLL_FRAMES 8 // Innermost frames searched for a polling call
+#define MAX_CLASSIFIED_IPS 65536 // Polling classification cache is cleared when full
+#define MIN_SPIN_MS 1000 // Shorter runs are not reported
+#define MIN_SPIN_SAMPLES 10
+#define MAX_SPINNERS 256
+#define MAX_SHOWN_SPINNERS 10
+
+typedef struct LoopAddress {
+    ULONG* ip;
+    uint32 count; // Number of samples with this address in the innermost two frames
+} LoopAddress;
+
+typedef struct SpinRun {
+    struct Task* task; // NULL when the slot is free
+    uint64 first; // Timestamp of the first sample
+    uint64 last; // Timestamp of the latest sample
+    uint32 samples; // Number of samples of the task in the run
+    uint32 pollSamples; // Samples in a polling call
+    uint32 forbidSamples; // Samples taken with task switching disabled
+    size_t ipCount;
+    LoopAddress ips[MAX_LOOP_IPS];
+} SpinRun;
+
+typedef struct Spinner {
+    uint32 task; // Interned task name
+    ULONG* anchor; // Most common address of the longest run
+    uint32 runs; // Number of runs
+    uint64 samples; // Samples in all runs
+    uint64 pollSamples; // Samples in polling calls in all runs
+    float seconds; // Wall time of all runs
+    uint64 forbidSamples; // Samples in Forbid in all runs
+    SpinRun longest; // Addresses of the longest run
+} Spinner;
+
+typedef struct Spin {
+    uint64 readStackTraces;
+    uint64 lostStackTraces;
+    uint64 now; // Timestamp of the latest stack trace
+    SpinRun* runs; // Current run of each task
+    HashMap runMap; // Task -> run index + 1
+    Spinner* spinners;
+    size_t spinnerCount;
+    size_t droppedRuns; // Runs not recorded because the spinner table was full
+    HashMap polling; // Address -> POLLING or NOT_POLLING
+    BOOL symbolsOpen;
+    InternTable names; // Task names
+} Spin;
+
+enum {
+    POLLING = 1,
+    NOT_POLLING
+};
+
+static Spin spin;
+
+// Run lasts from its first sample to the end of the last sampling period
+static float GetRunSeconds(const SpinRun* run)
+{
+    return (float)(TicksToMicros(run->last - run->first) / 1000000.0) + 1.0f / (float)ctx.samples;
+}
+
+static BOOL IsGapOver(const SpinRun* run, const uint64 timestamp)
+{
+    const double maxGapMs = run->pollSamples ? MAX_POLL_GAP_MS : MAX_GAP_MS;
+
+    return TicksToMicros(timestamp - run->last) > maxGapMs * 1000.0;
+}
+
+static ULONG* GetAnchor(const SpinRun* run)
+{
+    size_t best = 0;
+
+    for (size_t i = 1; i < run->ipCount; i++) {
+        if (run->ips[i].count > run->ips[best].count) {
+            best = i;
+        }
+    }
+
+    return run->ips[best].ip;
+}
+
+static BOOL IsPollingFunction(const char* name)
+{
+    const char* const pollingFunctions[] = {
+        "CheckSignal",
+        "SetSignal",
+        "GetMsg",
+        "Delay",
+        "WaitTOF",
+        "ReadEClock",
+        "GetSysTime",
+    };
+
+    for (size_t i = 0; i < sizeof(pollingFunctions) / sizeof(pollingFunctions[0]); i++) {
+        if (strstr(name, pollingFunctions[i])) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static BOOL IsPollingAddress(ULONG* ip)
+{
+    const uint32* cached = HashMapGet(&spin.polling, (uint32)ip);
+
+    if (cached) {
+        return *cached == POLLING;
+    }
+
+    SymbolInfo si;
+    const BOOL polling = spin.symbolsOpen && LookupSymbol(ip, &si) && IsPollingFunction(si.functionName);
+
+    if (spin.polling.count >= MAX_CLASSIFIED_IPS) {
+        ClearHashMap(&spin.polling);
+    }
+
+    uint32* value = HashMapAdd(&spin.polling, (uint32)ip);
+
+    if (value) {
+        *value = polling ? POLLING : NOT_POLLING;
+    }
+
+    return polling;
+}
+
+// Returns the depth when the innermost frames have no polling call
+static size_t FindPollingFrame(const StackTraceSample* sample, ULONG** addresses)
+{
+    for (size_t frame = 0; frame < sample->depth && frame < MAX_POLL_FRAMES; frame++) {
+        if (!IS_REPEAT_MARKER(addresses[frame]) && IsPollingAddress(addresses[frame])) {
+            return frame;
+        }
+    }
+
+    return sample->depth;
+}
+
+static void RecordRun(const SpinRun* run)
+{
+    const float seconds = GetRunSeconds(run);
+
+    if (seconds < MIN_SPIN_MS / 1000.0f || run->samples < MIN_SPIN_SAMPLES || !run->pollSamples || !run->ipCount) {
+        return;
+    }
+
+    SampleInfo sampleInfo = InitializeTaskData(run->task);
+
+    // Idle tasks loop by design
+    if (IsIdleTask(sampleInfo.nameBuffer)) {
+        return;
+    }
+
+    const uint32 task = InternString(&spin.names, sampleInfo.nameBuffer);
+    ULONG* const anchor = GetAnchor(run);
+
+    Spinner* spinner = NULL;
+
+    // Spinners are few, a linear search is enough
+    for (size_t i = 0; i < spin.spinnerCount; i++) {
+        if (spin.spinners[i].task == task && spin.spinners[i].anchor == anchor) {
+            spinner = &spin.spinners[i];
+            break;
+        }
+    }
+
+    if (!spinner) {
+        if (spin.spinnerCount >= MAX_SPINNERS) {
+            spin.droppedRuns++;
+            return;
+        }
+
+        spinner = &spin.spinners[spin.spinnerCount++];
+        spinner->task = task;
+        spinner->anchor = anchor;
+    }
+
+    spinner->runs++;
+    spinner->samples += run->samples;
+    spinner->pollSamples += run->pollSamples;
+    spinner->seconds += seconds;
+    spinner->forbidSamples += run->forbidSamples;
+
+    if (run->samples > spinner->longest.samples) {
+        spinner->longest = *run;
+    }
+}
+
+static void EndRun(SpinRun* run)
+{
+    RecordRun(run);
+
+    HashMapRemove(&spin.runMap, (uint32)run->task);
+    memset(run, 0, sizeof(SpinRun));
+}
+
+static BOOL AddAddress(SpinRun* run, ULONG* ip)
+{
+    for (size_t i = 0; i < run->ipCount; i++) {
+        if (run->ips[i].ip == ip) {
+            run->ips[i].count++;
+            return TRUE;
+        }
+    }
+
+    if (run->ipCount >= MAX_LOOP_IPS) {
+        return FALSE;
+    }
+
+    run->ips[run->ipCount].ip = ip;
+    run->ips[run->ipCount].count = 1;
+    run->ipCount++;
+
+    return TRUE;
+}
+
+// Returns FALSE when the sample doesn't fit into the small set of loop addresses.
+// Inside a polling call the frames below it vary, so the call and its call site
+// are followed instead
+static BOOL AddToRun(SpinRun* run, const StackTraceSample* sample, ULONG** addresses, const size_t pollingFrame)
+{
+    const SpinRun saved = *run;
+    const size_t loopFrame = pollingFrame < sample->depth ? pollingFrame : 0;
+
+    for (size_t frame = loopFrame; frame < sample->depth && frame < loopFrame + 2; frame++) {
+        if (IS_REPEAT_MARKER(addresses[frame])) {
+            continue;
+        }
+
+        if (!AddAddress(run, addresses[frame])) {
+            *run = saved;
+            return FALSE;
+        }
+    }
+
+    run->last = spin.now;
+    run->samples++;
+
+    if (pollingFrame < sample->depth) {
+        run->pollSamples++;
+    }
+
+    if (sample->flags & STACK_TRACE_FORBID) {
+        run->forbidSamples++;
+    }
+
+    return TRUE;
+}
+
+static SpinRun* StartRun(struct Task* task)
+{
+    for (size_t i = 0; i < MAX_TASKS; i++) {
+        SpinRun* run = &spin.runs[i];
+
+        if (!run->task) {
+            uint32* index = HashMapAdd(&spin.runMap, (uint32)task);
+
+            if (!index) {
+                return NULL;
+            }
+
+            *index = (uint32)i + 1;
+
+            run->task = task;
+            run->first = run->last = spin.now;
+
+            return run;
+        }
+    }
+
+    return NULL;
+}
+
+static void AddSample(const StackTraceSample* sample)
+{
+    ULONG** addresses = GetStackTraceAddresses(sample);
+
+    if (!addresses || !sample->task) {
+        return;
+    }
+
+    const uint32* index = HashMapGet(&spin.runMap, (uint32)sample->task);
+    SpinRun* run = index ? &spin.runs[*index - 1] : NULL;
+    const size_t pollingFrame = FindPollingFrame(sample, addresses);
+
+    if (run && (IsGapOver(run, spin.now) || !AddToRun(run, sample, addresses, pollingFrame))) {
+        EndRun(run);
+        run = NULL;
+    }
+
+    if (!run) {
+        run = StartRun(sample->task);
+
+        if (run) {
+            AddToRun(run, sample, addresses, pollingFrame);
+        }
+    }
+}
+
+// Tasks that stopped running or exited have no new samples to end their runs
+static void EndPausedRuns(void)
+{
+    for (size_t i = 0; i < MAX_TASKS; i++) {
+        SpinRun* run = &spin.runs[i];
+
+        if (run->task && IsGapOver(run, spin.now)) {
+            EndRun(run);
+        }
+    }
+}
+
+static void EndAllRuns(void)
+{
+    for (size_t i = 0; i < MAX_TASKS; i++) {
+        if (spin.runs[i].task) {
+            EndRun(&spin.runs[i]);
+        }
+    }
+}
+
+void UpdateSpin(void)
+{
+    size_t index;
+    const uint64 lost = spin.lostStackTraces;
+    size_t pending = GetNewStackTraces(&spin.readStackTraces, &index, &spin.lostStackTraces);
+
+    // Runs can't be followed over overwritten stack traces, and their time is gone
+    if (spin.lostStackTraces != lost) {
+        EndAllRuns();
+    }
+
+    while (pending > 0) {
+        const StackTraceSample* sample = &ctx.profiling.samples[index];
+
+        spin.now += sample->delta;
+        AddSample(sample);
+
+        if (++index >= ctx.profiling.maxStackTraces) {
+            index = 0;
+        }
+
+        pending--;
+    }
+
+    EndPausedRuns();
+}
+
+static int CompareSpinners(const void* first, const void* second)
+{
+    const Spinner* a = first;
+    const Spinner* b = second;
+
+    if (a->samples > b->samples) return -1;
+    if (a->samples < b->samples) return 1;
+
+    return 0;
+}
+
+static int CompareAddresses(const void* first, const void* second)
+{
+    const LoopAddress* a = first;
+    const LoopAddress* b = second;
+
+    if (a->ip < b->ip) return -1;
+    if (a->ip > b->ip) return 1;
+
+    return 0;
+}
+
+// Neighbouring addresses of the same function are shown as one range
+static void ShowLoop(SpinRun* run)
+{
+    qsort(run->ips, run->ipCount, sizeof(LoopAddress), CompareAddresses);
+
+    for (size_t i = 0; i < run->ipCount;) {
+        SymbolInfo si;
+        const BOOL found = LookupSymbol(run->ips[i].ip, &si);
+
+        size_t end = i + 1;
+        uint32 count = run->ips[i].count;
+
+        while (end < run->ipCount) {
+            SymbolInfo next;
+            LookupSymbol(run->ips[end].ip, &next);
+
+            if (strcmp(si.functionName, next.functionName) != 0 || strcmp(si.moduleName, next.moduleName) != 0) {
+                break;
+            }
+
+            count += run->ips[end].count;
+            end++;
+        }
+
+        printf("  %p-%p %3u address(es) %8lu hits - %s @ %s%s\n",
+               (void*)run->ips[i].ip,
+               (void*)run->ips[end - 1].ip,
+               end - i,
+               count,
+               si.functionName,
+               si.moduleName,
+               found && IsPollingFunction(si.functionName) ? " [polling]" : "");
+
+        i = end;
+    }
+}
+
+void ShowSpin(void)
+{
+    UpdateSpin();
+
+    // Runs still going on at exit are counted as well
+    EndAllRuns();
+
+    printf("\nSuspected spinners: tasks polling in at most %u addresses for %u ms or longer\n", MAX_LOOP_IPS, MIN_SPIN_MS);
+
+    if (spin.lostStackTraces) {
+        printf("%llu stack trace(s) were overwritten before they could be followed\n", spin.lostStackTraces);
+    }
+
+    if (spin.droppedRuns) {
+        printf("%u run(s) were not counted, over %u spinners\n", spin.droppedRuns, MAX_SPINNERS);
+    }
+
+    if (!spin.spinnerCount) {
+        puts("No polling tasks found");
+        return;
+    }
+
+    qsort(spin.spinners, spin.spinnerCount, sizeof(Spinner), CompareSpinners);
+
+    printf("\n%10s %6s %12s %10s %10s %10s %40s\n", "Seconds", "Runs", "Longest (s)", "CPU %", "Polling %", "Forbid %", "Task");
+
+    for (size_t i = 0; i < spin.spinnerCount && i < MAX_SHOWN_SPINNERS; i++) {
+        const Spinner* spinner = &spin.spinners[i];
+
+        printf("%10.2f %6lu %12.2f %10.2f %10.2f %10.2f %40s\n",
+               spinner->seconds,
+               spinner->runs,
+               GetRunSeconds(&spinner->longest),
+               100.0f * (float)spinner->samples / (spinner->seconds * (float)ctx.samples),
+               100.0f * (float)spinner->pollSamples / (float)spinner->samples,
+               100.0f * (float)spinner->forbidSamples / (float)spinner->samples,
+               GetInternedString(&spin.names, spinner->task));
+    }
+
+    if (!spin.symbolsOpen) {
+        return;
+    }
+
+    for (size_t i = 0; i < spin.spinnerCount && i < MAX_SHOWN_SPINNERS; i++) {
+        Spinner* spinner = &spin.spinners[i];
+
+        printf("\nSpinner %u (task %s - loop of the longest run, %lu samples):\n",
+               i,
+               GetInternedString(&spin.names, spinner->task),
+               spinner->longest.samples);
+
+        ShowLoop(&spinner->longest);
+    }
+}
+
+BOOL InitSpin(void)
+{
+    memset(&spin, 0, sizeof(spin));
+
+    spin.runs = AllocateMemory(MAX_TASKS * sizeof(SpinRun));
+    spin.spinners = AllocateMemory(MAX_SPINNERS * sizeof(Spinner));
+
+    if (!spin.runs || !spin.spinners) {
+        puts("Failed to allocate spin detection buffers");
+        return FALSE;
+    }
+
+    if (!InitHashMap(&spin.runMap, 0) || !InitHashMap(&spin.polling, 0) || !InitInternTable(&spin.names)) {
+        puts("Failed to allocate spin detection tables");
+        return FALSE;
+    }
+
+    // Polling calls are found by their symbols
+    spin.symbolsOpen = OpenSymbols();
+
+    if (!spin.symbolsOpen) {
+        puts("Failed to get IDebug");
+    }
+
+    return TRUE;
+}
+
+void FreeSpin(void)
+{
+    if (spin.symbolsOpen) {
+        CloseSymbols();
+        spin.symbolsOpen = FALSE;
+    }
+
+    FreeHashMap(&spin.polling);
+    FreeHashMap(&spin.runMap);
+    FreeInternTable(&spin.names);
+
+    if (spin.spinners) {
+        FreeMemory(spin.spinners);
+        spin.spinners = NULL;
+    }
+
+    if (spin.runs) {
+        FreeMemory(spin.runs);
+        spin.runs = NULL;
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef SPIN_H
+#define SPIN_H
+
+#include <exec/types.h>
+
+BOOL InitSpin(void);
+void FreeSpin(void);
+
+// Follows the new stack traces of each task to find long runs in the same few
+// instructions. Called once per display interval
+void UpdateSpin(void);
+
+// Shows the suspected spinners with their loop address ranges and functions
+void ShowSpin(void);
+
+#endif
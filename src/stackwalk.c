@@ -0,0 +1,131 @@
+#include "stackwalk.h"
+
+#include <string.h>
+
+#define BACK_CHAIN 0 // Word offsets in a stack frame
+#define LINK_REGISTER 1
+
+static BOOL IsValidFrame(const StackImage* image, const uint32 frame)
+{
+    return frame >= image->lower && frame <= image->upper - 8 && (frame & 3) == 0;
+}
+
+static uint32 ReadFrameWord(const StackImage* image, const uint32 frame, const uint32 word)
+{
+    return image->memory[(frame - image->lower) / 4 + word];
+}
+
+// Repeats of the previous address are counted in a marker instead of being stored again
+static size_t AddFrame(ULONG** addresses, size_t depth, const uint32 word)
+{
+    ULONG* const address = (ULONG *)(size_t)word;
+
+    if (depth > 0 && addresses[depth - 1] == address) {
+        addresses[depth++] = REPEAT_MARKER(1);
+    } else if (depth > 1 && IS_REPEAT_MARKER(addresses[depth - 1]) && addresses[depth - 2] == address) {
+        addresses[depth - 1] = REPEAT_MARKER(REPEAT_COUNT(addresses[depth - 1]) + 1);
+    } else {
+        addresses[depth++] = address;
+    }
+
+    return depth;
+}
+
+void WalkStack(const StackImage* image, const StackRegisters* registers, ULONG** addresses, const size_t maxDepth, StackWalk* walk)
+{
+    uint32 frame = registers->sp;
+    size_t depth = 0;
+
+    memset(walk, 0, sizeof(StackWalk));
+
+    if (registers->ip && maxDepth > 0) {
+        // Return address of the current frame is stored in the caller frame, so the
+        // walk continues from the back chain
+        frame = IsValidFrame(image, registers->sp) ? ReadFrameWord(image, registers->sp, BACK_CHAIN) : 0;
+
+        depth = AddFrame(addresses, depth, registers->ip);
+
+        // Leaf function, or a function in its prologue or epilogue, has its return
+        // address only in the link register. After a call has returned, the link
+        // register points to the sampled function itself instead, which can't be
+        // told apart without symbols
+        const BOOL frameValid = IsValidFrame(image, frame);
+
+        if (depth < maxDepth && registers->lr && registers->lr != registers->ip &&
+            (!frameValid || registers->lr != ReadFrameWord(image, frame, LINK_REGISTER))) {
+            depth = AddFrame(addresses, depth, registers->lr);
+            walk->linkRegisterFrame = TRUE;
+        }
+    }
+
+    size_t walked = 0;
+
+    while (depth < maxDepth && walked++ < MAX_WALKED_FRAMES) {
+        if (!IsValidFrame(image, frame)) {
+            if (frame) {
+                walk->outOfBounds = TRUE;
+                walk->badFrame = frame;
+            }
+            break;
+        }
+
+        depth = AddFrame(addresses, depth, ReadFrameWord(image, frame, LINK_REGISTER));
+
+        const uint32 backChain = ReadFrameWord(image, frame, BACK_CHAIN);
+
+        if (backChain == frame) {
+            walk->loopDetected = TRUE;
+            walk->badFrame = frame;
+            frame = 0;
+            break;
+        }
+
+        if (backChain && (backChain - frame) % 16) {
+            walk->notAligned++;
+            walk->badFrame = frame;
+        }
+
+        frame = backChain;
+    }
+
+    walk->truncated = IsValidFrame(image, frame);
+    walk->depth = depth;
+}
+
+size_t RemoveFrame(ULONG** addresses, const size_t depth, const size_t index)
+{
+    if (index >= depth) {
+        return depth;
+    }
+
+    memmove(&addresses[index], &addresses[index + 1], (depth - index - 1) * sizeof(ULONG *));
+
+    return depth - 1;
+}
+
+size_t ExpandRepeats(ULONG** addresses, const size_t depth, ULONG** expanded, const size_t maxDepth)
+{
+    size_t frames = 0;
+
+    for (size_t i = 0; i < depth; i++) {
+        if (!IS_REPEAT_MARKER(addresses[i])) {
+            frames++;
+        }
+    }
+
+    size_t room = maxDepth > frames ? maxDepth - frames : 0;
+    size_t count = 0;
+
+    for (size_t i = 0; i < depth && count < maxDepth; i++) {
+        if (!IS_REPEAT_MARKER(addresses[i])) {
+            expanded[count++] = addresses[i];
+        } else if (i > 0) {
+            // Marker follows the address it repeats
+            for (uint32 repeat = REPEAT_COUNT(addresses[i]); repeat > 0 && room > 0; repeat--, room--) {
+                expanded[count++] = addresses[i - 1];
+            }
+        }
+    }
+
+    return count;
+}
@@ -0,0 +1,57 @@
+#ifndef STACKWALK_H
+#define STACKWALK_H
+
+#include <exec/types.h>
+#include <stddef.h>
+
+// Stack walking doesn't use system calls, so it can be tested on a host with
+// hand-built stack images
+
+// Instruction pointers are word aligned, so an odd value in a stack trace is a marker
+// telling how many more times the previous frame repeats (recursion)
+#define IS_REPEAT_MARKER(address) (((uint32)(size_t)(address) & 1) != 0)
+#define REPEAT_MARKER(count) ((ULONG *)(size_t)(((uint32)(count) << 1) | 1))
+#define REPEAT_COUNT(address) ((uint32)(size_t)(address) >> 1)
+
+#define MAX_STACK_DEPTH 256
+
+// Recursion doesn't use frame slots, but the walk of a deep recursion is still limited
+#define MAX_WALKED_FRAMES (4 * MAX_STACK_DEPTH)
+
+// Stack memory of a task. A PowerPC stack frame starts with the back chain word,
+// followed by the word where the called function saves its return address
+typedef struct StackImage {
+    const uint32* memory; // Word at address lower
+    uint32 lower; // Lowest stack address
+    uint32 upper; // Address after the stack
+} StackImage;
+
+typedef struct StackRegisters {
+    uint32 ip; // Interrupted instruction pointer, 0 when only the saved stack pointer is known
+    uint32 lr; // Link register
+    uint32 sp; // Stack pointer (r1), or the stack pointer saved at the task switch
+} StackRegisters;
+
+typedef struct StackWalk {
+    size_t depth; // Number of instruction pointers and repeat markers stored
+    BOOL linkRegisterFrame; // Second frame came from the link register and may be the sampled function itself
+    BOOL truncated; // Stack was deeper than the limit
+    BOOL loopDetected; // Back chain pointed to the frame itself
+    BOOL outOfBounds; // Back chain pointed outside of the stack
+    uint32 notAligned; // Frames that were not 16-byte aligned relative to the previous one
+    uint32 badFrame; // Address of the last frame that was out of bounds or not aligned
+} StackWalk;
+
+// Walks the stack from the registers and stores at most maxDepth instruction pointers,
+// innermost first. Recursion is stored as repeat markers
+void WalkStack(const StackImage* image, const StackRegisters* registers, ULONG** addresses, size_t maxDepth, StackWalk* walk);
+
+// Removes the frame at index and returns the new depth
+size_t RemoveFrame(ULONG** addresses, size_t depth, size_t index);
+
+// Copies the stack trace with repeat markers expanded back into repeated frames, for
+// exporters that show each call. Other frames are always kept and repeats fill the
+// room left of maxDepth. Returns the new depth
+size_t ExpandRepeats(ULONG** addresses, size_t depth, ULONG** expanded, size_t maxDepth);
+
+#endif
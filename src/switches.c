@@ -0,0 +1,398 @@
+#include "switches.h"
+#include "hashmap.h"
+#include "intern.h"
+#include "profiler.h"
+#include "tasknames.h"
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Task switch rate is sampled with every timer tick from DispCount and collected
+// into bins of whole ticks, about 100 ms each. A bin is a burst when its rate is
+// much higher than the recent baseline, and neighbouring burst bins make one burst.
+// Switches during bursts are attributed to the tasks that were running at those
+// ticks. The switches of each tick are kept for the last minute.
+
+#define BIN_MS 100
+#define TICK_SERIES_SECONDS 60
+#define BURST_FACTOR 4 // Burst rate is at least this many times the baseline
+#define MIN_BURST_RATE 1000 // Switches per second, lower rates are never bursts
+#define BASELINE_BINS 100 // Baseline follows about 10 seconds of normal bins
+#define MAX_BIN_TASKS 8
+#define MAX_BURSTS 100
+#define MAX_SHOWN_BURSTS 10
+#define MAX_SHOWN_BURST_TASKS 10
+
+typedef struct TaskSwitches {
+    struct Task* task; // Task running at the tick
+    uint32 switches; // Switches counted at its ticks
+} TaskSwitches;
+
+typedef struct Burst {
+    uint32 start; // Number of the first bin since start
+    uint32 bins; // Length in bins
+    uint32 peak; // Highest bin rate, switches per second
+    uint32 peakTick; // Highest single tick rate, switches per second
+    uint32 switches; // Number of switches
+    uint32 task; // Interned name of the task running at most switches
+} Burst;
+
+typedef struct Switches {
+    uint32* series; // Ring of switch rates per bin, switches per second
+    uint32 seriesLength; // Bins in the last 15 minutes
+    uint32 bins; // Number of bins completed since start
+    uint16* tickSeries; // Ring of switches per tick
+    uint32 tickSeriesLength; // Ticks in the last minute
+    uint32 ticks; // Number of ticks since start
+    uint32 ticksPerBin; // Timer ticks per bin
+    uint32 binTicks; // Ticks collected into the current bin
+    uint32 binSwitches; // Switches collected into the current bin
+    uint32 binPeakTick; // Most switches at one tick of the current bin
+    TaskSwitches binTasks[MAX_BIN_TASKS]; // Tasks of the current bin
+    float baseline; // Moving average of bin rates outside bursts
+
+    BOOL inBurst; // TRUE when the previous bin was a burst
+    Burst current; // Burst being collected
+    TaskSwitches burstTasks[MAX_BIN_TASKS]; // Tasks of the current burst
+    Burst* bursts; // Ring of completed bursts
+    uint32 totalBursts; // Number of bursts since start
+
+    HashMap taskSwitches; // Interned task name -> switches during bursts
+    HashMap taskNames; // Task -> interned task name, cleared with each update
+    InternTable names; // Task names
+} Switches;
+
+static Switches sw;
+
+// Bins have whole ticks, so they are not exactly BIN_MS long
+static float GetBinSeconds(const uint32 bins)
+{
+    return (float)bins * (float)sw.ticksPerBin / (float)ctx.samples;
+}
+
+// Few tasks run during one bin, the rest are left out
+static void AddTaskSwitches(TaskSwitches* tasks, struct Task* task, const uint32 switches)
+{
+    for (size_t i = 0; i < MAX_BIN_TASKS; i++) {
+        if (tasks[i].task == task || !tasks[i].task) {
+            tasks[i].task = task;
+            tasks[i].switches += switches;
+            return;
+        }
+    }
+}
+
+static void EndBurst(void)
+{
+    size_t top = 0;
+
+    for (size_t i = 0; i < MAX_BIN_TASKS && sw.burstTasks[i].task; i++) {
+        if (sw.burstTasks[i].switches > sw.burstTasks[top].switches) {
+            top = i;
+        }
+    }
+
+    sw.current.task = sw.burstTasks[top].task ? InternTaskName(sw.burstTasks[top].task, &sw.taskNames, &sw.names) : 0;
+    sw.bursts[sw.totalBursts++ % MAX_BURSTS] = sw.current;
+    sw.inBurst = FALSE;
+
+    memset(sw.burstTasks, 0, sizeof(sw.burstTasks));
+}
+
+static void EndBin(void)
+{
+    const uint32 rate = (uint32)((uint64)sw.binSwitches * ctx.samples / sw.binTicks);
+
+    const uint32 tickRate = sw.binPeakTick * ctx.samples;
+
+    sw.series[sw.bins % sw.seriesLength] = rate;
+
+    if (sw.bins == 0) {
+        sw.baseline = (float)rate;
+    }
+
+    if (rate >= MIN_BURST_RATE && (float)rate > BURST_FACTOR * sw.baseline) {
+        if (!sw.inBurst) {
+            memset(&sw.current, 0, sizeof(Burst));
+            sw.current.start = sw.bins;
+            sw.inBurst = TRUE;
+        }
+
+        sw.current.bins++;
+        sw.current.switches += sw.binSwitches;
+
+        if (rate > sw.current.peak) {
+            sw.current.peak = rate;
+        }
+
+        if (tickRate > sw.current.peakTick) {
+            sw.current.peakTick = tickRate;
+        }
+
+        for (size_t i = 0; i < MAX_BIN_TASKS && sw.binTasks[i].task; i++) {
+            AddTaskSwitches(sw.burstTasks, sw.binTasks[i].task, sw.binTasks[i].switches);
+
+            uint32* switches = HashMapAdd(&sw.taskSwitches, InternTaskName(sw.binTasks[i].task, &sw.taskNames, &sw.names));
+            if (switches) {
+                *switches += sw.binTasks[i].switches;
+            }
+        }
+    } else {
+        if (sw.inBurst) {
+            EndBurst();
+        }
+
+        sw.baseline += ((float)rate - sw.baseline) / BASELINE_BINS;
+    }
+
+    if (rate > ctx.peakSwitchesPerSecond) {
+        ctx.peakSwitchesPerSecond = rate;
+    }
+
+    sw.bins++;
+    sw.binTicks = 0;
+    sw.binSwitches = 0;
+    sw.binPeakTick = 0;
+
+    memset(sw.binTasks, 0, sizeof(sw.binTasks));
+}
+
+void UpdateSwitches(const SampleData* data)
+{
+    // Task pointers are reused by new tasks, refresh names for this update
+    ClearHashMap(&sw.taskNames);
+
+    ctx.peakSwitchesPerSecond = 0;
+    ctx.peakTickSwitchesPerSecond = 0;
+
+    for (size_t tick = 0; tick < ctx.totalSamples; tick++) {
+        const Sample* sample = &data->sampleBuffer[tick];
+
+        const uint32 tickRate = sample->switches * ctx.samples;
+
+        if (tickRate > ctx.peakTickSwitchesPerSecond) {
+            ctx.peakTickSwitchesPerSecond = tickRate;
+        }
+
+        sw.tickSeries[sw.ticks++ % sw.tickSeriesLength] = (uint16)(sample->switches < 0xFFFF ? sample->switches : 0xFFFF);
+
+        if (sample->switches > sw.binPeakTick) {
+            sw.binPeakTick = sample->switches;
+        }
+
+        sw.binTicks++;
+        sw.binSwitches += sample->switches;
+
+        AddTaskSwitches(sw.binTasks, sample->task, sample->switches);
+
+        // Bins continue over display intervals when a second doesn't divide evenly
+        if (sw.binTicks >= sw.ticksPerBin) {
+            EndBin();
+        }
+    }
+}
+
+static int CompareBursts(const void* first, const void* second)
+{
+    const Burst* a = first;
+    const Burst* b = second;
+
+    if (a->peak > b->peak) return -1;
+    if (a->peak < b->peak) return 1;
+
+    return 0;
+}
+
+static void ShowBursts(void)
+{
+    const size_t count = sw.totalBursts < MAX_BURSTS ? sw.totalBursts : MAX_BURSTS;
+
+    qsort(sw.bursts, count, sizeof(Burst), CompareBursts);
+
+    printf("\n%10s %12s %10s %12s %14s %40s\n", "Start (s)", "Length (ms)", "Switches", "Peak / s", "Tick peak / s",
+           "Task running at most switches");
+
+    for (size_t i = 0; i < count && i < MAX_SHOWN_BURSTS; i++) {
+        const Burst* burst = &sw.bursts[i];
+
+        printf("%10.1f %12.0f %10lu %12lu %14lu %40s\n",
+               GetBinSeconds(burst->start),
+               1000.0f * GetBinSeconds(burst->bins),
+               burst->switches,
+               burst->peak,
+               burst->peakTick,
+               burst->task ? GetInternedString(&sw.names, burst->task) : "");
+    }
+}
+
+static void ShowBurstTasks(void)
+{
+    uint32 total = 0;
+
+    for (size_t slot = 0; slot < sw.taskSwitches.capacity; slot++) {
+        total += sw.taskSwitches.values[slot];
+    }
+
+    if (!total) {
+        return;
+    }
+
+    printf("\n%10s %10s %64s\n", "Switch %", "Switches", "Task running during bursts");
+
+    for (size_t shown = 0; shown < MAX_SHOWN_BURST_TASKS; shown++) {
+        size_t best = sw.taskSwitches.capacity;
+
+        for (size_t slot = 0; slot < sw.taskSwitches.capacity; slot++) {
+            if (sw.taskSwitches.keys[slot] && sw.taskSwitches.values[slot] &&
+                (best == sw.taskSwitches.capacity || sw.taskSwitches.values[slot] > sw.taskSwitches.values[best])) {
+                best = slot;
+            }
+        }
+
+        if (best == sw.taskSwitches.capacity) {
+            break;
+        }
+
+        printf("%10.2f %10lu %64s\n",
+               100.0f * (float)sw.taskSwitches.values[best] / (float)total,
+               sw.taskSwitches.values[best],
+               GetInternedString(&sw.names, sw.taskSwitches.keys[best]));
+
+        // Shown already, sorting is not needed for a few lines
+        sw.taskSwitches.values[best] = 0;
+    }
+}
+
+static BOOL IsBurstBin(const uint32 bin)
+{
+    for (size_t i = 0; i < MAX_BURSTS && i < sw.totalBursts; i++) {
+        if (bin >= sw.bursts[i].start && bin < sw.bursts[i].start + sw.bursts[i].bins) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static void WriteSeries(const char* fileName)
+{
+    FILE* file = fopen(fileName, "w");
+
+    if (!file) {
+        printf("Failed to open '%s' for writing\n", fileName);
+        return;
+    }
+
+    fprintf(file, "time_s,switches_per_s,burst\n");
+
+    const uint32 first = sw.bins > sw.seriesLength ? sw.bins - sw.seriesLength : 0;
+
+    for (uint32 bin = first; bin < sw.bins; bin++) {
+        fprintf(file, "%.3f,%lu,%d\n", GetBinSeconds(bin), sw.series[bin % sw.seriesLength], IsBurstBin(bin) ? 1 : 0);
+    }
+
+    fclose(file);
+
+    printf("Wrote %lu task switch rate(s) to '%s'\n", sw.bins - first, fileName);
+}
+
+// Ticks go next to the bins, "switches.csv" -> "switches_ticks.csv"
+static void WriteTickSeries(const char* fileName)
+{
+    char tickFileName[NAME_LEN];
+    const char* extension = strrchr(fileName, '.');
+    const int length = extension ? (int)(extension - fileName) : (int)strlen(fileName);
+
+    snprintf(tickFileName, sizeof(tickFileName), "%.*s_ticks%s", length, fileName, extension ? extension : "");
+
+    FILE* file = fopen(tickFileName, "w");
+
+    if (!file) {
+        printf("Failed to open '%s' for writing\n", tickFileName);
+        return;
+    }
+
+    fprintf(file, "time_s,switches,burst\n");
+
+    const uint32 first = sw.ticks > sw.tickSeriesLength ? sw.ticks - sw.tickSeriesLength : 0;
+
+    for (uint32 tick = first; tick < sw.ticks; tick++) {
+        fprintf(file, "%.4f,%u,%d\n", (float)tick / (float)ctx.samples, sw.tickSeries[tick % sw.tickSeriesLength],
+                IsBurstBin(tick / sw.ticksPerBin) ? 1 : 0);
+    }
+
+    fclose(file);
+
+    printf("Wrote %lu task switch tick(s) to '%s'\n", sw.ticks - first, tickFileName);
+}
+
+void ShowSwitches(void)
+{
+    if (sw.inBurst) {
+        EndBurst();
+    }
+
+    if (ctx.switchCsvFile[0]) {
+        WriteSeries(ctx.switchCsvFile);
+        WriteTickSeries(ctx.switchCsvFile);
+    }
+
+    if (!sw.totalBursts) {
+        return;
+    }
+
+    printf("\nTask switch bursts: %lu (over %u switches / s and %u times the recent rate, in %.1f ms bins)\n",
+           sw.totalBursts, MIN_BURST_RATE, BURST_FACTOR, 1000.0f * GetBinSeconds(1));
+
+    ShowBursts();
+    ShowBurstTasks();
+}
+
+BOOL InitSwitches(void)
+{
+    memset(&sw, 0, sizeof(sw));
+
+    sw.ticksPerBin = ctx.samples * BIN_MS / 1000;
+    sw.seriesLength = MAX_LOAD_AVERAGES * ctx.samples / sw.ticksPerBin;
+    sw.tickSeriesLength = TICK_SERIES_SECONDS * ctx.samples;
+
+    sw.series = AllocateMemory(sw.seriesLength * sizeof(uint32));
+    sw.tickSeries = AllocateMemory(sw.tickSeriesLength * sizeof(uint16));
+    sw.bursts = AllocateMemory(MAX_BURSTS * sizeof(Burst));
+
+    if (!sw.series || !sw.tickSeries || !sw.bursts) {
+        puts("Failed to allocate task switch buffers");
+        return FALSE;
+    }
+
+    if (!InitHashMap(&sw.taskSwitches, 0) || !InitHashMap(&sw.taskNames, 0) || !InitInternTable(&sw.names)) {
+        puts("Failed to allocate task switch tables");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void FreeSwitches(void)
+{
+    FreeHashMap(&sw.taskSwitches);
+    FreeHashMap(&sw.taskNames);
+    FreeInternTable(&sw.names);
+
+    if (sw.bursts) {
+        FreeMemory(sw.bursts);
+        sw.bursts = NULL;
+    }
+
+    if (sw.tickSeries) {
+        FreeMemory(sw.tickSeries);
+        sw.tickSeries = NULL;
+    }
+
+    if (sw.series) {
+        FreeMemory(sw.series);
+        sw.series = NULL;
+    }
+}
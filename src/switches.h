@@ -0,0 +1,16 @@
+#ifndef SWITCHES_H
+#define SWITCHES_H
+
+#include "common.h"
+
+BOOL InitSwitches(void);
+void FreeSwitches(void);
+
+// Collects per-tick task switch counts of the interval into about 100 ms rates and finds
+// bursts. Called once per display interval
+void UpdateSwitches(const SampleData* data);
+
+// Shows task switch bursts and the tasks running during them, and writes the rate CSVs
+void ShowSwitches(void);
+
+#endif
@@ -0,0 +1,97 @@
+#include "symbolizer.h"
+#include "symbols.h"
+#include "profiler.h"
+#include "common.h"
+
+#include <proto/dos.h>
+#include <proto/exec.h>
+
+#include <stdio.h>
+
+// Symbols are resolved while sampling is running, when profiled programs are still
+// loaded. This also leaves less work for the report at exit.
+
+#define SYMBOLIZER_PRIORITY -1
+#define SYMBOLIZER_DELAY 25 // Ticks (1/50 s) between passes
+#define SYMBOLIZER_EXPIRE_PASSES 20 // Passes between checks of cached names against loaded modules
+
+static struct Process* symbolizer;
+static uint32 symbolizerPid;
+
+// Returns FALSE when process was asked to stop
+static BOOL Symbolize(uint64* readStackTraces)
+{
+    size_t index;
+    size_t pending = GetNewStackTraces(readStackTraces, &index, NULL);
+
+    while (pending > 0) {
+        const StackTraceSample* sample = &ctx.profiling.samples[index];
+        ULONG** addresses = GetStackTraceAddresses(sample);
+
+        for (size_t frame = 0; addresses && frame < sample->depth; frame++) {
+            CacheSymbol(addresses[frame]);
+        }
+
+        if (IDOS->CheckSignal(SIGBREAKF_CTRL_C)) {
+            return FALSE;
+        }
+
+        if (++index >= ctx.profiling.maxStackTraces) {
+            index = 0;
+        }
+
+        pending--;
+    }
+
+    return TRUE;
+}
+
+static int32 SymbolizerEntry(STRPTR args, int32 length, APTR sysBase)
+{
+    (void)args;
+    (void)length;
+    (void)sysBase;
+
+    uint64 readStackTraces = 0;
+    uint32 passes = 0;
+
+    while (Symbolize(&readStackTraces) && !IDOS->CheckSignal(SIGBREAKF_CTRL_C)) {
+        IDOS->Delay(SYMBOLIZER_DELAY);
+
+        // Programs may have quit and others loaded to the same addresses
+        if (++passes % SYMBOLIZER_EXPIRE_PASSES == 0) {
+            ExpireSymbols();
+        }
+    }
+
+    return RETURN_OK;
+}
+
+BOOL StartSymbolizer(void)
+{
+    symbolizer = IDOS->CreateNewProcTags(
+        NP_Entry, SymbolizerEntry,
+        NP_Name, "Tequila symbolizer",
+        NP_Priority, SYMBOLIZER_PRIORITY,
+        NP_StackSize, 64000,
+        NP_Child, TRUE,
+        TAG_DONE);
+
+    if (!symbolizer) {
+        puts("Failed to start symbolizer process");
+        return FALSE;
+    }
+
+    symbolizerPid = symbolizer->pr_ProcessID;
+
+    return TRUE;
+}
+
+void StopSymbolizer(void)
+{
+    if (symbolizer) {
+        IExec->Signal((struct Task *)symbolizer, SIGBREAKF_CTRL_C);
+        IDOS->WaitForChildExit(symbolizerPid);
+        symbolizer = NULL;
+    }
+}
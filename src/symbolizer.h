@@ -0,0 +1,10 @@
+#ifndef SYMBOLIZER_H
+#define SYMBOLIZER_H
+
+#include <exec/types.h>
+
+// Starts a low-priority process which resolves sampled addresses into the symbol cache
+BOOL StartSymbolizer(void);
+void StopSymbolizer(void);
+
+#endif
@@ -1,37 +1,76 @@
 #include "symbols.h"
 #include "common.h"
 #include "profiler.h"
-
+#include "folded.h"
+#include "pprof.h"
+#include "flamegraph.h"
+#include "timeline.h"
+#include "demangle.h"
+#include "hashmap.h"
+#include "intern.h"
+#include "reservoir.h"
+#include "tasknames.h"
+
+#include <proto/dos.h>
 #include <proto/exec.h>
 
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
+#include <math.h>
 
 #define MAX_SYMBOLS 200
 #define MAX_STACK_TRACES 200
 #define LOWEST_VALID_CODE_ADDRESS 0x100000 /* Just a random number from magic hat */
-
-struct DebugIFace* IDebug;
-
-typedef struct SymbolInfo {
+#define MAX_TOP_FUNCTIONS 10
+#define MAX_ANNOTATED_ADDRESSES 20
+#define MAX_ESTIMATES 20
+#define MAX_CACHED_SYMBOLS 65536 // Addresses, the least recently used ones are evicted
+
+typedef struct CachedSymbol {
+    const ULONG* address;
+    uint32 moduleName; // Interned strings
+    uint32 functionName;
+    uint32 sourceFile;
+    uint32 line;
+    uint32 segmentOffset;
+    uint32 generation; // Cache generation when the address was last resolved
+    BOOL found;
+    BOOL referenced; // Looked up since the eviction hand last passed
+} CachedSymbol;
+
+// Symbols are cached by address, so each address is resolved only once per
+// generation. The cache is shared with the symbolizer process. When it's full,
+// the clock algorithm evicts an entry that wasn't looked up recently
+typedef struct SymbolCache {
+    struct SignalSemaphore* lock;
+    HashMap addresses; // Address -> entry index + 1
+    InternTable strings;
+    CachedSymbol* entries;
     size_t count;
-    ULONG* address;
-    char moduleName[NAME_LEN];
-    char functionName[NAME_LEN];
-} SymbolInfo;
+    size_t capacity;
+    size_t hand; // Next eviction candidate
+    uint32 generation;
+} SymbolCache;
 
-typedef struct StackTrace {
-    uint32 id;
-    struct Task* task;
-    size_t count;
-    uint32* ip[MAX_STACK_DEPTH];
-} StackTrace;
+struct DebugIFace* IDebug;
 
-// TODO: C++ name demangling needed
+static SymbolCache cache;
+static int symbolUsers; // Number of OpenSymbols() calls without CloseSymbols()
 
-static void Symbol(const ULONG* address, SymbolInfo* symbolInfo)
+static BOOL ResolveSymbol(const ULONG* address, SymbolInfo* symbolInfo)
 {
+    if (IS_REPEAT_MARKER(address)) {
+        // Shown as a frame of its own, between the recursive function and its caller
+        snprintf(symbolInfo->moduleName, NAME_LEN, "[recursion]");
+        snprintf(symbolInfo->functionName, NAME_LEN, "%lu more calls", REPEAT_COUNT(address));
+        symbolInfo->sourceFile[0] = '\0';
+        symbolInfo->line = 0;
+        symbolInfo->segmentOffset = 0;
+        return TRUE;
+    }
+
     // Note: there is a bug in kernel < 54.47 (???) that requires address increment of 4 bytes
     const int offset = ctx.symbolLookupWorkaroundNeeded ? 1 : 0;
 
@@ -39,8 +78,12 @@ static void Symbol(const ULONG* address, SymbolInfo* symbolInfo)
 
     if (ds) {
         snprintf(symbolInfo->moduleName, NAME_LEN, "%s", ds->Name);
-        snprintf(symbolInfo->functionName, NAME_LEN, "%s", ds->SourceFunctionName);
+        snprintf(symbolInfo->functionName, NAME_LEN, "%s", DemangleSymbol(ds->SourceFunctionName));
+        snprintf(symbolInfo->sourceFile, NAME_LEN, "%s", ds->SourceFileName ? ds->SourceFileName : "");
+        symbolInfo->line = ds->SourceLineNumber;
+        symbolInfo->segmentOffset = ds->SegmentOffset;
         IDebug->ReleaseDebugSymbol(ds);
+        return TRUE;
     } else {
         const char* detail = "";
         if ((uint32)address < LOWEST_VALID_CODE_ADDRESS) {
@@ -51,47 +94,286 @@ static void Symbol(const ULONG* address, SymbolInfo* symbolInfo)
 
         snprintf(symbolInfo->moduleName, NAME_LEN, "Symbol not available%s", detail);
         symbolInfo->functionName[0] = '\0';
+        symbolInfo->sourceFile[0] = '\0';
+        symbolInfo->line = 0;
+        symbolInfo->segmentOffset = 0;
         //snprintf(symbolInfo->functionName, NAME_LEN, "%p", address);
         //IExec->DebugPrintF("%p\n", address);
     }
+
+    return FALSE;
+}
+
+static BOOL GrowCache(void)
+{
+    if (cache.capacity >= MAX_CACHED_SYMBOLS) {
+        return FALSE;
+    }
+
+    const size_t capacity = cache.capacity ? cache.capacity * 2 : 256;
+    CachedSymbol* entries = AllocateMemory(capacity * sizeof(CachedSymbol));
+
+    if (!entries) {
+        return FALSE;
+    }
+
+    if (cache.entries) {
+        memcpy(entries, cache.entries, cache.count * sizeof(CachedSymbol));
+        FreeMemory(cache.entries);
+    }
+
+    cache.entries = entries;
+    cache.capacity = capacity;
+
+    return TRUE;
 }
 
-static void MaybeLookup(ULONG* address, SymbolInfo* symbolInfo)
+// Strings of evicted entries stay interned, so the strings are copied to a new
+// table when most of them are no longer used
+static void CompactStrings(void)
 {
-    static ULONG* lastAddress = NULL;
+    InternTable strings;
+
+    if (!InitInternTable(&strings)) {
+        return;
+    }
+
+    for (size_t i = 0; i < cache.count; i++) {
+        CachedSymbol* symbol = &cache.entries[i];
 
-    // Try to avoid unnecessary symbol lookups
-    if (address != lastAddress) {
-        Symbol(address, symbolInfo);
-        lastAddress = address;
+        symbol->moduleName = InternString(&strings, GetInternedString(&cache.strings, symbol->moduleName));
+        symbol->functionName = InternString(&strings, GetInternedString(&cache.strings, symbol->functionName));
+        symbol->sourceFile = InternString(&strings, GetInternedString(&cache.strings, symbol->sourceFile));
     }
+
+    FreeInternTable(&cache.strings);
+    cache.strings = strings;
 }
 
-static BOOL FindSymbol(const ULONG* address, SymbolInfo* symbols, SymbolInfo* symbolInfoBuffer)
+// Returns the entry to reuse when the cache is full
+static CachedSymbol* EvictSymbol(void)
 {
-    for (size_t u = 0; u < ctx.profiling.uniqueSymbols; u++) {
-        if (address == symbols[u].address ||
-            ((strcmp(symbolInfoBuffer->moduleName, symbols[u].moduleName) == 0) &&
-             (strcmp(symbolInfoBuffer->functionName, symbols[u].functionName) == 0)))
-        {
-            symbols[u].count++;
-            return TRUE;
+    while (cache.entries[cache.hand].referenced) {
+        cache.entries[cache.hand].referenced = FALSE;
+
+        if (++cache.hand >= cache.count) {
+            cache.hand = 0;
         }
     }
 
-    return FALSE;
+    CachedSymbol* symbol = &cache.entries[cache.hand];
+
+    HashMapRemove(&cache.addresses, (uint32)symbol->address);
+
+    if (++cache.hand >= cache.count) {
+        cache.hand = 0;
+    }
+
+    // Each entry has three strings at most
+    if (cache.strings.count > 6 * cache.count) {
+        CompactStrings();
+    }
+
+    return symbol;
 }
 
-static void AddSymbol(ULONG* address, SymbolInfo* symbols, SymbolInfo* symbolInfoBuffer)
+static void SetCachedSymbol(CachedSymbol* symbol, const SymbolInfo* symbolInfo, const BOOL found)
 {
-    SymbolInfo* symbol = &symbols[ctx.profiling.uniqueSymbols];
+    symbol->moduleName = InternString(&cache.strings, symbolInfo->moduleName);
+    symbol->functionName = InternString(&cache.strings, symbolInfo->functionName);
+    symbol->sourceFile = InternString(&cache.strings, symbolInfo->sourceFile);
+    symbol->line = symbolInfo->line;
+    symbol->segmentOffset = symbolInfo->segmentOffset;
+    symbol->found = found;
+    symbol->generation = cache.generation;
+    symbol->referenced = TRUE;
+}
+
+// Caller must hold the cache lock. Returns NULL when symbol couldn't be cached.
+// An entry of an older generation is resolved again when refresh is set, and replaced
+// when the address has a symbol now. Otherwise the old name is kept, because it's
+// still the best name for samples taken before the module was unloaded
+static const CachedSymbol* GetCachedSymbol(const ULONG* address, SymbolInfo* symbolInfo, const BOOL refresh)
+{
+    const uint32* index = HashMapGet(&cache.addresses, (uint32)address);
+
+    if (index) {
+        CachedSymbol* symbol = &cache.entries[*index - 1];
+
+        symbol->referenced = TRUE;
+
+        if (refresh && symbol->generation != cache.generation) {
+            if (ResolveSymbol(address, symbolInfo)) {
+                SetCachedSymbol(symbol, symbolInfo, TRUE);
+            } else {
+                symbol->generation = cache.generation;
+            }
+        }
+
+        return symbol;
+    }
+
+    const BOOL found = ResolveSymbol(address, symbolInfo);
+
+    CachedSymbol* symbol;
+    size_t entry;
+
+    if (cache.count < cache.capacity || GrowCache()) {
+        entry = cache.count;
+        symbol = &cache.entries[entry];
+    } else if (cache.count) {
+        symbol = EvictSymbol();
+        entry = (size_t)(symbol - cache.entries);
+    } else {
+        return NULL;
+    }
+
+    uint32* slot = HashMapAdd(&cache.addresses, (uint32)address);
+
+    if (!slot) {
+        // Evicted entry is no longer mapped, so it must not remove the address later
+        symbol->address = NULL;
+        return NULL;
+    }
+
+    *slot = (uint32)entry + 1;
+
+    if (entry == cache.count) {
+        cache.count++;
+    }
 
-    strcpy(symbol->moduleName, symbolInfoBuffer->moduleName); // TODO: take buffer size into account
-    strcpy(symbol->functionName, symbolInfoBuffer->functionName); // TODO: take buffer size into account
-    symbol->count = 1;
     symbol->address = address;
+    SetCachedSymbol(symbol, symbolInfo, found);
+
+    return symbol;
+}
+
+BOOL LookupSymbol(const ULONG* address, SymbolInfo* symbolInfo)
+{
+    if (!cache.lock) {
+        return ResolveSymbol(address, symbolInfo);
+    }
+
+    IExec->ObtainSemaphore(cache.lock);
 
-    ++ctx.profiling.uniqueSymbols;
+    const CachedSymbol* symbol = GetCachedSymbol(address, symbolInfo, FALSE);
+    BOOL found;
+
+    if (symbol) {
+        snprintf(symbolInfo->moduleName, NAME_LEN, "%s", GetInternedString(&cache.strings, symbol->moduleName));
+        snprintf(symbolInfo->functionName, NAME_LEN, "%s", GetInternedString(&cache.strings, symbol->functionName));
+        snprintf(symbolInfo->sourceFile, NAME_LEN, "%s", GetInternedString(&cache.strings, symbol->sourceFile));
+        symbolInfo->line = symbol->line;
+        symbolInfo->segmentOffset = symbol->segmentOffset;
+        found = symbol->found;
+    } else {
+        found = ResolveSymbol(address, symbolInfo);
+    }
+
+    IExec->ReleaseSemaphore(cache.lock);
+
+    return found;
+}
+
+void CacheSymbol(const ULONG* address)
+{
+    SymbolInfo symbolInfo;
+
+    if (!cache.lock) {
+        return;
+    }
+
+    // Address was just sampled, so the module loaded there now is the right one
+    IExec->ObtainSemaphore(cache.lock);
+    GetCachedSymbol(address, &symbolInfo, TRUE);
+    IExec->ReleaseSemaphore(cache.lock);
+}
+
+void ExpireSymbols(void)
+{
+    if (!cache.lock) {
+        return;
+    }
+
+    IExec->ObtainSemaphore(cache.lock);
+    cache.generation++;
+    IExec->ReleaseSemaphore(cache.lock);
+}
+
+static void CheckLinkRegisterFrame(StackTraceSample* sample, ULONG** addresses)
+{
+    SymbolInfo sampled;
+    SymbolInfo caller;
+
+    if (sample->depth >= 2 &&
+        LookupSymbol(addresses[0], &sampled) &&
+        LookupSymbol(addresses[1], &caller) &&
+        strcmp(sampled.functionName, caller.functionName) == 0 &&
+        strcmp(sampled.moduleName, caller.moduleName) == 0) {
+        sample->depth = (uint32)RemoveFrame(addresses, sample->depth, 1);
+        ctx.profiling.linkRegisterFramesDropped++;
+    }
+
+    sample->flags &= ~(uint32)STACK_TRACE_LINK_REGISTER;
+}
+
+void CheckLinkRegisterFrames(void)
+{
+    static uint64 checkedStackTraces;
+
+    if (!IDebug) {
+        return;
+    }
+
+    size_t index;
+    size_t pending = GetNewStackTraces(&checkedStackTraces, &index, NULL);
+
+    while (pending > 0) {
+        StackTraceSample* sample = &ctx.profiling.samples[index];
+        ULONG** addresses = GetStackTraceAddresses(sample);
+
+        if (addresses && (sample->flags & STACK_TRACE_LINK_REGISTER)) {
+            CheckLinkRegisterFrame(sample, addresses);
+        }
+
+        if (++index >= ctx.profiling.maxStackTraces) {
+            index = 0;
+        }
+
+        pending--;
+    }
+}
+
+// Symbols are identified by interned names while preparing the report
+typedef struct SymbolIndex {
+    InternTable names; // Module names and "module function" keys
+    HashMap symbols; // Interned "module function" key -> symbol index + 1
+} SymbolIndex;
+
+static SymbolIndex symbolIndex;
+
+static uint32 GetSymbolKey(const char* moduleName, const char* functionName)
+{
+    char name[2 * NAME_LEN];
+    snprintf(name, sizeof(name), "%s %s", moduleName, functionName);
+
+    return InternString(&symbolIndex.names, name);
+}
+
+// Space-Saving: when the table is full, the smallest entry is replaced and the new
+// entry inherits its count. Counts are then overestimated by at most that much,
+// which is never more than total / table size.
+static size_t FindSmallestSymbol(const SymbolInfo* symbols)
+{
+    size_t smallest = 0;
+
+    for (size_t i = 1; i < ctx.profiling.uniqueSymbols; i++) {
+        if (symbols[i].count < symbols[smallest].count) {
+            smallest = i;
+        }
+    }
+
+    return smallest;
 }
 
 static void AddUniqueSymbol(uint32* address, SymbolInfo* symbols)
@@ -99,32 +381,112 @@ static void AddUniqueSymbol(uint32* address, SymbolInfo* symbols)
     SymbolInfo si;
     ctx.profiling.validSymbols++;
 
-    MaybeLookup(address, &si);
+    LookupSymbol(address, &si);
 
-    if (!FindSymbol(address, symbols, &si)) {
-        if (ctx.profiling.uniqueSymbols < MAX_SYMBOLS) {
-            AddSymbol(address, symbols, &si);
-        } else {
-            puts("Too many unique symbols");
-        }
+    const uint32 key = GetSymbolKey(si.moduleName, si.functionName);
+
+    if (!key) {
+        puts("Failed to intern symbol name");
+        return;
+    }
+
+    const uint32* found = HashMapGet(&symbolIndex.symbols, key);
+
+    if (found) {
+        symbols[*found - 1].count++;
+        return;
+    }
+
+    size_t index = ctx.profiling.uniqueSymbols;
+    size_t error = 0;
+
+    if (index >= MAX_SYMBOLS) {
+        index = FindSmallestSymbol(symbols);
+        error = symbols[index].count;
+
+        HashMapRemove(&symbolIndex.symbols, GetSymbolKey(symbols[index].moduleName, symbols[index].functionName));
+        ctx.profiling.evictedSymbols++;
+    }
+
+    uint32* slot = HashMapAdd(&symbolIndex.symbols, key);
+
+    if (!slot) {
+        puts("Failed to grow symbol map");
+        return;
+    }
+
+    SymbolInfo* symbol = &symbols[index];
+
+    snprintf(symbol->moduleName, NAME_LEN, "%s", si.moduleName);
+    snprintf(symbol->functionName, NAME_LEN, "%s", si.functionName);
+    symbol->module = InternString(&symbolIndex.names, si.moduleName);
+    symbol->count = error + 1;
+    symbol->error = error;
+    symbol->address = address;
+
+    if (index == ctx.profiling.uniqueSymbols) {
+        ctx.profiling.uniqueSymbols++;
     }
+
+    *slot = (uint32)index + 1;
 }
 
-static BOOL FindStackTrace(StackTraceSample* sample, StackTrace* traces)
+// Same addresses sampled in different tasks are different stack traces
+static uint32 GetStackTraceKey(struct Task* task, ULONG** addresses, const size_t depth)
 {
-    uint32 id = 0;
-    for (size_t frame = 0; frame < MAX_STACK_DEPTH; frame++) {
-        if (sample->addresses[frame]) {
-            id += (uint32)sample->addresses[frame];
-        } else {
-            break;
-        }
+    uint32 key = HashMapHash((uint32)task);
+
+    for (size_t frame = 0; frame < depth; frame++) {
+        key = HashMapHash(key ^ (uint32)addresses[frame]);
+    }
+
+    return key ? key : 1;
+}
+
+static BOOL IsSameStackTrace(const StackTraceSample* sample, ULONG** addresses, const StackTrace* trace)
+{
+    if (sample->task != trace->task || sample->depth != trace->depth) {
+        return FALSE;
+    }
+
+    return memcmp(addresses, trace->ip, trace->depth * sizeof(ULONG *)) == 0;
+}
+
+static void CountStackTrace(const StackTraceSample* sample, StackTrace* trace)
+{
+    trace->count++;
+
+    if (sample->flags & STACK_TRACE_FORBID) {
+        trace->forbidCount++;
+    }
+
+    if (sample->flags & STACK_TRACE_SUPERVISOR) {
+        trace->supervisorCount++;
+    }
+
+    if (sample->flags & STACK_TRACE_USER) {
+        trace->userCount++;
+    }
+}
+
+static BOOL FindStackTrace(const StackTraceSample* sample, ULONG** addresses, StackTrace* traces, const HashMap* traceMap, const uint32 key)
+{
+    const uint32* index = HashMapGet(traceMap, key);
+
+    if (!index) {
+        return FALSE;
+    }
+
+    // Map stores index + 1
+    if (IsSameStackTrace(sample, addresses, &traces[*index - 1])) {
+        CountStackTrace(sample, &traces[*index - 1]);
+        return TRUE;
     }
 
+    // Key collision, rare enough for a linear search
     for (size_t i = 0; i < ctx.profiling.uniqueStackTraces; i++) {
-        if (traces[i].id == id) {
-            traces[i].count++;
-            //printf("%s - id %lu, count %u\n", __func__, id, traces[i].count);
+        if (IsSameStackTrace(sample, addresses, &traces[i])) {
+            CountStackTrace(sample, &traces[i]);
             return TRUE;
         }
     }
@@ -132,28 +494,75 @@ static BOOL FindStackTrace(StackTraceSample* sample, StackTrace* traces)
     return FALSE;
 }
 
-static void AddStackTrace(StackTraceSample* sample, StackTrace* traces, SymbolInfo* symbols)
+static void SetStackTrace(const StackTraceSample* sample, ULONG** addresses, StackTrace* t, SymbolInfo* symbols)
 {
-    StackTrace* t = &traces[ctx.profiling.uniqueStackTraces];
     t->id = 0; // TODO: is hash needed?
     t->task = sample->task;
     t->count = 1;
-
-    for (size_t frame = 0; frame < MAX_STACK_DEPTH; frame++) {
-        t->ip[frame] = sample->addresses[frame];
-        if (t->ip[frame]) {
-            t->id += (uint32)t->ip[frame];
-            if (frame == 0) {
-                AddUniqueSymbol(t->ip[frame], symbols);
-            }
-        } else {
-            break;
+    t->error = 0;
+    t->forbidCount = (sample->flags & STACK_TRACE_FORBID) ? 1 : 0;
+    t->supervisorCount = (sample->flags & STACK_TRACE_SUPERVISOR) ? 1 : 0;
+    t->userCount = (sample->flags & STACK_TRACE_USER) ? 1 : 0;
+    t->depth = sample->depth;
+    t->ip = t->depth ? addresses : NULL; // Frame arena doesn't change after sampling
+
+    for (size_t frame = 0; frame < t->depth; frame++) {
+        t->id += (uint32)t->ip[frame];
+        if (frame == 0) {
+            AddUniqueSymbol(t->ip[frame], symbols);
         }
     }
 
     //printf("%s - id %lu\n", __func__, t->id);
+}
+
+static size_t FindSmallestStackTrace(const StackTrace* traces)
+{
+    size_t smallest = 0;
+
+    for (size_t i = 1; i < ctx.profiling.uniqueStackTraces; i++) {
+        if (traces[i].count < traces[smallest].count) {
+            smallest = i;
+        }
+    }
+
+    return smallest;
+}
+
+// Stack traces are kept with Space-Saving too, see FindSmallestSymbol()
+static void AddStackTrace(const StackTraceSample* sample, ULONG** addresses, StackTrace* traces, SymbolInfo* symbols,
+                          HashMap* traceMap, const uint32 key)
+{
+    size_t index = ctx.profiling.uniqueStackTraces;
+    size_t error = 0;
+
+    if (index >= MAX_STACK_TRACES) {
+        index = FindSmallestStackTrace(traces);
+        error = traces[index].count;
+
+        // Colliding keys may map to another stack trace
+        const StackTrace* old = &traces[index];
+        const uint32 oldKey = GetStackTraceKey(old->task, old->ip, old->depth);
+        const uint32* mapped = HashMapGet(traceMap, oldKey);
+
+        if (mapped && *mapped == index + 1) {
+            HashMapRemove(traceMap, oldKey);
+        }
+
+        ctx.profiling.evictedStackTraces++;
+    } else {
+        ctx.profiling.uniqueStackTraces++;
+    }
 
-   ++ctx.profiling.uniqueStackTraces;
+    uint32* slot = HashMapAdd(traceMap, key);
+    if (slot && *slot == 0) {
+        *slot = (uint32)index + 1;
+    }
+
+    SetStackTrace(sample, addresses, &traces[index], symbols);
+
+    traces[index].count += error;
+    traces[index].error = error;
 }
 
 static void AddEmptyStackTrace(SymbolInfo* symbols, StackTrace* traces)
@@ -162,17 +571,39 @@ static void AddEmptyStackTrace(SymbolInfo* symbols, StackTrace* traces)
     // If profiling buffer is only filled partially, it should be there.
     StackTraceSample dummy;
     dummy.task = NULL;
-    dummy.addresses[0] = NULL;
+    dummy.depth = 0;
+    dummy.flags = 0;
+
+    SetStackTrace(&dummy, NULL, &traces[ctx.profiling.uniqueStackTraces++], symbols);
+}
+
+// Number of stack traces in the report, either the ring buffer or the reservoir
+static size_t GetSampleCount(void)
+{
+    return ctx.profiling.reservoirSize ? GetReservoirCount() : ctx.profiling.stackTraces;
+}
 
-    AddStackTrace(&dummy, traces, symbols);
+static const StackTraceSample* GetSample(const size_t index, ULONG*** addresses)
+{
+    if (ctx.profiling.reservoirSize) {
+        const StackTraceSample* sample = GetReservoirSample(index);
+        *addresses = GetReservoirAddresses(sample);
+        return sample;
+    }
+
+    const StackTraceSample* sample = &ctx.profiling.samples[index];
+    *addresses = GetStackTraceAddresses(sample);
+    return sample;
 }
 
 static void PrepareSymbols(SymbolInfo* symbols, StackTrace* traces)
 {
+    const size_t sampleCount = GetSampleCount();
+
     printf("\nPlease wait and do not quit profiled programs...\n");
-    printf("\nProcessing symbol data (stack traces %u)...\n", ctx.profiling.stackTraces);
+    printf("\nProcessing symbol data (stack traces %u)...\n", sampleCount);
 
-    const size_t part = ctx.profiling.stackTraces / 10;
+    const size_t part = sampleCount / 10;
     size_t nextMark = part;
     MyClock start, finish;
 
@@ -180,25 +611,52 @@ static void PrepareSymbols(SymbolInfo* symbols, StackTrace* traces)
         ITimer->ReadEClock(&start.un.clockVal);
     }
 
+    HashMap traceMap;
+    size_t lostStackTraces = 0;
+
+    if (!InitHashMap(&traceMap, MAX_STACK_TRACES * 2)) {
+        puts("Failed to allocate stack trace map");
+        return;
+    }
+
+    if (!InitInternTable(&symbolIndex.names) || !InitHashMap(&symbolIndex.symbols, MAX_SYMBOLS * 2)) {
+        puts("Failed to allocate symbol map");
+        FreeInternTable(&symbolIndex.names);
+        FreeHashMap(&traceMap);
+        return;
+    }
+
     AddEmptyStackTrace(symbols, traces);
 
-    for (size_t trace = 0; trace < ctx.profiling.stackTraces; trace++) {
-        StackTraceSample* sample = &ctx.profiling.samples[trace];
+    for (size_t trace = 0; trace < sampleCount; trace++) {
+        ULONG** addresses;
+        const StackTraceSample* sample = GetSample(trace, &addresses);
 
-        if (!FindStackTrace(sample, traces)) {
-            if (ctx.profiling.uniqueStackTraces < MAX_STACK_TRACES) {
-                AddStackTrace(sample, traces, symbols);
-            } else {
-                puts("Too many unique stack traces");
+        if (!addresses) {
+            // Overwritten by newer, deeper stack traces
+            lostStackTraces++;
+        } else {
+            const uint32 key = GetStackTraceKey(sample->task, addresses, sample->depth);
+
+            if (!FindStackTrace(sample, addresses, traces, &traceMap, key)) {
+                AddStackTrace(sample, addresses, traces, symbols, &traceMap, key);
             }
         }
 
         if (trace >= nextMark) {
-            printf("%u/%u\n", trace, ctx.profiling.stackTraces);
+            printf("%u/%u\n", trace, sampleCount);
             nextMark += part;
         }
     }
 
+    FreeHashMap(&symbolIndex.symbols);
+    FreeInternTable(&symbolIndex.names);
+    FreeHashMap(&traceMap);
+
+    if (lostStackTraces) {
+        printf("%u stack trace(s) were overwritten in the frame arena\n", lostStackTraces);
+    }
+
     if (ctx.debugMode) {
         ITimer->ReadEClock(&finish.un.clockVal);
         const uint64 duration = finish.un.ticks - start.un.ticks;
@@ -231,89 +689,882 @@ static int CompareStackTraces(const void* first, const void* second)
     return 0;
 }
 
-static size_t PrepareModules(SymbolInfo* symbols, const size_t unique, char** moduleNames)
+typedef struct ModuleTotal {
+    uint32 module; // Interned module name
+    const char* name;
+    size_t count; // Samples of all functions in module
+    size_t functions; // Number of functions in module
+    size_t first; // Index of the first function in module order
+} ModuleTotal;
+
+static int CompareModuleTotals(const void* first, const void* second)
+{
+    const ModuleTotal* a = first;
+    const ModuleTotal* b = second;
+
+    if (a->count > b->count) return -1;
+    if (a->count < b->count) return 1;
+
+    return 0;
+}
+
+// Symbols must be sorted by count. Returns number of modules, sorted by cost
+static size_t PrepareModules(const SymbolInfo* symbols, ModuleTotal* modules, size_t* order)
 {
     size_t uniqueModules = 0;
+    HashMap moduleIndices; // Interned module name + 1 -> module index + 1
 
-    for (size_t i = 0; i < unique; i++) {
-        BOOL found = FALSE;
+    if (!InitHashMap(&moduleIndices, 0)) {
+        puts("Failed to allocate module map");
+        return 0;
+    }
 
-        for (size_t m = 0; m < uniqueModules; m++) {
-            if (strcmp(moduleNames[m], symbols[i].moduleName) == 0) {
-                found = TRUE;
-                break;
-            }
+    for (size_t i = 0; i < ctx.profiling.uniqueSymbols; i++) {
+        // Empty string has id 0, which is not a valid key
+        uint32* index = HashMapAdd(&moduleIndices, symbols[i].module + 1);
+
+        if (!index) {
+            puts("Failed to grow module map");
+            break;
         }
 
-        if (!found) {
-            moduleNames[uniqueModules] = strdup(symbols[i].moduleName);
-            if (moduleNames[uniqueModules]) {
-                uniqueModules++;
-            } else {
-                puts("Failed to duplicate module name");
+        if (*index == 0) {
+            ModuleTotal* module = &modules[uniqueModules];
+            module->module = symbols[i].module;
+            module->name = symbols[i].moduleName;
+            module->count = 0;
+            module->functions = 0;
+            *index = (uint32)++uniqueModules;
+        }
+
+        modules[*index - 1].count += symbols[i].count;
+        modules[*index - 1].functions++;
+    }
+
+    qsort(modules, uniqueModules, sizeof(ModuleTotal), CompareModuleTotals);
+
+    // Bucket functions by module, keeping them sorted by count within the module
+    size_t first = 0;
+
+    for (size_t m = 0; m < uniqueModules; m++) {
+        modules[m].first = first;
+        first += modules[m].functions;
+
+        uint32* index = HashMapGet(&moduleIndices, modules[m].module + 1);
+        if (index) {
+            *index = (uint32)m + 1;
+        }
+    }
+
+    size_t* next = AllocateMemory((uniqueModules + 1) * sizeof(size_t));
+
+    if (!next) {
+        puts("Failed to allocate module order buffer");
+        uniqueModules = 0;
+    } else {
+        for (size_t i = 0; i < ctx.profiling.uniqueSymbols; i++) {
+            const uint32* index = HashMapGet(&moduleIndices, symbols[i].module + 1);
+
+            if (index) {
+                const ModuleTotal* module = &modules[*index - 1];
+                order[module->first + next[*index - 1]++] = i;
             }
         }
+
+        FreeMemory(next);
     }
 
+    FreeHashMap(&moduleIndices);
+
     return uniqueModules;
 }
 
-static void ShowByModule(SymbolInfo* symbols)
+static void ShowByModule(const SymbolInfo* symbols)
 {
-    char** moduleNames = AllocateMemory(ctx.profiling.uniqueSymbols * sizeof(char *));
+    ModuleTotal* modules = AllocateMemory((ctx.profiling.uniqueSymbols + 1) * sizeof(ModuleTotal));
+    size_t* order = AllocateMemory((ctx.profiling.uniqueSymbols + 1) * sizeof(size_t));
 
-    if (!moduleNames) {
-        puts("Failed to allocate module name buffer");
-        return;
+    if (!modules || !order) {
+        puts("Failed to allocate module buffers");
+        goto out;
     }
 
-    const size_t uniqueModules = PrepareModules(symbols, ctx.profiling.uniqueSymbols, moduleNames);
+    const size_t uniqueModules = PrepareModules(symbols, modules, order);
 
     printf("\nSorted by module:\n");
 
+    printf("\n%10s %10s %64s\n", "Sample %", "Count", "Module");
+
     for (size_t m = 0; m < uniqueModules; m++) {
-        printf("\n%10s %10s %64s '%s'\n", "Sample %", "Count", "Function in module", moduleNames[m]);
+        const float percentage = 100.0f * (float)modules[m].count / (float)ctx.profiling.validSymbols;
+        printf("%10.2f %10u %64s\n", percentage, modules[m].count, modules[m].name);
+    }
 
-        for (size_t i = 0; i < ctx.profiling.uniqueSymbols; i++) {
-            if (strcmp(moduleNames[m], symbols[i].moduleName) == 0) {
-                const float percentage = 100.0f * (float)symbols[i].count / (float)ctx.profiling.validSymbols;
-                printf("%10.2f %10u %64s\n", percentage, symbols[i].count, symbols[i].functionName);
-            }
+    for (size_t m = 0; m < uniqueModules; m++) {
+        printf("\n%10s %10s %64s '%s'\n", "Sample %", "Count", "Function in module", modules[m].name);
+
+        for (size_t f = 0; f < modules[m].functions; f++) {
+            const SymbolInfo* symbol = &symbols[order[modules[m].first + f]];
+            const float percentage = 100.0f * (float)symbol->count / (float)ctx.profiling.validSymbols;
+            printf("%10.2f %10u %64s\n", percentage, symbol->count, symbol->functionName);
         }
+    }
 
-        free(moduleNames[m]);
+out:
+    if (order) {
+        FreeMemory(order);
     }
 
-    FreeMemory(moduleNames);
+    if (modules) {
+        FreeMemory(modules);
+    }
 }
 
-// TODO: how to deal with similar but not identical stack traces?
-static void ShowByStackTraces(StackTrace* traces)
+typedef struct TaskProfile {
+    uint32 name; // Interned task display name
+    size_t count; // Number of samples
+    size_t empty; // Samples without stack trace
+    size_t supervisor; // Samples in supervisor mode
+    size_t user; // Samples in user mode
+    HashMap leaves; // Innermost address -> number of samples, resolved into functions
+    HashMap functions; // Interned leaf function name -> number of samples
+} TaskProfile;
+
+typedef struct FunctionCount {
+    uint32 name;
+    uint32 count;
+} FunctionCount;
+
+static int CompareTaskProfiles(const void* first, const void* second)
 {
-    printf("\nSorting stack traces...\n");
+    const TaskProfile* a = first;
+    const TaskProfile* b = second;
 
-    qsort(traces, ctx.profiling.uniqueStackTraces, sizeof(StackTrace), CompareStackTraces);
+    if (a->count > b->count) return -1;
+    if (a->count < b->count) return 1;
+
+    return 0;
+}
+
+static int CompareFunctionCounts(const void* first, const void* second)
+{
+    const FunctionCount* a = first;
+    const FunctionCount* b = second;
+
+    if (a->count > b->count) return -1;
+    if (a->count < b->count) return 1;
+
+    return 0;
+}
+
+static BOOL MatchTaskFilter(const char* pattern, const char* name)
+{
+    return !pattern || IDOS->MatchPatternNoCase(pattern, name);
+}
+
+// Shows the highest counts of the name id -> count map, with percentages of total
+static void ShowTopCounts(const HashMap* counts, const size_t total, const InternTable* names)
+{
+    FunctionCount top[MAX_TOP_FUNCTIONS];
+    size_t count = 0;
+
+    // Keep the highest counts in descending order
+    for (size_t slot = 0; slot < counts->capacity; slot++) {
+        if (!counts->keys[slot]) {
+            continue;
+        }
+
+        const FunctionCount function = { counts->keys[slot], counts->values[slot] };
+
+        if (count < MAX_TOP_FUNCTIONS) {
+            top[count++] = function;
+        } else if (function.count > top[count - 1].count) {
+            top[count - 1] = function;
+        } else {
+            continue;
+        }
+
+        qsort(top, count, sizeof(FunctionCount), CompareFunctionCounts);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const float percentage = 100.0f * (float)top[i].count / (float)total;
+        printf("%10.2f %10lu %64s\n", percentage, top[i].count, GetInternedString(names, top[i].name));
+    }
+}
+
+static uint32 GetFunctionName(const ULONG* address, InternTable* names)
+{
+    SymbolInfo si;
+    LookupSymbol(address, &si);
+
+    char name[NAME_LEN];
+    snprintf(name, NAME_LEN, "%s %s", si.moduleName, si.functionName);
+
+    return InternString(names, name);
+}
+
+static uint32 GetLeafFunctionName(const StackTrace* trace, InternTable* names)
+{
+    if (trace->depth == 0) {
+        return InternString(names, "Empty stack trace");
+    }
+
+    return GetFunctionName(trace->ip[0], names);
+}
+
+static void AddFunctionCount(HashMap* functions, const uint32 function, const uint32 samples)
+{
+    if (function) {
+        uint32* count = HashMapAdd(functions, function);
+        if (count) {
+            *count += samples;
+        }
+    }
+}
+
+// Every sample is counted, the unique stack trace table keeps only the top traces
+static size_t PrepareTaskProfiles(TaskProfile* profiles, InternTable* names, const char* pattern)
+{
+    size_t uniqueTasks = 0;
+    HashMap taskNames; // Task -> interned name
+    HashMap taskIndices; // Interned name -> profile index + 1
+
+    if (!InitHashMap(&taskNames, MAX_TASKS) || !InitHashMap(&taskIndices, MAX_TASKS)) {
+        puts("Failed to allocate task maps");
+        FreeHashMap(&taskNames);
+        return 0;
+    }
+
+    const size_t sampleCount = GetSampleCount();
+
+    for (size_t i = 0; i < sampleCount; i++) {
+        ULONG** addresses;
+        const StackTraceSample* sample = GetSample(i, &addresses);
+
+        // Tasks are partitioned by display name, so shell processes are told apart by command name
+        const uint32 name = InternTaskName(sample->task, &taskNames, names);
+
+        if (!name || !MatchTaskFilter(pattern, GetInternedString(names, name))) {
+            continue;
+        }
+
+        uint32* index = HashMapAdd(&taskIndices, name);
+
+        if (!index) {
+            puts("Failed to grow task map");
+            break;
+        }
+
+        if (*index == 0) {
+            if (uniqueTasks >= MAX_TASKS) {
+                puts("Too many unique tasks");
+                continue;
+            }
+
+            TaskProfile* profile = &profiles[uniqueTasks];
+
+            if (!InitHashMap(&profile->leaves, 0) || !InitHashMap(&profile->functions, 0)) {
+                puts("Failed to allocate function map");
+                FreeHashMap(&profile->leaves);
+                continue;
+            }
+
+            profile->name = name;
+            profile->count = 0;
+            profile->empty = 0;
+            profile->supervisor = 0;
+            profile->user = 0;
+            *index = (uint32)++uniqueTasks;
+        }
+
+        TaskProfile* profile = &profiles[*index - 1];
+        profile->count++;
+        profile->supervisor += (sample->flags & STACK_TRACE_SUPERVISOR) ? 1 : 0;
+        profile->user += (sample->flags & STACK_TRACE_USER) ? 1 : 0;
+
+        if (addresses && sample->depth) {
+            AddFunctionCount(&profile->leaves, (uint32)addresses[0], 1);
+        } else {
+            profile->empty++;
+        }
+    }
+
+    // Addresses of the same function are summed by name
+    for (size_t t = 0; t < uniqueTasks; t++) {
+        TaskProfile* profile = &profiles[t];
+
+        for (size_t slot = 0; slot < profile->leaves.capacity; slot++) {
+            if (profile->leaves.keys[slot]) {
+                AddFunctionCount(&profile->functions, GetFunctionName((const ULONG *)profile->leaves.keys[slot], names),
+                                 profile->leaves.values[slot]);
+            }
+        }
+
+        if (profile->empty) {
+            AddFunctionCount(&profile->functions, InternString(names, "Empty stack trace"), (uint32)profile->empty);
+        }
+
+        FreeHashMap(&profile->leaves);
+    }
+
+    FreeHashMap(&taskIndices);
+    FreeHashMap(&taskNames);
+
+    return uniqueTasks;
+}
+
+// Kernel, libraries and devices are system code, everything else belongs to applications
+static BOOL IsSystemModule(const char* name)
+{
+    static const char* const suffixes[] = { ".library", ".device", ".resource", ".kmod", ".gadget", ".class", ".image", ".datatype" };
+
+    if (strcasecmp(name, "Kernel") == 0) {
+        return TRUE;
+    }
+
+    const size_t length = strlen(name);
+
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        const size_t suffixLength = strlen(suffixes[i]);
+
+        if (length >= suffixLength && strcasecmp(name + length - suffixLength, suffixes[i]) == 0) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+typedef enum CpuMode {
+    CPU_SUPERVISOR_SYSTEM,
+    CPU_SUPERVISOR_APPLICATION,
+    CPU_USER_SYSTEM,
+    CPU_USER_APPLICATION,
+    CPU_MODE_COUNT
+} CpuMode;
+
+// Like %sy and %us of top, and split further by the module of the innermost frame.
+// Every sample is counted, the unique stack trace table keeps only the top traces
+static void ShowCpuModes(void)
+{
+    static const char* const modeNames[CPU_MODE_COUNT] = {
+        "Supervisor, system modules",
+        "Supervisor, application modules",
+        "User, system modules",
+        "User, application modules"
+    };
+
+    HashMap supervisorLeaves = { NULL, NULL, 0, 0 }; // Innermost address -> samples in supervisor mode
+    HashMap userLeaves = { NULL, NULL, 0, 0 }; // Innermost address -> samples in user mode
+    size_t modes[CPU_MODE_COUNT] = { 0 };
+    size_t supervisor = 0;
+    size_t user = 0;
+    size_t noFrames = 0;
+
+    if (!InitHashMap(&supervisorLeaves, 0) || !InitHashMap(&userLeaves, 0)) {
+        puts("Failed to allocate CPU mode tables");
+        goto out;
+    }
+
+    const size_t total = GetSampleCount();
+
+    for (size_t i = 0; i < total; i++) {
+        ULONG** addresses;
+        const StackTraceSample* sample = GetSample(i, &addresses);
+        HashMap* leaves;
+
+        if (sample->flags & STACK_TRACE_SUPERVISOR) {
+            supervisor++;
+            leaves = &supervisorLeaves;
+        } else if (sample->flags & STACK_TRACE_USER) {
+            user++;
+            leaves = &userLeaves;
+        } else {
+            continue;
+        }
+
+        if (addresses && sample->depth) {
+            AddFunctionCount(leaves, (uint32)addresses[0], 1);
+        } else {
+            noFrames++;
+        }
+    }
+
+    // Each innermost address is resolved once
+    for (size_t slot = 0; slot < supervisorLeaves.capacity; slot++) {
+        if (supervisorLeaves.keys[slot]) {
+            SymbolInfo si;
+            LookupSymbol((const ULONG *)supervisorLeaves.keys[slot], &si);
+            modes[IsSystemModule(si.moduleName) ? CPU_SUPERVISOR_SYSTEM : CPU_SUPERVISOR_APPLICATION] += supervisorLeaves.values[slot];
+        }
+    }
+
+    for (size_t slot = 0; slot < userLeaves.capacity; slot++) {
+        if (userLeaves.keys[slot]) {
+            SymbolInfo si;
+            LookupSymbol((const ULONG *)userLeaves.keys[slot], &si);
+            modes[IsSystemModule(si.moduleName) ? CPU_USER_SYSTEM : CPU_USER_APPLICATION] += userLeaves.values[slot];
+        }
+    }
+
+    printf("\nCPU mode (sy %.2f%%, us %.2f%%):\n", 100.0f * (float)supervisor / (float)total, 100.0f * (float)user / (float)total);
+    printf("\n%10s %10s %64s\n", "Sample %", "Count", "Mode and module of innermost frame");
+
+    for (size_t m = 0; m < CPU_MODE_COUNT; m++) {
+        printf("%10.2f %10u %64s\n", 100.0f * (float)modes[m] / (float)total, modes[m], modeNames[m]);
+    }
+
+    if (noFrames) {
+        printf("%10.2f %10u %64s\n", 100.0f * (float)noFrames / (float)total, noFrames, "No stack frames");
+    }
+
+    const size_t unknown = total - supervisor - user;
+
+    if (unknown) {
+        printf("%10.2f %10u %64s\n", 100.0f * (float)unknown / (float)total, unknown, "Mode not known");
+    }
+
+out:
+    FreeHashMap(&userLeaves);
+    FreeHashMap(&supervisorLeaves);
+}
+
+static void ShowByTask(void)
+{
+    TaskProfile* profiles = AllocateMemory(MAX_TASKS * sizeof(TaskProfile));
+    char* pattern = NULL;
+    InternTable names;
+
+    if (!InitInternTable(&names)) {
+        puts("Failed to allocate name table");
+        goto out;
+    }
+
+    if (!profiles) {
+        puts("Failed to allocate task profile buffer");
+        goto out;
+    }
+
+    if (ctx.profiling.taskFilter[0]) {
+        const size_t size = 2 * NAME_LEN + 2;
+        pattern = AllocateMemory(size);
+
+        if (!pattern || IDOS->ParsePatternNoCase(ctx.profiling.taskFilter, pattern, size) < 0) {
+            printf("Failed to parse task filter '%s'\n", ctx.profiling.taskFilter);
+            goto out;
+        }
+    }
+
+    const size_t uniqueTasks = PrepareTaskProfiles(profiles, &names, pattern);
+
+    qsort(profiles, uniqueTasks, sizeof(TaskProfile), CompareTaskProfiles);
+
+    printf("\nSorted by task:\n");
+
+    if (pattern) {
+        printf("\n%u task(s) matching '%s'\n", uniqueTasks, ctx.profiling.taskFilter);
+    }
+
+    for (size_t t = 0; t < uniqueTasks; t++) {
+        const float share = 100.0f * (float)profiles[t].count / (float)GetSampleCount();
+
+        printf("\n%10s %10s %64s '%s' (%.2f%% of samples, sy %.2f%%, us %.2f%%)\n", "Sample %", "Count", "Top functions in task",
+               GetInternedString(&names, profiles[t].name), share,
+               100.0f * (float)profiles[t].supervisor / (float)profiles[t].count,
+               100.0f * (float)profiles[t].user / (float)profiles[t].count);
+
+        ShowTopCounts(&profiles[t].functions, profiles[t].count, &names);
+
+        FreeHashMap(&profiles[t].functions);
+    }
+
+out:
+    if (pattern) {
+        FreeMemory(pattern);
+    }
+
+    if (profiles) {
+        FreeMemory(profiles);
+    }
+
+    FreeInternTable(&names);
+}
+
+// Reservoir shares estimate shares of the whole run. Error is the 95% confidence
+// interval of a sampled proportion, 1.96 * sqrt(p * (1 - p) / n). Every reservoir
+// sample is counted, the unique stack trace table keeps only the top traces
+static void ShowEstimates(void)
+{
+    HashMap leaves = { NULL, NULL, 0, 0 }; // Innermost address -> number of samples
+    HashMap functions = { NULL, NULL, 0, 0 }; // Interned leaf function name -> number of samples
+    InternTable names;
+    FunctionCount* counts = NULL;
+    const size_t n = GetReservoirCount();
+    uint32 empty = 0;
+
+    if (!InitInternTable(&names) || !InitHashMap(&functions, 0) || !InitHashMap(&leaves, 0)) {
+        puts("Failed to allocate estimate tables");
+        goto out;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        ULONG** addresses;
+        const StackTraceSample* sample = GetSample(i, &addresses);
+
+        if (!addresses || sample->depth == 0) {
+            empty++;
+            continue;
+        }
+
+        AddFunctionCount(&leaves, (uint32)addresses[0], 1);
+    }
+
+    // Addresses of the same function are summed by name
+    for (size_t slot = 0; slot < leaves.capacity; slot++) {
+        if (leaves.keys[slot]) {
+            AddFunctionCount(&functions, GetFunctionName((const ULONG *)leaves.keys[slot], &names), leaves.values[slot]);
+        }
+    }
+
+    if (empty) {
+        AddFunctionCount(&functions, InternString(&names, "Empty stack trace"), empty);
+    }
+
+    counts = AllocateMemory((functions.count + 1) * sizeof(FunctionCount));
+
+    if (!counts) {
+        puts("Failed to allocate estimate buffer");
+        goto out;
+    }
+
+    size_t count = 0;
+
+    for (size_t slot = 0; slot < functions.capacity; slot++) {
+        if (functions.keys[slot]) {
+            counts[count].name = functions.keys[slot];
+            counts[count].count = functions.values[slot];
+            count++;
+        }
+    }
+
+    qsort(counts, count, sizeof(FunctionCount), CompareFunctionCounts);
+
+    const uint64 seen = GetReservoirSeen();
+
+    printf("\nWhole run estimates from %u of %llu stack traces (1 in %.1f kept):\n", n, seen,
+           n ? (double)seen / (double)n : 0.0);
+
+    printf("\n%10s %10s %12s %64s\n", "Sample %", "+/- 95%", "Est. count", "Innermost function");
+
+    for (size_t i = 0; i < count && i < MAX_ESTIMATES && n; i++) {
+        const double p = (double)counts[i].count / (double)n;
+        const double error = 1.96 * sqrt(p * (1.0 - p) / (double)n);
+
+        printf("%10.2f %10.2f %12.0f %64s\n", 100.0 * p, 100.0 * error, p * (double)seen,
+               GetInternedString(&names, counts[i].name));
+    }
+
+out:
+    if (counts) {
+        FreeMemory(counts);
+    }
+
+    FreeHashMap(&leaves);
+    FreeHashMap(&functions);
+    FreeInternTable(&names);
+}
+
+typedef struct AddressCount {
+    ULONG* address;
+    uint32 count;
+} AddressCount;
+
+static int CompareAddressCounts(const void* first, const void* second)
+{
+    const AddressCount* a = first;
+    const AddressCount* b = second;
+
+    if (a->count > b->count) return -1;
+    if (a->count < b->count) return 1;
+
+    return 0;
+}
+
+static BOOL IsSameFunction(const SymbolInfo* a, const SymbolInfo* b)
+{
+    return strcmp(a->moduleName, b->moduleName) == 0 && strcmp(a->functionName, b->functionName) == 0;
+}
+
+static void ShowHotAddresses(const HashMap* addresses, const size_t total)
+{
+    AddressCount* hot = AllocateMemory((addresses->count + 1) * sizeof(AddressCount));
+
+    if (!hot) {
+        puts("Failed to allocate address buffer");
+        return;
+    }
+
+    size_t count = 0;
+
+    for (size_t slot = 0; slot < addresses->capacity; slot++) {
+        if (addresses->keys[slot]) {
+            hot[count].address = (ULONG *)addresses->keys[slot];
+            hot[count].count = addresses->values[slot];
+            count++;
+        }
+    }
+
+    qsort(hot, count, sizeof(AddressCount), CompareAddressCounts);
+
+    printf("%10s %10s %10s %10s %53s\n", "Sample %", "Count", "Address", "Offset", "Source line");
+
+    for (size_t i = 0; i < count && i < MAX_ANNOTATED_ADDRESSES; i++) {
+        SymbolInfo si;
+        LookupSymbol(hot[i].address, &si);
+
+        char line[NAME_LEN];
+        if (si.line) {
+            snprintf(line, NAME_LEN, "%s:%lu", si.sourceFile, si.line);
+        } else {
+            snprintf(line, NAME_LEN, "Line not available");
+        }
+
+        const float percentage = 100.0f * (float)hot[i].count / (float)total;
+        printf("%10.2f %10lu %10p %#10lx %53s\n", percentage, hot[i].count, (void*)hot[i].address, si.segmentOffset, line);
+    }
+
+    if (count > MAX_ANNOTATED_ADDRESSES) {
+        printf("%u more address(es) not shown\n", count - MAX_ANNOTATED_ADDRESSES);
+    }
+
+    FreeMemory(hot);
+}
+
+// Histogram of sampled innermost addresses for the function
+static void AnnotateFunction(const SymbolInfo* function, const HashMap* leaves)
+{
+    HashMap addresses; // Address -> number of samples
+    size_t total = 0;
+
+    if (!InitHashMap(&addresses, 0)) {
+        puts("Failed to allocate address map");
+        return;
+    }
+
+    for (size_t slot = 0; slot < leaves->capacity; slot++) {
+        if (!leaves->keys[slot]) {
+            continue;
+        }
+
+        SymbolInfo si;
+        LookupSymbol((const ULONG *)leaves->keys[slot], &si);
+
+        if (IsSameFunction(function, &si)) {
+            AddFunctionCount(&addresses, leaves->keys[slot], leaves->values[slot]);
+            total += leaves->values[slot];
+        }
+    }
+
+    printf("\nHot spots in '%s %s' (%u samples):\n", function->moduleName, function->functionName, total);
+
+    if (total) {
+        ShowHotAddresses(&addresses, total);
+    }
+
+    FreeHashMap(&addresses);
+}
+
+// Every sample is counted, the unique stack trace table keeps only the top traces
+static void ShowAnnotated(const SymbolInfo* symbols)
+{
+    HashMap leaves; // Innermost address -> number of samples
+
+    printf("\nAnnotated top functions:\n");
+
+    if (!InitHashMap(&leaves, 0)) {
+        puts("Failed to allocate address map");
+        return;
+    }
+
+    const size_t sampleCount = GetSampleCount();
+
+    for (size_t i = 0; i < sampleCount; i++) {
+        ULONG** addresses;
+        const StackTraceSample* sample = GetSample(i, &addresses);
+
+        if (addresses && sample->depth) {
+            AddFunctionCount(&leaves, (uint32)addresses[0], 1);
+        }
+    }
+
+    for (size_t i = 0; i < ctx.profiling.uniqueSymbols && i < ctx.profiling.annotatedFunctions; i++) {
+        AnnotateFunction(&symbols[i], &leaves);
+    }
+
+    FreeHashMap(&leaves);
+}
+
+static void ShowFrames(const StackTrace* trace)
+{
+    for (size_t frame = 0; frame < trace->depth; frame++) {
+        if (IS_REPEAT_MARKER(trace->ip[frame])) {
+            printf("  Frame %u repeated %lu more times\n", frame - 1, REPEAT_COUNT(trace->ip[frame]));
+            continue;
+        }
+
+        SymbolInfo si;
+        LookupSymbol(trace->ip[frame], &si);
+        printf("  Frame %u, ip %p - %s @ %s\n", frame, (void*)trace->ip[frame], si.functionName, si.moduleName);
+    }
+}
+
+// TODO: how to deal with similar but not identical stack traces?
+static void ShowByStackTraces(StackTrace* traces)
+{
+    printf("\nSorting stack traces...\n");
+
+    qsort(traces, ctx.profiling.uniqueStackTraces, sizeof(StackTrace), CompareStackTraces);
 
     printf("\nUnique stack traces:\n");
 
     for (size_t i = 0; i < ctx.profiling.uniqueStackTraces; i++) {
         SampleInfo sampleInfo = InitializeTaskData(traces[i].task);
-        printf("\nStack trace %u (count %u - %.2f%% - context %s (%p)):\n", i, traces[i].count, 100.0f * (float)traces[i].count / (float)ctx.profiling.stackTraces, sampleInfo.nameBuffer, (void*)traces[i].task);
+        printf("\nStack trace %u (count %u - %.2f%% - context %s (%p)):\n", i, traces[i].count, 100.0f * (float)traces[i].count / (float)GetSampleCount(), sampleInfo.nameBuffer, (void*)traces[i].task);
+        if (traces[i].error) {
+            printf("  Count may be overestimated by %u\n", traces[i].error);
+        }
+
         if (traces[i].id == 0) {
             printf("  Empty stack trace\n");
         }
 
-        for (size_t frame = 0; frame < MAX_STACK_DEPTH; frame++) {
-            const uint32* const ip = traces[i].ip[frame];
-            if (ip) {
-                SymbolInfo si;
-                Symbol(ip, &si);
-                printf("  Frame %u, ip %p - %s @ %s\n", frame, (void*)traces[i].ip[frame], si.functionName, si.moduleName);
-            } else {
-                break;
-            }
+        ShowFrames(&traces[i]);
+    }
+}
+
+static int CompareForbidCounts(const void* first, const void* second)
+{
+    const StackTrace* a = *(const StackTrace* const *)first;
+    const StackTrace* b = *(const StackTrace* const *)second;
+
+    if (a->forbidCount > b->forbidCount) return -1;
+    if (a->forbidCount < b->forbidCount) return 1;
+
+    return 0;
+}
+
+// Code running with task switching disabled delays all other tasks. Disable()d code
+// can't be seen here, because it blocks the sampling interrupt too. Every sample is
+// counted, the unique stack trace table is used only for the top code paths
+static void ShowForbidden(const StackTrace* traces)
+{
+    HashMap taskNames = { NULL, NULL, 0, 0 }; // Task -> interned name
+    HashMap tasks = { NULL, NULL, 0, 0 }; // Interned task name -> samples in Forbid
+    HashMap leaves = { NULL, NULL, 0, 0 }; // Innermost address -> samples in Forbid
+    HashMap functions = { NULL, NULL, 0, 0 }; // Interned leaf function name -> samples in Forbid
+    InternTable names;
+    const StackTrace** paths = NULL;
+    size_t total = 0;
+    size_t pathCount = 0;
+    uint32 empty = 0;
+
+    printf("\nRunning with task switching disabled (Forbid):\n");
+
+    if (!InitInternTable(&names) ||
+        !InitHashMap(&taskNames, MAX_TASKS) ||
+        !InitHashMap(&tasks, MAX_TASKS) ||
+        !InitHashMap(&leaves, 0) ||
+        !InitHashMap(&functions, 0)) {
+        puts("Failed to allocate Forbid tables");
+        goto out;
+    }
+
+    paths = AllocateMemory((ctx.profiling.uniqueStackTraces + 1) * sizeof(StackTrace *));
+
+    if (!paths) {
+        puts("Failed to allocate Forbid code path buffer");
+        goto out;
+    }
+
+    const size_t sampleCount = GetSampleCount();
+
+    for (size_t i = 0; i < sampleCount; i++) {
+        ULONG** addresses;
+        const StackTraceSample* sample = GetSample(i, &addresses);
+
+        if (!(sample->flags & STACK_TRACE_FORBID)) {
+            continue;
+        }
+
+        total++;
+
+        AddFunctionCount(&tasks, InternTaskName(sample->task, &taskNames, &names), 1);
+
+        if (addresses && sample->depth) {
+            AddFunctionCount(&leaves, (uint32)addresses[0], 1);
+        } else {
+            empty++;
+        }
+    }
+
+    if (!total) {
+        printf("\nNo stack traces collected in Forbid\n");
+        goto out;
+    }
+
+    // Addresses of the same function are summed by name
+    for (size_t slot = 0; slot < leaves.capacity; slot++) {
+        if (leaves.keys[slot]) {
+            AddFunctionCount(&functions, GetFunctionName((const ULONG *)leaves.keys[slot], &names), leaves.values[slot]);
+        }
+    }
+
+    if (empty) {
+        AddFunctionCount(&functions, InternString(&names, "Empty stack trace"), empty);
+    }
+
+    printf("\n%u of %u stack trace(s) (%.2f%%) collected in Forbid\n", total, sampleCount,
+           100.0f * (float)total / (float)sampleCount);
+
+    printf("\n%10s %10s %64s\n", "Forbid %", "Count", "Task");
+    ShowTopCounts(&tasks, total, &names);
+
+    printf("\n%10s %10s %64s\n", "Forbid %", "Count", "Innermost function");
+    ShowTopCounts(&functions, total, &names);
+
+    for (size_t i = 0; i < ctx.profiling.uniqueStackTraces; i++) {
+        if (traces[i].forbidCount) {
+            paths[pathCount++] = &traces[i];
         }
     }
+
+    qsort(paths, pathCount, sizeof(StackTrace *), CompareForbidCounts);
+
+    printf("\nTop code paths in Forbid:\n");
+
+    for (size_t i = 0; i < pathCount && i < MAX_TOP_FUNCTIONS; i++) {
+        SampleInfo sampleInfo = InitializeTaskData(paths[i]->task);
+        printf("\nCode path %u (count %u - %.2f%% of Forbid - context %s):\n", i, paths[i]->forbidCount,
+               100.0f * (float)paths[i]->forbidCount / (float)total, sampleInfo.nameBuffer);
+
+        if (paths[i]->depth == 0) {
+            printf("  Empty stack trace\n");
+        }
+
+        ShowFrames(paths[i]);
+    }
+
+out:
+    if (paths) {
+        FreeMemory(paths);
+    }
+
+    FreeHashMap(&functions);
+    FreeHashMap(&leaves);
+    FreeHashMap(&tasks);
+    FreeHashMap(&taskNames);
+    FreeInternTable(&names);
 }
 
 static void ShowStatistics(void)
@@ -322,16 +1573,112 @@ static void ShowStatistics(void)
     printf("  %u stack frame loop(s) detected\n", ctx.profiling.stackFrameLoopDetected);
     printf("  %u stack frame alignment issue(s) detected\n", ctx.profiling.stackFrameNotAligned);
     printf("  %u stack frame out-of-bound issue(s) detected\n", ctx.profiling.stackFrameOutOfBounds);
+    printf("  %u stack trace(s) truncated at depth %lu\n", ctx.profiling.stackTracesTruncated, ctx.profiling.maxDepth);
+    printf("  %u stack trace(s) walked from the saved stack pointer\n", ctx.profiling.savedContextWalks);
+    printf("  %u link register frame(s) dropped as the sampled function itself\n", ctx.profiling.linkRegisterFramesDropped);
+
+    if (ctx.profiling.totalStackTraces && ctx.profiling.savedContextWalks == ctx.profiling.totalStackTraces) {
+        puts("  Interrupted registers were never available, executing functions are missing from stack traces");
+    }
+
+    // Space-Saving bound: no count is overestimated by more than total / table size
+    if (ctx.profiling.evictedStackTraces) {
+        printf("  %u stack trace(s) replaced to keep the top %u, counts overestimated by at most %u\n",
+               ctx.profiling.evictedStackTraces, MAX_STACK_TRACES, GetSampleCount() / MAX_STACK_TRACES);
+    }
+
+    if (ctx.profiling.evictedSymbols) {
+        printf("  %u symbol(s) replaced to keep the top %u, counts overestimated by at most %u\n",
+               ctx.profiling.evictedSymbols, MAX_SYMBOLS, ctx.profiling.validSymbols / MAX_SYMBOLS);
+    }
+
+    printf("\nStack depth histogram:\n");
+
+    for (size_t depth = 0; depth <= ctx.profiling.maxDepth; depth++) {
+        const size_t count = ctx.profiling.depthHistogram[depth];
+
+        if (count) {
+            const float percentage = 100.0f * (float)count / (float)ctx.profiling.totalStackTraces;
+            printf("  Depth %3u: %10u (%6.2f%%)\n", depth, count, percentage);
+        }
+    }
+}
+
+static void FreeSymbolCache(void)
+{
+    if (cache.lock) {
+        IExec->FreeSysObject(ASOT_SEMAPHORE, cache.lock);
+        cache.lock = NULL;
+    }
+
+    if (cache.entries) {
+        FreeMemory(cache.entries);
+        cache.entries = NULL;
+    }
+
+    FreeHashMap(&cache.addresses);
+    FreeInternTable(&cache.strings);
+
+    cache.count = 0;
+    cache.capacity = 0;
+    cache.hand = 0;
+    cache.generation = 0;
+}
+
+static BOOL InitSymbolCache(void)
+{
+    cache.lock = IExec->AllocSysObjectTags(ASOT_SEMAPHORE, TAG_DONE);
+
+    if (!cache.lock ||
+        !InitHashMap(&cache.addresses, 0) ||
+        !InitInternTable(&cache.strings) ||
+        !GrowCache()) {
+        FreeSymbolCache();
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOL OpenSymbols(void)
+{
+    if (!IDebug) {
+        IDebug = (struct DebugIFace *)IExec->GetInterface((struct Library *)SysBase, "debug", 1, NULL);
+
+        if (!IDebug) {
+            return FALSE;
+        }
+
+        if (!InitSymbolCache()) {
+            // Symbols still work, only slower
+            puts("Failed to allocate symbol cache");
+        }
+    }
+
+    symbolUsers++;
+
+    return TRUE;
+}
+
+void CloseSymbols(void)
+{
+    if (symbolUsers > 0 && --symbolUsers == 0) {
+        FreeSymbolCache();
+        FreeDemangler();
+
+        IExec->DropInterface((struct Interface *)IDebug);
+        IDebug = NULL;
+    }
 }
 
 void ShowSymbols(void)
 {
-    IDebug = (struct DebugIFace *)IExec->GetInterface((struct Library *)SysBase, "debug", 1, NULL);
+    const BOOL symbolsOpen = OpenSymbols();
 
     SymbolInfo* symbols = AllocateMemory(sizeof(SymbolInfo) * MAX_SYMBOLS);
     StackTrace* traces = AllocateMemory(sizeof(StackTrace) * MAX_STACK_TRACES);
 
-    if (!IDebug) {
+    if (!symbolsOpen) {
         puts("Failed to get IDebug");
         goto out;
     }
@@ -348,6 +1695,26 @@ void ShowSymbols(void)
 
     PrepareSymbols(symbols, traces);
 
+    if (ctx.profiling.foldedFile[0]) {
+        WriteFoldedStacks(ctx.profiling.foldedFile, traces, ctx.profiling.uniqueStackTraces);
+    }
+
+    if (ctx.profiling.pprofFile[0]) {
+        WritePprofProfile(ctx.profiling.pprofFile, traces, ctx.profiling.uniqueStackTraces);
+    }
+
+    if (ctx.profiling.htmlFile[0]) {
+        WriteFlameGraph(ctx.profiling.htmlFile, traces, ctx.profiling.uniqueStackTraces);
+    }
+
+    if (ctx.profiling.chromeTraceFile[0]) {
+        WriteChromeTrace(ctx.profiling.chromeTraceFile);
+    }
+
+    if (ctx.profiling.speedscopeFile[0]) {
+        WriteSpeedscope(ctx.profiling.speedscopeFile);
+    }
+
     puts("Sorting symbols...");
 
     qsort(symbols, ctx.profiling.uniqueSymbols, sizeof(SymbolInfo), CompareCounts);
@@ -364,6 +1731,19 @@ void ShowSymbols(void)
     }
 
     ShowByModule(symbols);
+    ShowCpuModes();
+    ShowByTask();
+
+    if (ctx.profiling.reservoirSize) {
+        ShowEstimates();
+    }
+
+    ShowForbidden(traces);
+
+    if (ctx.profiling.annotatedFunctions) {
+        ShowAnnotated(symbols);
+    }
+
     ShowByStackTraces(traces);
     ShowStatistics();
 
@@ -371,7 +1751,8 @@ out:
     FreeMemory(traces);
     FreeMemory(symbols);
 
-    IExec->DropInterface((struct Interface *)IDebug);
-    IDebug = NULL;
+    if (symbolsOpen) {
+        CloseSymbols();
+    }
 }
 
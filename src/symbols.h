@@ -1,6 +1,50 @@
 #ifndef SYMBOLS_H
 #define SYMBOLS_H
 
+#include "common.h"
+
+typedef struct SymbolInfo {
+    size_t count;
+    size_t error; // Count may be overestimated by this much after replacing a smaller entry
+    ULONG* address;
+    uint32 module; // Interned module name, groups symbols by module
+    char moduleName[NAME_LEN];
+    char functionName[NAME_LEN];
+    char sourceFile[NAME_LEN];
+    uint32 line; // Source line number, 0 when not available
+    uint32 segmentOffset; // Offset of address in its ELF segment
+} SymbolInfo;
+
+typedef struct StackTrace {
+    uint32 id;
+    struct Task* task;
+    size_t count;
+    size_t error; // Count may be overestimated by this much after replacing a smaller entry
+    size_t forbidCount; // Samples collected with task switching disabled
+    size_t supervisorCount; // Samples of code running in supervisor mode
+    size_t userCount; // Samples of code running in user mode
+    size_t depth; // Number of instruction pointers
+    uint32** ip; // Innermost first, points to the frame arena of stack trace samples
+} StackTrace;
+
+// Symbols can be looked up between these calls. Calls can be nested, resolved symbols
+// are cached until the last CloseSymbols(). ShowSymbols() opens and closes them itself
+BOOL OpenSymbols(void);
+void CloseSymbols(void);
+
+// Resolves the address into the symbol cache without returning it. The address must
+// have been sampled recently, a cached name older than the last ExpireSymbols() is
+// replaced when another module is loaded at the address
+void CacheSymbol(const ULONG* address);
+void ExpireSymbols(void);
+
+// Returns FALSE when debug symbol is not available
+BOOL LookupSymbol(const ULONG* address, SymbolInfo* symbolInfo);
+
+// Link register frames of new stack traces are kept only when they resolve to another
+// function than the sampled one. Called once per display interval before stack traces
+// are counted, and symbols must be open
+void CheckLinkRegisterFrames(void);
 void ShowSymbols(void);
 
 #endif
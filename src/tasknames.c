@@ -0,0 +1,22 @@
+#include "tasknames.h"
+#include "profiler.h"
+
+uint32 InternTaskName(struct Task* task, HashMap* taskNames, InternTable* names)
+{
+    uint32* name = HashMapGet(taskNames, (uint32)task);
+
+    if (name) {
+        return *name;
+    }
+
+    SampleInfo sampleInfo = InitializeTaskData(task);
+
+    const uint32 id = InternString(names, sampleInfo.nameBuffer);
+
+    name = HashMapAdd(taskNames, (uint32)task);
+    if (name) {
+        *name = id;
+    }
+
+    return id;
+}
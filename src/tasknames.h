@@ -0,0 +1,14 @@
+#ifndef TASKNAMES_H
+#define TASKNAMES_H
+
+#include "hashmap.h"
+#include "intern.h"
+
+struct Task;
+
+// Returns the interned name of the task, caching it in taskNames by the task pointer.
+// Task pointers are reused by new tasks, so the caller clears taskNames now and then.
+// Returns 0 on failure, like InternString()
+uint32 InternTaskName(struct Task* task, HashMap* taskNames, InternTable* names);
+
+#endif
@@ -0,0 +1,354 @@
+#include "timeline.h"
+#include "symbols.h"
+#include "profiler.h"
+#include "hashmap.h"
+#include "intern.h"
+#include "version.h"
+#include "timer.h"
+#include "common.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Timeline exports replay the stack trace ring in time order. Consecutive samples
+// are diffed against each other so that a frame is opened when it appears on the
+// stack and closed when it disappears, or when another task gets the CPU.
+
+typedef struct Timeline {
+    InternTable names; // Frame names, frame index is name id - 1
+    HashMap frames; // Address -> frame name id
+    HashMap tasks; // Task -> task index + 1
+    struct Task** taskList; // Indexed by task index
+    size_t taskCount;
+    size_t first; // Ring buffer index of the oldest sample
+    uint64 start; // EClock ticks of the oldest sample
+    FILE* file;
+    BOOL separator; // TRUE when next JSON element needs a preceding comma
+} Timeline;
+
+typedef void (*EventWriter)(Timeline* timeline, BOOL open, size_t task, uint32 frame, double micros);
+
+static const StackTraceSample* GetSample(const Timeline* timeline, const size_t index)
+{
+    return &ctx.profiling.samples[(timeline->first + index) % ctx.profiling.maxStackTraces];
+}
+
+static BOOL InitTimeline(Timeline* timeline)
+{
+    memset(timeline, 0, sizeof(Timeline));
+
+    if (!InitInternTable(&timeline->names) ||
+        !InitHashMap(&timeline->frames, 1024) ||
+        !InitHashMap(&timeline->tasks, MAX_TASKS))
+    {
+        return FALSE;
+    }
+
+    timeline->taskList = AllocateMemory(ctx.profiling.stackTraces * sizeof(struct Task *));
+
+    if (!timeline->taskList) {
+        return FALSE;
+    }
+
+    // Ring buffer is full when it has wrapped around, then the oldest sample is
+    // the one to be overwritten next
+    if (ctx.profiling.stackTraces >= ctx.profiling.maxStackTraces) {
+        timeline->first = ctx.profiling.nextStackTrace;
+    }
+
+    timeline->start = ctx.profiling.lastTimestamp;
+
+    for (size_t i = 1; i < ctx.profiling.stackTraces; i++) {
+        timeline->start -= GetSample(timeline, i)->delta;
+    }
+
+    return TRUE;
+}
+
+static void FreeTimeline(Timeline* timeline)
+{
+    if (timeline->taskList) {
+        FreeMemory(timeline->taskList);
+    }
+
+    FreeHashMap(&timeline->tasks);
+    FreeHashMap(&timeline->frames);
+    FreeInternTable(&timeline->names);
+}
+
+static uint32 GetFrame(Timeline* timeline, ULONG* address)
+{
+    uint32* frame = HashMapGet(&timeline->frames, (uint32)address);
+
+    if (frame) {
+        return *frame;
+    }
+
+    SymbolInfo si;
+    char name[2 * NAME_LEN];
+
+    if (LookupSymbol(address, &si) && si.functionName[0]) {
+        snprintf(name, sizeof(name), "%s`%s", si.moduleName, si.functionName);
+    } else {
+        snprintf(name, sizeof(name), "%p", (void *)address);
+    }
+
+    const uint32 id = InternString(&timeline->names, name);
+
+    frame = HashMapAdd(&timeline->frames, (uint32)address);
+    if (frame) {
+        *frame = id;
+    }
+
+    return id;
+}
+
+static size_t GetTask(Timeline* timeline, struct Task* task)
+{
+    uint32* index = HashMapAdd(&timeline->tasks, (uint32)task);
+
+    if (!index) {
+        return 0;
+    }
+
+    if (!*index) {
+        timeline->taskList[timeline->taskCount] = task;
+        *index = (uint32)++timeline->taskCount;
+    }
+
+    return *index - 1;
+}
+
+// Returns frames of the sample, outermost first
+static size_t GetFrames(Timeline* timeline, const StackTraceSample* sample, uint32* frames)
+{
+    ULONG** addresses = GetStackTraceAddresses(sample);
+
+    if (!addresses) {
+        return 0;
+    }
+
+    ULONG* expanded[MAX_STACK_DEPTH];
+    const size_t depth = ExpandRepeats(addresses, sample->depth, expanded, MAX_STACK_DEPTH);
+
+    for (size_t i = 0; i < depth; i++) {
+        frames[depth - 1 - i] = GetFrame(timeline, expanded[i]);
+    }
+
+    return depth;
+}
+
+// Passing a task limits events to that task. Without writer, only frames and tasks are resolved.
+static void Replay(Timeline* timeline, const struct Task* only, EventWriter writer)
+{
+    uint32 open[MAX_STACK_DEPTH];
+    uint32 frames[MAX_STACK_DEPTH];
+    size_t openDepth = 0;
+    size_t openTask = 0;
+    uint64 time = timeline->start;
+    double micros = 0.0;
+
+    for (size_t i = 0; i < ctx.profiling.stackTraces; i++) {
+        const StackTraceSample* sample = GetSample(timeline, i);
+
+        if (i > 0) {
+            time += sample->delta;
+        }
+
+        micros = TicksToMicros(time - timeline->start);
+
+        const size_t task = GetTask(timeline, sample->task);
+        size_t depth = GetFrames(timeline, sample, frames);
+
+        if (!writer) {
+            continue;
+        }
+
+        if (only && sample->task != only) {
+            depth = 0;
+        }
+
+        size_t common = 0;
+
+        if (task == openTask) {
+            while (common < openDepth && common < depth && open[common] == frames[common]) {
+                common++;
+            }
+        }
+
+        while (openDepth > common) {
+            writer(timeline, FALSE, openTask, open[--openDepth], micros);
+        }
+
+        while (openDepth < depth) {
+            open[openDepth] = frames[openDepth];
+            writer(timeline, TRUE, task, open[openDepth++], micros);
+        }
+
+        openTask = task;
+    }
+
+    // Last sample lasts one sampling period
+    micros += ctx.period;
+
+    while (writer && openDepth > 0) {
+        writer(timeline, FALSE, openTask, open[--openDepth], micros);
+    }
+}
+
+static void WriteJsonString(FILE* file, const char* string)
+{
+    fputc('"', file);
+
+    for (const unsigned char* c = (const unsigned char *)string; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', file);
+            fputc(*c, file);
+        } else if (*c < 0x20) {
+            fprintf(file, "\\u%04x", *c);
+        } else if (*c >= 0x80) {
+            // Task names are Latin-1, JSON has to be Unicode
+            fprintf(file, "\\u%04x", *c);
+        } else {
+            fputc(*c, file);
+        }
+    }
+
+    fputc('"', file);
+}
+
+static void WriteSeparator(Timeline* timeline)
+{
+    if (timeline->separator) {
+        fputs(",\n", timeline->file);
+    }
+
+    timeline->separator = TRUE;
+}
+
+static void WriteTraceEvent(Timeline* timeline, const BOOL open, const size_t task, const uint32 frame, const double micros)
+{
+    WriteSeparator(timeline);
+
+    fputs("{\"name\":", timeline->file);
+    WriteJsonString(timeline->file, GetInternedString(&timeline->names, frame));
+    fprintf(timeline->file, ",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}", open ? "B" : "E", micros, task + 1);
+}
+
+static void WriteTaskName(Timeline* timeline, const size_t task)
+{
+    const SampleInfo sampleInfo = InitializeTaskData(timeline->taskList[task]);
+    WriteJsonString(timeline->file, sampleInfo.nameBuffer);
+}
+
+static void WriteSpeedscopeEvent(Timeline* timeline, const BOOL open, const size_t task __attribute__((unused)), const uint32 frame, const double micros)
+{
+    WriteSeparator(timeline);
+
+    fprintf(timeline->file, "{\"type\":\"%s\",\"frame\":%lu,\"at\":%.3f}", open ? "O" : "C", frame - 1, micros);
+}
+
+static double GetDuration(const Timeline* timeline)
+{
+    return TicksToMicros(ctx.profiling.lastTimestamp - timeline->start) + ctx.period;
+}
+
+BOOL WriteChromeTrace(const char* fileName)
+{
+    Timeline timeline;
+    BOOL success = FALSE;
+
+    if (!InitTimeline(&timeline)) {
+        puts("Failed to allocate timeline");
+        goto out;
+    }
+
+    timeline.file = fopen(fileName, "w");
+
+    if (!timeline.file) {
+        printf("Failed to open '%s' for writing\n", fileName);
+        goto out;
+    }
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", timeline.file);
+
+    Replay(&timeline, NULL, WriteTraceEvent);
+
+    WriteSeparator(&timeline);
+    fputs("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"" VERSION_STRING "\"}}", timeline.file);
+
+    for (size_t task = 0; task < timeline.taskCount; task++) {
+        WriteSeparator(&timeline);
+        fprintf(timeline.file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", task + 1);
+        WriteTaskName(&timeline, task);
+        fputs("}}", timeline.file);
+    }
+
+    fputs("\n]}\n", timeline.file);
+    fclose(timeline.file);
+
+    printf("Wrote timeline of %u samples and %u tasks to '%s'\n", ctx.profiling.stackTraces, timeline.taskCount, fileName);
+    success = TRUE;
+
+out:
+    FreeTimeline(&timeline);
+
+    return success;
+}
+
+BOOL WriteSpeedscope(const char* fileName)
+{
+    Timeline timeline;
+    BOOL success = FALSE;
+
+    if (!InitTimeline(&timeline)) {
+        puts("Failed to allocate timeline");
+        goto out;
+    }
+
+    timeline.file = fopen(fileName, "w");
+
+    if (!timeline.file) {
+        printf("Failed to open '%s' for writing\n", fileName);
+        goto out;
+    }
+
+    // Shared frame list must precede the profiles
+    Replay(&timeline, NULL, NULL);
+
+    fputs("{\"$schema\":\"https://www.speedscope.app/file-format-schema.json\",\n", timeline.file);
+    fputs("\"exporter\":\"" VERSION_STRING "\",\"name\":\"Tequila timeline\",\"activeProfileIndex\":0,\n", timeline.file);
+    fputs("\"shared\":{\"frames\":[\n", timeline.file);
+
+    for (size_t id = 1; id < timeline.names.count; id++) {
+        WriteSeparator(&timeline);
+        fputs("{\"name\":", timeline.file);
+        WriteJsonString(timeline.file, GetInternedString(&timeline.names, (uint32)id));
+        fputc('}', timeline.file);
+    }
+
+    fputs("\n]},\n\"profiles\":[\n", timeline.file);
+
+    // One evented profile per task
+    for (size_t task = 0; task < timeline.taskCount; task++) {
+        fprintf(timeline.file, "%s{\"type\":\"evented\",\"name\":", task ? ",\n" : "");
+        WriteTaskName(&timeline, task);
+        fprintf(timeline.file, ",\"unit\":\"microseconds\",\"startValue\":0,\"endValue\":%.3f,\"events\":[\n", GetDuration(&timeline));
+
+        timeline.separator = FALSE;
+        Replay(&timeline, timeline.taskList[task], WriteSpeedscopeEvent);
+
+        fputs("\n]}", timeline.file);
+    }
+
+    fputs("\n]}\n", timeline.file);
+    fclose(timeline.file);
+
+    printf("Wrote timeline of %u samples and %u tasks to '%s'\n", ctx.profiling.stackTraces, timeline.taskCount, fileName);
+    success = TRUE;
+
+out:
+    FreeTimeline(&timeline);
+
+    return success;
+}
@@ -0,0 +1,9 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <exec/types.h>
+
+BOOL WriteChromeTrace(const char* fileName);
+BOOL WriteSpeedscope(const char* fileName);
+
+#endif
@@ -0,0 +1,129 @@
+#include "waittraces.h"
+#include "symbols.h"
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32 GetKey(const uint32 task, const uint32 object, ULONG** addresses, const size_t depth)
+{
+    uint32 key = HashMapHash(task ^ HashMapHash(object + 1));
+
+    for (size_t frame = 0; frame < depth; frame++) {
+        key = HashMapHash(key ^ (uint32)addresses[frame]);
+    }
+
+    return key ? key : 1;
+}
+
+static BOOL IsSame(const WaitTrace* trace, const uint32 task, const uint32 object, ULONG** addresses, const size_t depth)
+{
+    if (trace->task != task || trace->object != object || trace->depth != depth) {
+        return FALSE;
+    }
+
+    return memcmp(addresses, trace->ip, depth * sizeof(ULONG *)) == 0;
+}
+
+// On a key collision the map keeps pointing to the first trace
+static void MapTrace(WaitTraces* table, const size_t index)
+{
+    const WaitTrace* trace = &table->traces[index];
+    uint32* slot = HashMapAdd(&table->map, GetKey(trace->task, trace->object, trace->ip, trace->depth));
+
+    if (slot && *slot == 0) {
+        *slot = (uint32)index + 1;
+    }
+}
+
+void AddWaitTrace(WaitTraces* table, const uint32 task, const uint32 object, ULONG** addresses, const size_t depth)
+{
+    const uint32* index = HashMapGet(&table->map, GetKey(task, object, addresses, depth));
+
+    if (index && IsSame(&table->traces[*index - 1], task, object, addresses, depth)) {
+        table->traces[*index - 1].count++;
+        return;
+    }
+
+    if (table->count >= table->capacity) {
+        table->droppedSamples++;
+        return;
+    }
+
+    WaitTrace* trace = &table->traces[table->count];
+    trace->task = task;
+    trace->object = object;
+    trace->count = 1;
+    trace->depth = depth;
+    trace->ip = &table->pool[table->count * table->maxDepth];
+
+    if (depth) {
+        memcpy(trace->ip, addresses, depth * sizeof(ULONG *));
+    }
+
+    MapTrace(table, table->count++);
+}
+
+static int CompareWaitTraces(const void* first, const void* second)
+{
+    const WaitTrace* a = first;
+    const WaitTrace* b = second;
+
+    if (a->count > b->count) return -1;
+    if (a->count < b->count) return 1;
+
+    return 0;
+}
+
+void SortWaitTraces(WaitTraces* table)
+{
+    qsort(table->traces, table->count, sizeof(WaitTrace), CompareWaitTraces);
+
+    // Indices moved, later samples still find their stacks
+    ClearHashMap(&table->map);
+
+    for (size_t i = 0; i < table->count; i++) {
+        MapTrace(table, i);
+    }
+}
+
+void ShowWaitTraceFrames(const WaitTrace* trace)
+{
+    if (trace->depth == 0) {
+        printf("  Empty stack trace\n");
+    }
+
+    for (size_t frame = 0; frame < trace->depth; frame++) {
+        SymbolInfo si;
+        LookupSymbol(trace->ip[frame], &si);
+        printf("  Frame %u, ip %p - %s @ %s\n", frame, (void*)trace->ip[frame], si.functionName, si.moduleName);
+    }
+}
+
+BOOL InitWaitTraces(WaitTraces* table, const size_t capacity, const size_t maxDepth)
+{
+    memset(table, 0, sizeof(WaitTraces));
+
+    table->capacity = capacity;
+    table->maxDepth = maxDepth;
+    table->traces = AllocateMemory(capacity * sizeof(WaitTrace));
+    table->pool = AllocateMemory(capacity * maxDepth * sizeof(ULONG *));
+
+    return table->traces && table->pool && InitHashMap(&table->map, 0);
+}
+
+void FreeWaitTraces(WaitTraces* table)
+{
+    FreeHashMap(&table->map);
+
+    if (table->pool) {
+        FreeMemory(table->pool);
+        table->pool = NULL;
+    }
+
+    if (table->traces) {
+        FreeMemory(table->traces);
+        table->traces = NULL;
+    }
+}
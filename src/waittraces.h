@@ -0,0 +1,39 @@
+#ifndef WAITTRACES_H
+#define WAITTRACES_H
+
+#include "hashmap.h"
+
+// Unique stacks of waiting tasks with their counts, for the off-CPU and semaphore
+// reports. A stack is told apart by the task, what it waits for and its frames.
+
+typedef struct WaitTrace {
+    uint32 task; // Interned task name
+    uint32 object; // What the task waits for, like a signal mask or a semaphore index
+    size_t count; // Number of samples waiting here
+    size_t depth; // Number of instruction pointers
+    ULONG** ip; // Innermost first, points to the frame pool
+} WaitTrace;
+
+typedef struct WaitTraces {
+    WaitTrace* traces;
+    ULONG** pool; // Fixed-size record of maxDepth instruction pointers per trace
+    size_t count; // Number of unique stacks
+    size_t capacity; // Maximum number of unique stacks
+    size_t maxDepth;
+    size_t droppedSamples; // Samples not counted because the table was full
+    HashMap map; // Stack key -> trace index + 1
+} WaitTraces;
+
+BOOL InitWaitTraces(WaitTraces* table, size_t capacity, size_t maxDepth);
+void FreeWaitTraces(WaitTraces* table);
+
+// Counts a sample of the stack, copying the frames when the stack is new
+void AddWaitTrace(WaitTraces* table, uint32 task, uint32 object, ULONG** addresses, size_t depth);
+
+// Sorts the stacks by count, most common first
+void SortWaitTraces(WaitTraces* table);
+
+// Prints the frames of the stack with their functions and modules
+void ShowWaitTraceFrames(const WaitTrace* trace);
+
+#endif
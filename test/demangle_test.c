@@ -0,0 +1,139 @@
+#include "demangle.h"
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Expected names are what c++filt from GNU binutils prints
+
+typedef struct DemangleCase {
+    const char* mangled;
+    const char* expected;
+} DemangleCase;
+
+static int failures;
+
+APTR AllocateMemory(size_t size)
+{
+    return calloc(1, size);
+}
+
+void FreeMemory(APTR address)
+{
+    free(address);
+}
+
+static void Expect(const char* name, const DemangleCase* cases, const size_t count)
+{
+    BOOL ok = TRUE;
+
+    for (size_t i = 0; i < count; i++) {
+        const char* result = DemangleSymbol(cases[i].mangled);
+
+        if (strcmp(result, cases[i].expected) != 0) {
+            printf("FAIL %s: %s gave '%s', expected '%s'\n", name, cases[i].mangled, result, cases[i].expected);
+            ok = FALSE;
+        }
+    }
+
+    if (ok) {
+        printf("ok %s\n", name);
+    } else {
+        failures++;
+    }
+}
+
+static void TestPlainNames(void)
+{
+    static const DemangleCase cases[] = {
+        { "main", "main" },
+        { "_start", "_start" },
+        { "_Z", "_Z" }, // Can't be demangled, returned as is
+        { "_Z1", "_Z1" },
+        { "_Z3foo", "foo" }
+    };
+
+    Expect("plain names", cases, sizeof(cases) / sizeof(cases[0]));
+}
+
+static void TestVoidFunctions(void)
+{
+    static const DemangleCase cases[] = {
+        { "_Z1fv", "f()" },
+        { "_ZN3Foo3BarEv", "Foo::Bar()" },
+        { "_ZN3FooC2Ev", "Foo::Foo()" },
+        { "_ZN3FooD0Ev", "Foo::~Foo()" },
+        { "_Z1fPFvvE", "f(void (*)())" }
+    };
+
+    Expect("void functions", cases, sizeof(cases) / sizeof(cases[0]));
+}
+
+static void TestParameters(void)
+{
+    static const DemangleCase cases[] = {
+        { "_Z1fi", "f(int)" },
+        { "_Z1fPKcj", "f(char const*, unsigned int)" },
+        { "_Z1fRKi", "f(int const&)" },
+        { "_ZN2ns1fEPNS_3FooE", "ns::f(ns::Foo*)" },
+        { "_Z1fA10_i", "f(int [10])" }
+    };
+
+    Expect("parameters", cases, sizeof(cases) / sizeof(cases[0]));
+}
+
+static void TestTemplates(void)
+{
+    static const DemangleCase cases[] = {
+        { "_Z3maxIiET_S0_S0_", "int max<int>(int, int)" },
+        { "_ZNSt6vectorIiSaIiEE9push_backERKi", "std::vector<int, std::allocator<int> >::push_back(int const&)" },
+        { "_ZN3FooIcE3getEv", "Foo<char>::get()" },
+        { "_Z1fILi3EEvv", "void f<3>()" }
+    };
+
+    Expect("templates", cases, sizeof(cases) / sizeof(cases[0]));
+}
+
+static void TestQualifiers(void)
+{
+    static const DemangleCase cases[] = {
+        { "_ZNK3Foo3getEv", "Foo::get() const" },
+        { "_ZNVK3Foo3getEv", "Foo::get() const volatile" },
+        { "_ZNR3Foo3getEv", "Foo::get() &" },
+        { "_ZNKO3Foo3getEv", "Foo::get() const &&" },
+        { "_ZZNK3Foo3getEvE3Bar", "Foo::get() const::Bar" }
+    };
+
+    Expect("qualifiers", cases, sizeof(cases) / sizeof(cases[0]));
+}
+
+static void TestCloneSuffixes(void)
+{
+    static const DemangleCase cases[] = {
+        { "_Z1fv.cold", "f() [clone .cold]" },
+        { "_Z1fi.constprop.0", "f(int) [clone .constprop.0]" },
+        { "_Z1fi.isra.0.cold", "f(int) [clone .isra.0] [clone .cold]" },
+        { "_Z1fi.part.0.constprop.1", "f(int) [clone .part.0] [clone .constprop.1]" },
+        { "_ZN3FooC2Ev.cold.12", "Foo::Foo() [clone .cold.12]" },
+        { "_ZNK3Foo3getEv.localalias", "Foo::get() const [clone .localalias]" }
+    };
+
+    Expect("clone suffixes", cases, sizeof(cases) / sizeof(cases[0]));
+}
+
+int main(void)
+{
+    TestPlainNames();
+    TestVoidFunctions();
+    TestParameters();
+    TestTemplates();
+    TestQualifiers();
+    TestCloneSuffixes();
+
+    FreeDemangler();
+
+    printf("%d failure(s)\n", failures);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,24 @@
+#ifndef EXEC_TYPES_H
+#define EXEC_TYPES_H
+
+// Host build of the platform independent sources needs only the basic types
+
+#include <stdint.h>
+
+typedef uint8_t uint8;
+typedef uint32_t uint32;
+typedef uint64_t uint64;
+typedef uint32_t ULONG;
+typedef int16_t BOOL;
+typedef int8_t BYTE;
+typedef void* APTR;
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#endif
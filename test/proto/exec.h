@@ -0,0 +1,8 @@
+#ifndef PROTO_EXEC_H
+#define PROTO_EXEC_H
+
+// Host build of the platform independent sources doesn't call Exec
+
+#include <exec/types.h>
+
+#endif
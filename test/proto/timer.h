@@ -0,0 +1,17 @@
+#ifndef PROTO_TIMER_H
+#define PROTO_TIMER_H
+
+// Host build needs only the EClock value type of the timer device
+
+#include <exec/types.h>
+
+struct Interrupt;
+struct MsgPort;
+struct TimeRequest;
+
+struct EClockVal {
+    uint32 ev_hi;
+    uint32 ev_lo;
+};
+
+#endif
@@ -0,0 +1,276 @@
+#include "stackwalk.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Hand-built PowerPC stacks. Stack grows down, a frame starts with the back chain
+// and the next word holds the return address saved by the function called from
+// the frame owner. The outermost frame has a NULL back chain.
+
+#define STACK_LOWER 0x1000
+#define STACK_WORDS 256
+#define STACK_UPPER (STACK_LOWER + 4 * STACK_WORDS)
+
+// Code addresses: IP_* are sampled instructions, RET_* are return addresses into a function
+#define IP_F 0x200100
+#define RET_F 0x200140 // Into f, after its call to k
+#define RET_G 0x300120 // Into g, after its call to f
+#define RET_H 0x400080 // Into h, after its call to g
+#define RET_MAIN 0x500010 // Into main, after its call to h
+#define IP_R 0x600020
+#define RET_R 0x600050 // Into recursive r, after its call to itself
+
+#define FRAME_MAIN 0x1300
+#define FRAME_H 0x12C0
+#define FRAME_G 0x1280
+#define FRAME_F 0x1240
+
+static uint32 memory[STACK_WORDS];
+static const StackImage image = { memory, STACK_LOWER, STACK_UPPER };
+
+static int failures;
+
+static void SetFrame(const uint32 frame, const uint32 backChain, const uint32 linkRegister)
+{
+    memory[(frame - STACK_LOWER) / 4] = backChain;
+    memory[(frame - STACK_LOWER) / 4 + 1] = linkRegister;
+}
+
+// main -> h -> g, each with a frame. The return address slot of g's frame is set by
+// each test, because it depends on whether f has run its prologue
+static void BuildStack(void)
+{
+    memset(memory, 0, sizeof(memory));
+
+    SetFrame(FRAME_MAIN, 0, RET_MAIN);
+    SetFrame(FRAME_H, FRAME_MAIN, RET_H);
+    SetFrame(FRAME_G, FRAME_H, 0);
+}
+
+static ULONG* Address(const uint32 address)
+{
+    return (ULONG *)(size_t)address;
+}
+
+static void Expect(const char* name, ULONG** addresses, const StackWalk* walk, const uint32* expected,
+                   const size_t depth, const BOOL linkRegisterFrame)
+{
+    BOOL ok = walk->depth == depth && walk->linkRegisterFrame == linkRegisterFrame;
+
+    for (size_t i = 0; ok && i < depth; i++) {
+        ok = addresses[i] == Address(expected[i]);
+    }
+
+    if (!ok) {
+        printf("FAIL %s: depth %u, link register frame %d:", name, (unsigned)walk->depth, walk->linkRegisterFrame);
+        for (size_t i = 0; i < walk->depth; i++) {
+            printf(" %p", (void *)addresses[i]);
+        }
+        printf("\n");
+        failures++;
+    } else {
+        printf("ok %s\n", name);
+    }
+}
+
+// Leaf f has no frame, so its caller g is known only from the link register
+static void TestLeaf(void)
+{
+    BuildStack();
+
+    const StackRegisters registers = { IP_F, RET_G, FRAME_G };
+    const uint32 expected[] = { IP_F, RET_G, RET_H, RET_MAIN };
+    ULONG* addresses[16];
+    StackWalk walk;
+
+    WalkStack(&image, &registers, addresses, 16, &walk);
+    Expect("leaf", addresses, &walk, expected, 4, TRUE);
+}
+
+// Non-leaf f before any call: its prologue saved the link register into g's frame
+static void TestNonLeaf(void)
+{
+    BuildStack();
+    SetFrame(FRAME_F, FRAME_G, 0);
+    memory[(FRAME_G - STACK_LOWER) / 4 + 1] = RET_G;
+
+    const StackRegisters registers = { IP_F, RET_G, FRAME_F };
+    const uint32 expected[] = { IP_F, RET_G, RET_H, RET_MAIN };
+    ULONG* addresses[16];
+    StackWalk walk;
+
+    WalkStack(&image, &registers, addresses, 16, &walk);
+    Expect("non-leaf", addresses, &walk, expected, 4, FALSE);
+}
+
+// Non-leaf f after its call to k returned: the link register points into f itself.
+// The frame is flagged, and symbols tell to drop it
+static void TestNonLeafAfterCall(void)
+{
+    BuildStack();
+    SetFrame(FRAME_F, FRAME_G, RET_F);
+    memory[(FRAME_G - STACK_LOWER) / 4 + 1] = RET_G;
+
+    const StackRegisters registers = { IP_F, RET_F, FRAME_F };
+    const uint32 expected[] = { IP_F, RET_F, RET_G, RET_H, RET_MAIN };
+    const uint32 dropped[] = { IP_F, RET_G, RET_H, RET_MAIN };
+    ULONG* addresses[16];
+    StackWalk walk;
+
+    WalkStack(&image, &registers, addresses, 16, &walk);
+    Expect("non-leaf after call", addresses, &walk, expected, 5, TRUE);
+
+    walk.depth = RemoveFrame(addresses, walk.depth, 1);
+    walk.linkRegisterFrame = FALSE;
+    Expect("non-leaf after call, link register dropped", addresses, &walk, dropped, 4, FALSE);
+}
+
+// Prologue of f after "mflr r0; stw r0,4(r1)" but before "stwu": the stack pointer is
+// still g's frame and the return address is both in the link register and g's frame
+static void TestPrologue(void)
+{
+    BuildStack();
+    memory[(FRAME_G - STACK_LOWER) / 4 + 1] = RET_G;
+
+    const StackRegisters registers = { IP_F, RET_G, FRAME_G };
+    const uint32 expected[] = { IP_F, RET_G, RET_H, RET_MAIN };
+    ULONG* addresses[16];
+    StackWalk walk;
+
+    WalkStack(&image, &registers, addresses, 16, &walk);
+    Expect("prologue", addresses, &walk, expected, 4, TRUE);
+}
+
+// Epilogue of f after "mtlr r0; addi r1,r1,N": the frame of f is gone, the link
+// register is the return address into g and the stale frame below is not walked
+static void TestEpilogue(void)
+{
+    BuildStack();
+    SetFrame(FRAME_F, FRAME_G, RET_F);
+    memory[(FRAME_G - STACK_LOWER) / 4 + 1] = RET_G;
+
+    const StackRegisters registers = { IP_F, RET_G, FRAME_G };
+    const uint32 expected[] = { IP_F, RET_G, RET_H, RET_MAIN };
+    ULONG* addresses[16];
+    StackWalk walk;
+
+    WalkStack(&image, &registers, addresses, 16, &walk);
+    Expect("epilogue", addresses, &walk, expected, 4, TRUE);
+}
+
+// Recursive r called from g, 5 frames deep and sampled in the innermost one before it
+// calls anything. Repeats of the return address into r are collapsed into a marker
+static void TestRecursion(void)
+{
+    BuildStack();
+    memory[(FRAME_G - STACK_LOWER) / 4 + 1] = RET_G;
+
+    uint32 frame = FRAME_G;
+
+    for (int depth = 0; depth < 5; depth++) {
+        // Slot of the innermost frame is not used yet
+        SetFrame(frame - 0x20, frame, depth < 4 ? RET_R : 0);
+        frame -= 0x20;
+    }
+
+    const StackRegisters registers = { IP_R, RET_R, frame };
+    const uint32 expected[] = { IP_R, RET_R, (3 << 1) | 1, RET_G, RET_H, RET_MAIN };
+    ULONG* addresses[16];
+    StackWalk walk;
+
+    WalkStack(&image, &registers, addresses, 16, &walk);
+    Expect("recursion", addresses, &walk, expected, 6, FALSE);
+}
+
+// Without interrupted registers the walk starts from the saved stack pointer
+static void TestSavedContext(void)
+{
+    BuildStack();
+    memory[(FRAME_G - STACK_LOWER) / 4 + 1] = RET_G;
+
+    const StackRegisters registers = { 0, 0, FRAME_G };
+    const uint32 expected[] = { RET_G, RET_H, RET_MAIN };
+    ULONG* addresses[16];
+    StackWalk walk;
+
+    WalkStack(&image, &registers, addresses, 16, &walk);
+    Expect("saved context", addresses, &walk, expected, 3, FALSE);
+}
+
+// Exporters get the repeats back as frames, and a long recursion gives up repeats
+// before any other frame
+static void TestExpandRepeats(void)
+{
+    ULONG* addresses[] = { Address(IP_R), Address(RET_R), REPEAT_MARKER(3), Address(RET_G), Address(RET_MAIN) };
+    ULONG* expanded[16];
+    StackWalk walk;
+
+    memset(&walk, 0, sizeof(walk));
+
+    const uint32 full[] = { IP_R, RET_R, RET_R, RET_R, RET_R, RET_G, RET_MAIN };
+    walk.depth = ExpandRepeats(addresses, 5, expanded, 16);
+    Expect("expand repeats", expanded, &walk, full, 7, FALSE);
+
+    const uint32 limited[] = { IP_R, RET_R, RET_R, RET_G, RET_MAIN };
+    walk.depth = ExpandRepeats(addresses, 5, expanded, 5);
+    Expect("expand repeats, limited", expanded, &walk, limited, 5, FALSE);
+}
+
+static void TestBadFrames(void)
+{
+    ULONG* addresses[16];
+    StackWalk walk;
+
+    BuildStack();
+    SetFrame(FRAME_H, FRAME_H, RET_H);
+
+    const StackRegisters loop = { 0, 0, FRAME_G };
+    WalkStack(&image, &loop, addresses, 16, &walk);
+
+    if (!walk.loopDetected || walk.depth != 2 || walk.truncated) {
+        printf("FAIL back chain loop\n");
+        failures++;
+    } else {
+        printf("ok back chain loop\n");
+    }
+
+    BuildStack();
+    SetFrame(FRAME_H, STACK_UPPER + 0x100, RET_H);
+
+    WalkStack(&image, &loop, addresses, 16, &walk);
+
+    if (!walk.outOfBounds || walk.badFrame != STACK_UPPER + 0x100 || walk.depth != 2) {
+        printf("FAIL out of bounds\n");
+        failures++;
+    } else {
+        printf("ok out of bounds\n");
+    }
+
+    BuildStack();
+
+    WalkStack(&image, &loop, addresses, 2, &walk);
+
+    if (!walk.truncated || walk.depth != 2) {
+        printf("FAIL truncated\n");
+        failures++;
+    } else {
+        printf("ok truncated\n");
+    }
+}
+
+int main(void)
+{
+    TestLeaf();
+    TestNonLeaf();
+    TestNonLeafAfterCall();
+    TestPrologue();
+    TestEpilogue();
+    TestRecursion();
+    TestSavedContext();
+    TestExpandRepeats();
+    TestBadFrames();
+
+    printf("%d failure(s)\n", failures);
+
+    return failures ? 1 : 0;
+}